@@ -33,6 +33,18 @@ struct litepcie_ioctl_icap {
 	uint32_t data;
 };
 
+/*
+ * Batch of 32-bit LMS7002M SPI words, run back-to-back by the driver. Words
+ * without the write bit (bit 31) are reads: they are replaced in place by the
+ * 16-bit value read back.
+ */
+#define LITEPCIE_LMS7002M_SPI_MAX 256
+
+struct litepcie_ioctl_lms7002m_spi {
+	uint32_t count; /* 1 to LITEPCIE_LMS7002M_SPI_MAX */
+	__u64 words; /* pointer to the words */
+};
+
 struct litepcie_ioctl_dma_init {
 	uint8_t use_gpu;
 	uint64_t gpu_addr;
@@ -78,11 +90,32 @@ struct litepcie_ioctl_mmap_dma_update {
 	int64_t sw_count;
 };
 
+struct litepcie_ioctl_mmap_dma_status_info {
+	uint64_t dma_status_offset;
+	uint64_t dma_status_size;
+};
+
+/*
+ * DMA status page, shared with userspace through mmap. The hw_counts are
+ * published by the interrupt handler, while userspace can retire buffers by
+ * storing sw_counts (instead of using the MMAP_DMA_*_UPDATE ioctls); these are
+ * picked up by poll and the DMA ioctls. Each side writes its own cache line.
+ */
+struct litepcie_dma_status {
+	/* written by the kernel */
+	int64_t writer_hw_count;
+	int64_t reader_hw_count;
+	/* written by userspace */
+	int64_t writer_sw_count __attribute__((aligned(64)));
+	int64_t reader_sw_count;
+};
+
 #define LITEPCIE_IOCTL 'S'
 
 #define LITEPCIE_IOCTL_REG               _IOWR(LITEPCIE_IOCTL,  0, struct litepcie_ioctl_reg)
 #define LITEPCIE_IOCTL_FLASH             _IOWR(LITEPCIE_IOCTL,  1, struct litepcie_ioctl_flash)
 #define LITEPCIE_IOCTL_ICAP              _IOWR(LITEPCIE_IOCTL,  2, struct litepcie_ioctl_icap)
+#define LITEPCIE_IOCTL_LMS7002M_SPI      _IOW(LITEPCIE_IOCTL,   3, struct litepcie_ioctl_lms7002m_spi)
 
 #define LITEPCIE_IOCTL_DMA_INIT                  _IOW(LITEPCIE_IOCTL,  19, struct litepcie_ioctl_dma_init)
 #define LITEPCIE_IOCTL_DMA                       _IOW(LITEPCIE_IOCTL,  20, struct litepcie_ioctl_dma)
@@ -92,5 +125,6 @@ struct litepcie_ioctl_mmap_dma_update {
 #define LITEPCIE_IOCTL_LOCK                      _IOWR(LITEPCIE_IOCTL, 25, struct litepcie_ioctl_lock)
 #define LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE    _IOW(LITEPCIE_IOCTL,  26, struct litepcie_ioctl_mmap_dma_update)
 #define LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE    _IOW(LITEPCIE_IOCTL,  27, struct litepcie_ioctl_mmap_dma_update)
+#define LITEPCIE_IOCTL_MMAP_DMA_STATUS_INFO      _IOR(LITEPCIE_IOCTL,  28, struct litepcie_ioctl_mmap_dma_status_info)
 
 #endif /* _LINUX_LITEPCIE_H */
@@ -67,6 +67,7 @@ struct litepcie_dma_chan {
 	int64_t writer_hw_count;
 	int64_t writer_hw_count_last;
 	int64_t writer_sw_count;
+	struct litepcie_dma_status *status; /* shared with userspace */
 	uint8_t writer_enable;
 	uint8_t reader_enable;
 	uint8_t writer_lock;
@@ -94,6 +95,7 @@ struct litepcie_device {
 	uint8_t *bar0_addr; /* virtual address of BAR0 */
 	struct litepcie_chan chan[DMA_CHANNEL_COUNT];
 	spinlock_t lock;
+	struct mutex spi_lock; /* serializes LMS7002M SPI batches */
 	int minor_base;
 	int irqs;
 	int channels;
@@ -147,6 +149,22 @@ static void litepcie_disable_interrupt(struct litepcie_device *s, int irq_num)
 	litepcie_writel(s, CSR_PCIE_MSI_ENABLE_ADDR, v);
 }
 
+/* Publish the DMA counters to the status page. */
+static void litepcie_dma_status_publish(struct litepcie_dma_chan *dmachan)
+{
+	WRITE_ONCE(dmachan->status->writer_hw_count, dmachan->writer_hw_count);
+	WRITE_ONCE(dmachan->status->reader_hw_count, dmachan->reader_hw_count);
+	WRITE_ONCE(dmachan->status->writer_sw_count, dmachan->writer_sw_count);
+	WRITE_ONCE(dmachan->status->reader_sw_count, dmachan->reader_sw_count);
+}
+
+/* Pick up the sw_counts userspace stored in the status page. */
+static void litepcie_dma_status_sync(struct litepcie_dma_chan *dmachan)
+{
+	dmachan->writer_sw_count = READ_ONCE(dmachan->status->writer_sw_count);
+	dmachan->reader_sw_count = READ_ONCE(dmachan->status->reader_sw_count);
+}
+
 static int litepcie_dma_init_cpu(struct litepcie_device *s)
 {
 
@@ -248,6 +266,7 @@ static int litepcie_dma_writer_start(struct litepcie_device *s, int chan_num)
 	dmachan->writer_hw_count = 0;
 	dmachan->writer_hw_count_last = 0;
 	dmachan->writer_sw_count = 0;
+	litepcie_dma_status_publish(dmachan);
 
 	/* Start DMA Writer. */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_WRITER_ENABLE_OFFSET, 1);
@@ -275,6 +294,7 @@ static int litepcie_dma_writer_stop(struct litepcie_device *s, int chan_num)
 	dmachan->writer_hw_count = 0;
 	dmachan->writer_hw_count_last = 0;
 	dmachan->writer_sw_count = 0;
+	litepcie_dma_status_publish(dmachan);
 
 	return 0;
 }
@@ -312,6 +332,7 @@ static int litepcie_dma_reader_start(struct litepcie_device *s, int chan_num)
 	dmachan->reader_hw_count = 0;
 	dmachan->reader_hw_count_last = 0;
 	dmachan->reader_sw_count = 0;
+	litepcie_dma_status_publish(dmachan);
 
 	/* start dma reader */
 	litepcie_writel(s, dmachan->base + PCIE_DMA_READER_ENABLE_OFFSET, 1);
@@ -339,6 +360,7 @@ static int litepcie_dma_reader_stop(struct litepcie_device *s, int chan_num)
 	dmachan->reader_hw_count = 0;
 	dmachan->reader_hw_count_last = 0;
 	dmachan->reader_sw_count = 0;
+	litepcie_dma_status_publish(dmachan);
 
 	return 0;
 }
@@ -396,6 +418,7 @@ static irqreturn_t litepcie_interrupt(int irq, void *data)
 			if (chan->dma.reader_hw_count_last > chan->dma.reader_hw_count)
 				chan->dma.reader_hw_count += (1 << (ilog2(DMA_BUFFER_COUNT) + 16));
 			chan->dma.reader_hw_count_last = chan->dma.reader_hw_count;
+			WRITE_ONCE(chan->dma.status->reader_hw_count, chan->dma.reader_hw_count);
 #ifdef DEBUG_MSI
 			dev_dbg(&s->dev->dev, "MSI DMA%d Reader buf: %lld\n", i,
 				chan->dma.reader_hw_count);
@@ -412,6 +435,7 @@ static irqreturn_t litepcie_interrupt(int irq, void *data)
 			if (chan->dma.writer_hw_count_last > chan->dma.writer_hw_count)
 				chan->dma.writer_hw_count += (1 << (ilog2(DMA_BUFFER_COUNT) + 16));
 			chan->dma.writer_hw_count_last = chan->dma.writer_hw_count;
+			WRITE_ONCE(chan->dma.status->writer_hw_count, chan->dma.writer_hw_count);
 #ifdef DEBUG_MSI
 			dev_dbg(&s->dev->dev, "MSI DMA%d Writer buf: %lld\n", i,
 				chan->dma.writer_hw_count);
@@ -451,6 +475,8 @@ static int litepcie_open(struct inode *inode, struct file *file)
 		chan->dma.writer_sw_count = 0;
 	}
 
+	litepcie_dma_status_publish(&chan->dma);
+
 	return 0;
 }
 
@@ -498,6 +524,8 @@ static ssize_t litepcie_read(struct file *file, char __user *data, size_t size,
 	if (!s)
 		return -ENODEV;
 
+	litepcie_dma_status_sync(&chan->dma);
+
 	if (file->f_flags & O_NONBLOCK) {
 		if (chan->dma.writer_hw_count == chan->dma.writer_sw_count)
 			ret = -EAGAIN;
@@ -533,6 +561,8 @@ static ssize_t litepcie_read(struct file *file, char __user *data, size_t size,
 		}
 	}
 
+	WRITE_ONCE(chan->dma.status->writer_sw_count, chan->dma.writer_sw_count);
+
 	if (overflows)
 		dev_err(&s->dev->dev, "Reading too late, %d buffers lost\n", overflows);
 
@@ -556,6 +586,8 @@ static ssize_t litepcie_write(struct file *file, const char __user *data, size_t
 	if (!s)
 		return -ENODEV;
 
+	litepcie_dma_status_sync(&chan->dma);
+
 	if (file->f_flags & O_NONBLOCK) {
 		if (chan->dma.reader_hw_count == chan->dma.reader_sw_count)
 			ret = -EAGAIN;
@@ -590,6 +622,8 @@ static ssize_t litepcie_write(struct file *file, const char __user *data, size_t
 		}
 	}
 
+	WRITE_ONCE(chan->dma.status->reader_sw_count, chan->dma.reader_sw_count);
+
 	if (underflows)
 		dev_err(&s->dev->dev, "Writing too late, %d buffers lost\n", underflows);
 
@@ -611,6 +645,18 @@ static int litepcie_mmap(struct file *file, struct vm_area_struct *vma)
 	if (!s)
 		return -ENODEV;
 
+	/* DMA status page */
+	if (vma->vm_pgoff == ((2 * DMA_BUFFER_TOTAL_SIZE) >> PAGE_SHIFT)) {
+		if (vma->vm_end - vma->vm_start != PAGE_SIZE)
+			return -EINVAL;
+		pfn = virt_to_phys(chan->dma.status) >> PAGE_SHIFT;
+		if (remap_pfn_range(vma, vma->vm_start, pfn, PAGE_SIZE, vma->vm_page_prot)) {
+			dev_err(&s->dev->dev, "mmap remap_pfn_range failed\n");
+			return -EAGAIN;
+		}
+		return 0;
+	}
+
 	if (vma->vm_end - vma->vm_start != DMA_BUFFER_TOTAL_SIZE)
 		return -EINVAL;
 
@@ -656,6 +702,8 @@ static unsigned int litepcie_poll(struct file *file, poll_table *wait)
 	poll_wait(file, &chan->wait_rd, wait);
 	poll_wait(file, &chan->wait_wr, wait);
 
+	litepcie_dma_status_sync(&chan->dma);
+
 #ifdef DEBUG_POLL
 	dev_dbg(&s->dev->dev, "poll: writer hw_count: %10lld / sw_count %10lld\n",
 	chan->dma.writer_hw_count, chan->dma.writer_sw_count);
@@ -700,6 +748,36 @@ static int litepcie_flash_spi(struct litepcie_device *s, struct litepcie_ioctl_f
 }
 #endif
 
+#ifdef CSR_LMS7002M_SPI_CONTROL_ADDR
+/* LMS7002M SPI */
+
+#define LMS7002M_SPI_TIMEOUT 1000 /* in us, per word */
+#define LMS7002M_SPI_WRITE (1u << 31)
+
+static int litepcie_lms7002m_spi(struct litepcie_device *s, uint32_t *words, uint32_t count)
+{
+	uint32_t i;
+	int j;
+
+	for (i = 0; i < count; i++) {
+		litepcie_writel(s, CSR_LMS7002M_SPI_MOSI_ADDR, words[i]);
+		litepcie_writel(s, CSR_LMS7002M_SPI_CONTROL_ADDR,
+			SPI_CTRL_START | (32 * SPI_CTRL_LENGTH));
+		/* a word takes a few us, so poll right away */
+		for (j = 0; j < LMS7002M_SPI_TIMEOUT; j++) {
+			if (litepcie_readl(s, CSR_LMS7002M_SPI_STATUS_ADDR) & SPI_STATUS_DONE)
+				break;
+			udelay(1);
+		}
+		if (j == LMS7002M_SPI_TIMEOUT)
+			return -ETIMEDOUT;
+		if (!(words[i] & LMS7002M_SPI_WRITE))
+			words[i] = litepcie_readl(s, CSR_LMS7002M_SPI_MISO_ADDR) & 0xffff;
+	}
+	return 0;
+}
+#endif
+
 static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			   unsigned long arg)
 {
@@ -763,6 +841,44 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 		litepcie_writel(dev, CSR_ICAP_WRITE_ADDR, 1);
 	}
 	break;
+#endif
+#ifdef CSR_LMS7002M_SPI_CONTROL_ADDR
+	case LITEPCIE_IOCTL_LMS7002M_SPI:
+	{
+		struct litepcie_ioctl_lms7002m_spi m;
+		uint32_t *words;
+
+		if (copy_from_user(&m, (void *)arg, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (m.count == 0 || m.count > LITEPCIE_LMS7002M_SPI_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+
+		words = kmalloc_array(m.count, sizeof(*words), GFP_KERNEL);
+		if (!words) {
+			ret = -ENOMEM;
+			break;
+		}
+		if (copy_from_user(words, (void __user *)(uintptr_t)m.words,
+				   m.count * sizeof(*words))) {
+			kfree(words);
+			ret = -EFAULT;
+			break;
+		}
+
+		mutex_lock(&dev->spi_lock);
+		ret = litepcie_lms7002m_spi(dev, words, m.count);
+		mutex_unlock(&dev->spi_lock);
+
+		if (ret == 0 && copy_to_user((void __user *)(uintptr_t)m.words, words,
+					     m.count * sizeof(*words)))
+			ret = -EFAULT;
+		kfree(words);
+	}
+	break;
 #endif
 	case LITEPCIE_IOCTL_DMA_INIT:
 	{
@@ -800,6 +916,8 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			break;
 		}
 
+		litepcie_dma_status_sync(&chan->dma);
+
 		if (m.enable != chan->dma.writer_enable) {
 			/* enable / disable DMA */
 			if (m.enable) {
@@ -833,6 +951,8 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 			break;
 		}
 
+		litepcie_dma_status_sync(&chan->dma);
+
 		if (m.enable != chan->dma.reader_enable) {
 			/* enable / disable DMA */
 			if (m.enable) {
@@ -886,6 +1006,7 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 		}
 
 		chan->dma.writer_sw_count = m.sw_count;
+		WRITE_ONCE(chan->dma.status->writer_sw_count, m.sw_count);
 	}
 	break;
 	case LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE:
@@ -898,6 +1019,20 @@ static long litepcie_ioctl(struct file *file, unsigned int cmd,
 		}
 
 		chan->dma.reader_sw_count = m.sw_count;
+		WRITE_ONCE(chan->dma.status->reader_sw_count, m.sw_count);
+	}
+	break;
+	case LITEPCIE_IOCTL_MMAP_DMA_STATUS_INFO:
+	{
+		struct litepcie_ioctl_mmap_dma_status_info m;
+
+		m.dma_status_offset = 2 * DMA_BUFFER_TOTAL_SIZE;
+		m.dma_status_size = PAGE_SIZE;
+
+		if (copy_to_user((void *)arg, &m, sizeof(m))) {
+			ret = -EFAULT;
+			break;
+		}
 	}
 	break;
 	case LITEPCIE_IOCTL_LOCK:
@@ -1075,6 +1210,7 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 	pci_set_drvdata(dev, litepcie_dev);
 	litepcie_dev->dev = dev;
 	spin_lock_init(&litepcie_dev->lock);
+	mutex_init(&litepcie_dev->spi_lock);
 
 	ret = pcim_enable_device(dev);
 	if (ret != 0) {
@@ -1130,6 +1266,17 @@ static int litepcie_pci_probe(struct pci_dev *dev, const struct pci_device_id *i
 		goto fail1;
 	};
 
+	/* Allocate the DMA status pages (before any interrupt can update them) */
+	for (i = 0; i < DMA_CHANNELS; i++) {
+		litepcie_dev->chan[i].dma.status = (struct litepcie_dma_status *)
+			devm_get_free_pages(&dev->dev, GFP_KERNEL | __GFP_ZERO, 0);
+		if (!litepcie_dev->chan[i].dma.status) {
+			dev_err(&dev->dev, "Failed to allocate DMA status page\n");
+			ret = -ENOMEM;
+			goto fail1;
+		}
+	}
+
 	irqs = pci_alloc_irq_vectors(dev, 1, 32, PCI_IRQ_MSI);
 	if (irqs < 0) {
 		dev_err(&dev->dev, "Failed to enable MSI\n");
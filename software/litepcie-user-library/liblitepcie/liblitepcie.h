@@ -17,6 +17,8 @@ extern "C" {
 #include "litepcie_dma.h"
 #include "litepcie_flash.h"
 #include "litepcie_helpers.h"
+#include "litepcie_recorder.h"
+#include "litepcie_player.h"
 #include "litepcie.h"
 
 #ifdef __cplusplus
@@ -11,6 +11,7 @@
 #include <stdlib.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include "litepcie_dma.h"
 #include "litepcie_helpers.h"
@@ -38,6 +39,39 @@ void litepcie_dma_reader(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_
     *sw_count = m.sw_count;
 }
 
+/* status page */
+
+struct litepcie_dma_status *litepcie_dma_status_mmap(int fd) {
+    struct litepcie_ioctl_mmap_dma_status_info m;
+    void *status;
+
+    /* older drivers don't export the status page */
+    if (ioctl(fd, LITEPCIE_IOCTL_MMAP_DMA_STATUS_INFO, &m) < 0)
+        return NULL;
+
+    status = mmap(NULL, m.dma_status_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                  fd, m.dma_status_offset);
+    if (status == MAP_FAILED)
+        return NULL;
+    return status;
+}
+
+void litepcie_dma_status_munmap(struct litepcie_dma_status *status) {
+    if (status)
+        munmap(status, sysconf(_SC_PAGESIZE));
+}
+
+/* hw_counts are updated asynchronously by the interrupt handler, and sw_counts
+   are picked up by the driver whenever it needs them. */
+
+int64_t litepcie_dma_status_load(const int64_t *count) {
+    return __atomic_load_n(count, __ATOMIC_ACQUIRE);
+}
+
+void litepcie_dma_status_store(int64_t *count, int64_t value) {
+    __atomic_store_n(count, value, __ATOMIC_RELEASE);
+}
+
 /* lock */
 
 uint8_t litepcie_request_dma(int fd, uint8_t reader, uint8_t writer) {
@@ -110,6 +144,8 @@ int litepcie_dma_init(struct litepcie_dma_ctrl *dma, const char *device_name, ui
                 return -1;
             }
         }
+        /* if available, use the status page to avoid ioctls */
+        dma->status = litepcie_dma_status_mmap(dma->fds.fd);
     } else {
         /* else: allocate it */
         if (dma->use_writer) {
@@ -142,6 +178,7 @@ void litepcie_dma_cleanup(struct litepcie_dma_ctrl *dma)
     litepcie_release_dma(dma->fds.fd, dma->use_reader, dma->use_writer);
 
     if (dma->zero_copy) {
+        litepcie_dma_status_munmap(dma->status);
         if (dma->use_reader)
             munmap(dma->buf_wr, dma->mmap_dma_info.dma_tx_buf_size * dma->mmap_dma_info.dma_tx_buf_count);
         if (dma->use_writer)
@@ -160,10 +197,23 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
     int ret;
 
     /* set / get dma */
-    if (dma->use_writer)
-        litepcie_dma_writer(dma->fds.fd, 1, &dma->writer_hw_count, &dma->writer_sw_count);
-    if (dma->use_reader)
-        litepcie_dma_reader(dma->fds.fd, 1, &dma->reader_hw_count, &dma->reader_sw_count);
+    if (dma->status && dma->enabled) {
+        /* already enabled: get the counters without entering the kernel */
+        if (dma->use_writer) {
+            dma->writer_hw_count = litepcie_dma_status_load(&dma->status->writer_hw_count);
+            dma->writer_sw_count = litepcie_dma_status_load(&dma->status->writer_sw_count);
+        }
+        if (dma->use_reader) {
+            dma->reader_hw_count = litepcie_dma_status_load(&dma->status->reader_hw_count);
+            dma->reader_sw_count = litepcie_dma_status_load(&dma->status->reader_sw_count);
+        }
+    } else {
+        if (dma->use_writer)
+            litepcie_dma_writer(dma->fds.fd, 1, &dma->writer_hw_count, &dma->writer_sw_count);
+        if (dma->use_reader)
+            litepcie_dma_reader(dma->fds.fd, 1, &dma->reader_hw_count, &dma->reader_sw_count);
+        dma->enabled = 1;
+    }
 
     /* polling */
     ret = poll(&dma->fds, 1, 100);
@@ -184,7 +234,10 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
 
             /* update dma sw_count*/
             dma->mmap_dma_update.sw_count = dma->writer_sw_count + dma->buffers_available_read;
-            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &dma->mmap_dma_update);
+            if (dma->status)
+                litepcie_dma_status_store(&dma->status->writer_sw_count, dma->mmap_dma_update.sw_count);
+            else
+                checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &dma->mmap_dma_update);
         } else {
             len = read(dma->fds.fd, dma->buf_rd, DMA_BUFFER_TOTAL_SIZE);
             if (len < 0) {
@@ -207,7 +260,10 @@ void litepcie_dma_process(struct litepcie_dma_ctrl *dma)
 
             /* update dma sw_count */
             dma->mmap_dma_update.sw_count = dma->reader_sw_count + dma->buffers_available_write;
-            checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE, &dma->mmap_dma_update);
+            if (dma->status)
+                litepcie_dma_status_store(&dma->status->reader_sw_count, dma->mmap_dma_update.sw_count);
+            else
+                checked_ioctl(dma->fds.fd, LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE, &dma->mmap_dma_update);
 
         } else {
             len = write(dma->fds.fd, dma->buf_wr, DMA_BUFFER_TOTAL_SIZE);
@@ -24,12 +24,19 @@ struct litepcie_dma_ctrl {
     unsigned usr_read_buf_offset, usr_write_buf_offset;
     struct litepcie_ioctl_mmap_dma_info mmap_dma_info;
     struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
+    struct litepcie_dma_status *status; /* NULL if not supported by the driver */
+    uint8_t enabled;
 };
 
 void litepcie_dma_set_loopback(int fd, uint8_t loopback_enable);
 void litepcie_dma_reader(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_count);
 void litepcie_dma_writer(int fd, uint8_t enable, int64_t *hw_count, int64_t *sw_count);
 
+struct litepcie_dma_status *litepcie_dma_status_mmap(int fd);
+void litepcie_dma_status_munmap(struct litepcie_dma_status *status);
+int64_t litepcie_dma_status_load(const int64_t *count);
+void litepcie_dma_status_store(int64_t *count, int64_t value);
+
 uint8_t litepcie_request_dma(int fd, uint8_t reader, uint8_t writer);
 void litepcie_release_dma(int fd, uint8_t reader, uint8_t writer);
 
@@ -0,0 +1,108 @@
+/*
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2020 / EnjoyDigital  / florent@enjoy-digital.fr
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "litepcie_player.h"
+
+/* Granularity of the read-ahead requests, a multiple of the page size. */
+#define PLAYER_CHUNK (1 << 20)
+
+/* Ask the kernel to read the file up to `readahead` bytes past the playback
+   position, from the start of the file again past its end when looping. */
+static void player_advise(struct litepcie_player *player, int loop) {
+    const uint64_t page_mask = sysconf(_SC_PAGESIZE) - 1;
+
+    /* don't fall behind after reads larger than the read-ahead */
+    if (player->advised < player->bytes)
+        player->advised = player->bytes;
+
+    while (player->advised < player->bytes + player->readahead) {
+        uint64_t off = player->advised % player->size;
+        uint64_t len = PLAYER_CHUNK;
+        if (!loop && player->advised - player->bytes >= player->size - player->offset)
+            break;
+        if (len > player->size - off)
+            len = player->size - off;
+        madvise((char *)player->data + (off & ~page_mask), len + (off & page_mask), MADV_WILLNEED);
+        player->advised += len;
+    }
+}
+
+int litepcie_player_open(struct litepcie_player *player, const char *path, uint64_t readahead) {
+    struct stat st;
+    void *data;
+    int ret;
+
+    memset(player, 0, sizeof(*player));
+    player->fd = open(path, O_RDONLY);
+    if (player->fd < 0)
+        return -errno;
+    if (fstat(player->fd, &st) < 0) {
+        ret = -errno;
+        close(player->fd);
+        return ret;
+    }
+    if (st.st_size == 0) {
+        close(player->fd);
+        return -EINVAL;
+    }
+    player->size = st.st_size;
+    player->readahead = readahead;
+
+    /* small files are loaded right away */
+    data = mmap(NULL, player->size, PROT_READ,
+                MAP_SHARED | (player->size <= readahead ? MAP_POPULATE : 0), player->fd, 0);
+    if (data == MAP_FAILED) {
+        ret = -errno;
+        close(player->fd);
+        return ret;
+    }
+    player->data = data;
+
+    player_advise(player, 1);
+    return 0;
+}
+
+/* Copy up to `len` bytes from the playback position to `buf`, continuing from
+   the start of the file at its end if `loop` is set. Returns the number of
+   bytes copied, short only at the end of the file when not looping. */
+size_t litepcie_player_read(struct litepcie_player *player, void *buf, size_t len, int loop) {
+    size_t done = 0;
+
+    while (done < len) {
+        uint64_t n = len - done;
+        if (player->offset == player->size) {
+            if (!loop)
+                break;
+            player->offset = 0;
+            player->loops++;
+        }
+        if (n > player->size - player->offset)
+            n = player->size - player->offset;
+        memcpy((char *)buf + done, player->data + player->offset, n);
+        player->offset += n;
+        player->bytes += n;
+        done += n;
+    }
+
+    player_advise(player, loop);
+    return done;
+}
+
+void litepcie_player_close(struct litepcie_player *player) {
+    munmap((void *)player->data, player->size);
+    close(player->fd);
+    player->data = NULL;
+    player->fd = -1;
+}
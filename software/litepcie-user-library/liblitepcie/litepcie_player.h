@@ -0,0 +1,45 @@
+/*
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2020 / EnjoyDigital  / florent@enjoy-digital.fr
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef LITEPCIE_LIB_PLAYER_H
+#define LITEPCIE_LIB_PLAYER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Playback of a file into DMA buffers.
+ *
+ * The file is memory-mapped and copied straight into the DMA buffers, without
+ * going through a stdio buffer. To keep disk latency off the TX path, the
+ * kernel is asked to read `readahead` bytes ahead of the playback position,
+ * wrapping around to the start of the file when looping, so that the next
+ * loop starts from pages already in memory instead of stalling on a rewind.
+ *
+ * Files up to `readahead` bytes are loaded in full when opened. */
+
+struct litepcie_player {
+    int fd;
+    const char *data;
+    uint64_t size;
+    uint64_t readahead;
+
+    /* playback position in the file, and how far ahead reading was
+       requested, counted like `bytes` from the start of the first loop */
+    uint64_t offset;
+    uint64_t advised;
+
+    /* statistics: loops completed, and bytes played */
+    uint64_t loops, bytes;
+};
+
+int litepcie_player_open(struct litepcie_player *player, const char *path, uint64_t readahead);
+size_t litepcie_player_read(struct litepcie_player *player, void *buf, size_t len, int loop);
+void litepcie_player_close(struct litepcie_player *player);
+
+#endif /* LITEPCIE_LIB_PLAYER_H */
@@ -0,0 +1,310 @@
+/*
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2020 / EnjoyDigital  / florent@enjoy-digital.fr
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* O_DIRECT */
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#include "litepcie_recorder.h"
+
+/* O_DIRECT needs the memory, offsets and sizes to be aligned to the logical
+   block size of the device, which is at most a page. */
+#define RECORDER_ALIGN 4096
+
+/* io_uring, through the raw syscalls */
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+static int recorder_ring_init(struct litepcie_recorder *rec) {
+    struct io_uring_params p;
+    struct iovec *iovecs;
+    unsigned i;
+
+    memset(&p, 0, sizeof(p));
+    rec->ring_fd = sys_io_uring_setup(rec->depth, &p);
+    if (rec->ring_fd < 0)
+        return -errno;
+
+    rec->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    rec->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    rec->sq_ptr = mmap(NULL, rec->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       rec->ring_fd, IORING_OFF_SQ_RING);
+    rec->cq_ptr = mmap(NULL, rec->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       rec->ring_fd, IORING_OFF_CQ_RING);
+    rec->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    rec->sqes = mmap(NULL, rec->sqes_size, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, rec->ring_fd, IORING_OFF_SQES);
+    if (rec->sq_ptr == MAP_FAILED || rec->cq_ptr == MAP_FAILED || rec->sqes == MAP_FAILED)
+        return -ENOMEM;
+
+    rec->sq_head  = (unsigned *)((char *)rec->sq_ptr + p.sq_off.head);
+    rec->sq_tail  = (unsigned *)((char *)rec->sq_ptr + p.sq_off.tail);
+    rec->sq_mask  = (unsigned *)((char *)rec->sq_ptr + p.sq_off.ring_mask);
+    rec->sq_array = (unsigned *)((char *)rec->sq_ptr + p.sq_off.array);
+    rec->cq_head  = (unsigned *)((char *)rec->cq_ptr + p.cq_off.head);
+    rec->cq_tail  = (unsigned *)((char *)rec->cq_ptr + p.cq_off.tail);
+    rec->cq_mask  = (unsigned *)((char *)rec->cq_ptr + p.cq_off.ring_mask);
+    rec->cqes = (struct io_uring_cqe *)((char *)rec->cq_ptr + p.cq_off.cqes);
+
+    /* pinning the slots once saves doing it for every write, but counts
+       against RLIMIT_MEMLOCK, so it is optional */
+    iovecs = calloc(rec->depth, sizeof(*iovecs));
+    if (!iovecs)
+        return -ENOMEM;
+    for (i = 0; i < rec->depth; i++) {
+        iovecs[i].iov_base = rec->slots + (size_t)i * rec->buf_size;
+        iovecs[i].iov_len = rec->buf_size;
+    }
+    rec->fixed = sys_io_uring_register(rec->ring_fd, IORING_REGISTER_BUFFERS, iovecs, rec->depth) == 0;
+    free(iovecs);
+    return 0;
+}
+
+static void recorder_ring_cleanup(struct litepcie_recorder *rec) {
+    if (rec->sqes && rec->sqes != MAP_FAILED)
+        munmap(rec->sqes, rec->sqes_size);
+    if (rec->cq_ptr && rec->cq_ptr != MAP_FAILED)
+        munmap(rec->cq_ptr, rec->cq_size);
+    if (rec->sq_ptr && rec->sq_ptr != MAP_FAILED)
+        munmap(rec->sq_ptr, rec->sq_size);
+    if (rec->ring_fd >= 0)
+        close(rec->ring_fd);
+    rec->sqes = NULL;
+    rec->cq_ptr = rec->sq_ptr = NULL;
+    rec->ring_fd = -1;
+}
+
+/* Reap completed writes, waiting for at least `wait` of them. */
+static int recorder_reap(struct litepcie_recorder *rec, unsigned wait) {
+    unsigned head;
+
+    if (wait > 0 && sys_io_uring_enter(rec->ring_fd, 0, wait, IORING_ENTER_GETEVENTS) < 0 &&
+        errno != EINTR)
+        return -errno;
+
+    head = *rec->cq_head;
+    while (head != __atomic_load_n(rec->cq_tail, __ATOMIC_ACQUIRE)) {
+        const struct io_uring_cqe *cqe = &rec->cqes[head & *rec->cq_mask];
+        /* short writes only happen on a full disk */
+        if (cqe->res < 0)
+            rec->error = cqe->res;
+        else if ((uint64_t)cqe->res < (cqe->user_data >> 32))
+            rec->error = -ENOSPC;
+        rec->free_slots[rec->free_count++] = (uint32_t)cqe->user_data;
+        head++;
+    }
+    __atomic_store_n(rec->cq_head, head, __ATOMIC_RELEASE);
+    return rec->error;
+}
+
+/* files */
+
+static int recorder_open_file(struct litepcie_recorder *rec) {
+    char name[sizeof(rec->path) + 16];
+
+    if (rec->roll_size > 0)
+        snprintf(name, sizeof(name), "%s.%04" PRIu64, rec->path, rec->files);
+    else
+        snprintf(name, sizeof(name), "%s", rec->path);
+
+    /* writes in flight keep their own reference to the previous file */
+    if (rec->fd >= 0)
+        close(rec->fd);
+
+    rec->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    rec->direct = rec->fd >= 0;
+    if (rec->fd < 0 && errno == EINVAL)
+        rec->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (rec->fd < 0)
+        return -errno;
+
+    rec->file_offset = 0;
+    rec->file_size = 0;
+    rec->files++;
+    return 0;
+}
+
+int litepcie_recorder_open(struct litepcie_recorder *rec, const char *path,
+                           size_t buf_size, unsigned depth, uint64_t roll_size) {
+    unsigned i;
+    int ret;
+
+    memset(rec, 0, sizeof(*rec));
+    rec->fd = -1;
+    rec->ring_fd = -1;
+    if (buf_size == 0 || buf_size % RECORDER_ALIGN || depth == 0 ||
+        strlen(path) >= sizeof(rec->path))
+        return -EINVAL;
+    snprintf(rec->path, sizeof(rec->path), "%s", path);
+    rec->buf_size = buf_size;
+    rec->depth = depth;
+    /* files hold whole buffers */
+    rec->roll_size = roll_size / buf_size * buf_size;
+    if (roll_size > 0 && rec->roll_size == 0)
+        rec->roll_size = buf_size;
+
+    rec->slots = mmap(NULL, (size_t)depth * buf_size, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    rec->free_slots = calloc(depth, sizeof(unsigned));
+    if (rec->slots == MAP_FAILED || !rec->free_slots) {
+        rec->slots = NULL;
+        litepcie_recorder_close(rec);
+        return -ENOMEM;
+    }
+    for (i = 0; i < depth; i++)
+        rec->free_slots[i] = depth - 1 - i;
+    rec->free_count = depth;
+
+    if (recorder_ring_init(rec) < 0)
+        recorder_ring_cleanup(rec);
+
+    ret = recorder_open_file(rec);
+    if (ret < 0) {
+        litepcie_recorder_close(rec);
+        return ret;
+    }
+    return 0;
+}
+
+/* Queue `len` bytes (at most a buffer; only the last write can be shorter) for
+   writing, waiting for a free slot if all of them are in flight. */
+int litepcie_recorder_write(struct litepcie_recorder *rec, const void *buf, size_t len) {
+    unsigned slot, tail;
+    size_t aligned;
+    char *data;
+    int ret;
+
+    if (rec->error)
+        return rec->error;
+    if (len > rec->buf_size)
+        return -EINVAL;
+
+    if (rec->roll_size > 0 && rec->file_offset + rec->buf_size > rec->roll_size) {
+        ret = recorder_open_file(rec);
+        if (ret < 0)
+            return rec->error = ret;
+    }
+
+    /* reaping can return early, without a slot, when interrupted */
+    while (rec->ring_fd >= 0 && rec->free_count == 0) {
+        ret = recorder_reap(rec, 1);
+        if (ret < 0)
+            return ret;
+    }
+
+    /* O_DIRECT writes whole blocks; the file is truncated when closed */
+    slot = rec->free_slots[--rec->free_count];
+    data = rec->slots + (size_t)slot * rec->buf_size;
+    memcpy(data, buf, len);
+    aligned = (len + RECORDER_ALIGN - 1) / RECORDER_ALIGN * RECORDER_ALIGN;
+    memset(data + len, 0, aligned - len);
+
+    if (rec->ring_fd >= 0) {
+        struct io_uring_sqe *sqe;
+        tail = *rec->sq_tail;
+        sqe = &rec->sqes[tail & *rec->sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = rec->fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+        sqe->fd = rec->fd;
+        sqe->addr = (uintptr_t)data;
+        sqe->len = aligned;
+        sqe->off = rec->file_offset;
+        sqe->buf_index = slot;
+        sqe->user_data = ((uint64_t)aligned << 32) | slot;
+        rec->sq_array[tail & *rec->sq_mask] = tail & *rec->sq_mask;
+        __atomic_store_n(rec->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        if (sys_io_uring_enter(rec->ring_fd, 1, 0, 0) < 0)
+            return rec->error = -errno;
+        ret = recorder_reap(rec, 0);
+        if (ret < 0)
+            return ret;
+    } else {
+        if (pwrite(rec->fd, data, aligned, rec->file_offset) != (ssize_t)aligned)
+            return rec->error = errno ? -errno : -ENOSPC;
+        rec->free_slots[rec->free_count++] = slot;
+    }
+
+    rec->file_offset += aligned;
+    rec->file_size += len;
+    rec->bytes += len;
+    rec->buffers++;
+    return 0;
+}
+
+/* Log a gap before the next buffer written. */
+int litepcie_recorder_gap(struct litepcie_recorder *rec, uint64_t lost_samples) {
+    if (!rec->gaps) {
+        char name[sizeof(rec->path) + 8];
+        snprintf(name, sizeof(name), "%s.gaps", rec->path);
+        rec->gaps = fopen(name, "w");
+        if (!rec->gaps)
+            return -errno;
+    }
+    fprintf(rec->gaps, "%" PRIu64 " %" PRIu64 " %" PRIu64 "\n",
+            rec->files > 0 ? rec->files - 1 : 0, rec->file_offset, lost_samples);
+    rec->gap_count++;
+    rec->lost_samples += lost_samples;
+    return 0;
+}
+
+/* Wait for the writes in flight and close everything. */
+int litepcie_recorder_close(struct litepcie_recorder *rec) {
+    int ret = rec->error;
+
+    /* the slots can't be unmapped under writes in flight, so keep waiting
+       when interrupted, or after a failed write (which sets rec->error) */
+    while (rec->ring_fd >= 0 && rec->free_count < rec->depth) {
+        unsigned free_count = rec->free_count;
+        int reaped = recorder_reap(rec, rec->depth - rec->free_count);
+        if (ret == 0)
+            ret = reaped;
+        if (reaped < 0 && reaped != rec->error && rec->free_count == free_count)
+            break; /* the ring itself failed */
+    }
+    recorder_ring_cleanup(rec);
+
+    if (rec->fd >= 0) {
+        /* drop the padding of a short final write */
+        if (rec->file_offset != rec->file_size && ftruncate(rec->fd, rec->file_size) < 0 &&
+            ret == 0)
+            ret = -errno;
+        close(rec->fd);
+        rec->fd = -1;
+    }
+    if (rec->gaps) {
+        fclose(rec->gaps);
+        rec->gaps = NULL;
+    }
+    if (rec->slots)
+        munmap(rec->slots, (size_t)rec->depth * rec->buf_size);
+    rec->slots = NULL;
+    free(rec->free_slots);
+    rec->free_slots = NULL;
+    return ret;
+}
@@ -0,0 +1,77 @@
+/*
+ * LitePCIe library
+ *
+ * This file is part of LitePCIe.
+ *
+ * Copyright (C) 2018-2020 / EnjoyDigital  / florent@enjoy-digital.fr
+ * SPDX-License-Identifier: BSD-2-Clause
+ */
+
+#ifndef LITEPCIE_LIB_RECORDER_H
+#define LITEPCIE_LIB_RECORDER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stddef.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+/* Recording of DMA buffers to disk, bypassing the page cache.
+ *
+ * Buffers are copied into a set of aligned slots registered with io_uring, and
+ * written out from there to files opened with O_DIRECT, keeping up to `depth`
+ * writes in flight. The DMA ring itself can't be the source of the writes: it
+ * is mapped as PFN ranges, which O_DIRECT can't pin.
+ *
+ * Files can be rolled every `roll_size` bytes, named `path.0000`, `path.0001`,
+ * etc. Gaps (e.g. after overflows) are logged to `path.gaps`, one line per gap
+ * with the file index, the byte offset in that file and the number of sample
+ * frames lost (a frame holding the samples of all channels at one instant).
+ *
+ * Without io_uring (old kernels, seccomp), the writes are done synchronously
+ * with pwrite, and without O_DIRECT support (e.g. older tmpfs), through the
+ * page cache. */
+
+struct litepcie_recorder {
+    /* configuration */
+    char path[4096];
+    size_t buf_size;
+    unsigned depth;
+    uint64_t roll_size;
+
+    /* current file */
+    int fd;
+    uint8_t direct;
+    uint64_t file_offset;
+    uint64_t file_size;
+
+    /* slots, and the free ones */
+    char *slots;
+    unsigned *free_slots;
+    unsigned free_count;
+
+    /* io_uring, or -1 to write synchronously */
+    int ring_fd;
+    uint8_t fixed;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    struct io_uring_sqe *sqes;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    FILE *gaps;
+    int error;
+
+    /* statistics */
+    uint64_t files, bytes, buffers, gap_count, lost_samples;
+};
+
+int litepcie_recorder_open(struct litepcie_recorder *rec, const char *path,
+                           size_t buf_size, unsigned depth, uint64_t roll_size);
+int litepcie_recorder_write(struct litepcie_recorder *rec, const void *buf, size_t len);
+int litepcie_recorder_gap(struct litepcie_recorder *rec, uint64_t lost_samples);
+int litepcie_recorder_close(struct litepcie_recorder *rec);
+
+#endif /* LITEPCIE_LIB_RECORDER_H */
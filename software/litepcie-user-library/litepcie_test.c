@@ -15,6 +15,7 @@
 #include <fcntl.h>
 #include <math.h>
 #include <signal.h>
+#include <time.h>
 #include "liblitepcie.h"
 
 /* Variables */
@@ -117,25 +118,191 @@ static void litepcie_record(const char *device_name, const char *filename, uint3
         fclose(fo);
 }
 
+/* Direct Record (DMA RX) */
+/*------------------------*/
+
+/* Bytes per sample frame on the wire (2 channels of 8-bit IQ), to count gaps in frames. */
+#define BYTES_PER_FRAME 4
+
+/* Default number of writes in flight. */
+#define RECORD_DEPTH 64
+
+static void litepcie_record_direct(const char *device_name, const char *filename, uint64_t size,
+                                   uint64_t roll_size, unsigned depth, uint8_t zero_copy)
+{
+    static struct litepcie_dma_ctrl dma = {.use_writer = 1};
+    static struct litepcie_recorder rec;
+
+    int i = 0;
+    int ret;
+    size_t len;
+    int64_t last_time;
+    uint64_t bytes_last = 0;
+
+    /* Open File(s) to write to. */
+    ret = litepcie_recorder_open(&rec, filename, DMA_BUFFER_SIZE, depth, roll_size);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
+        exit(1);
+    }
+    printf("Recording with %s, %s\n",
+           rec.ring_fd >= 0 ? (rec.fixed ? "io_uring (registered buffers)" : "io_uring") : "pwrite",
+           rec.direct ? "O_DIRECT" : "page cache");
+
+    /* Initialize DMA. */
+    if (litepcie_dma_init(&dma, device_name, zero_copy))
+        exit(1);
+
+    /* Test Loop. */
+    last_time = get_time_ms();
+    for (;;) {
+        /* Exit loop on CTRL+C. */
+        if (!keep_running)
+            break;
+
+        /* Update DMA status. */
+        litepcie_dma_process(&dma);
+
+        /* Skip buffers the DMA has already overwritten, and log the gap. */
+        if (zero_copy && dma.buffers_available_read > DMA_BUFFER_COUNT) {
+            unsigned lost = dma.buffers_available_read - DMA_BUFFER_COUNT;
+            dma.buffers_available_read -= lost;
+            dma.usr_read_buf_offset = (dma.usr_read_buf_offset + lost) % DMA_BUFFER_COUNT;
+            litepcie_recorder_gap(&rec, (uint64_t)lost * DMA_BUFFER_SIZE / BYTES_PER_FRAME);
+        }
+
+        /* Read from DMA. */
+        while (1) {
+            /* Get Read buffer. */
+            char *buf_rd = litepcie_dma_next_read_buffer(&dma);
+            /* Break when no buffer available for Read. */
+            if (!buf_rd)
+                break;
+            /* Queue Read data for writing. */
+            len = DMA_BUFFER_SIZE;
+            if (size > 0 && size - rec.bytes < len)
+                len = size - rec.bytes;
+            ret = litepcie_recorder_write(&rec, buf_rd, len);
+            if (ret < 0) {
+                fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
+                keep_running = 0;
+                break;
+            }
+            /* Stop when specified size is reached */
+            if (size > 0 && rec.bytes >= size) {
+                keep_running = 0;
+                break;
+            }
+        }
+
+        /* Statistics every 200ms. */
+        int64_t duration = get_time_ms() - last_time;
+        if (duration > 200) {
+            /* Print banner every 10 lines. */
+            if (i % 10 == 0)
+                printf("\e[1mSPEED(Gbps)\t   BUFFERS\tSIZE(MB)\t FILES\t  GAPS\e[0m\n");
+            i++;
+            /* Print statistics. */
+            printf("%10.2f\t%10" PRIu64 "\t%8" PRIu64 "\t%6" PRIu64 "\t%6" PRIu64 "\n",
+                    (double)(rec.bytes - bytes_last) * 8 / ((double)duration * 1e6),
+                    rec.buffers,
+                    rec.bytes / 1024 / 1024,
+                    rec.files,
+                    rec.gap_count);
+            /* Update time/count. */
+            last_time = get_time_ms();
+            bytes_last = rec.bytes;
+        }
+    }
+
+    /* Cleanup DMA. */
+    litepcie_dma_cleanup(&dma);
+
+    /* Flush and close File(s). */
+    ret = litepcie_recorder_close(&rec);
+    if (ret < 0)
+        fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
+}
+
+/* Record Benchmark */
+/*------------------*/
+
+/* Writes `size` bytes of synthetic DMA buffers to `filename`, with fwrite (like
+   record) and with the recorder, to compare the throughput a target sustains. */
+static void litepcie_record_bench(const char *filename, uint64_t size, unsigned depth)
+{
+    static struct litepcie_recorder rec;
+    char *buf;
+    uint64_t done;
+    int64_t start;
+    FILE *fo;
+    int ret;
+
+    buf = malloc(DMA_BUFFER_COUNT * DMA_BUFFER_SIZE);
+    if (!buf)
+        exit(1);
+    for (done = 0; done < (uint64_t)DMA_BUFFER_COUNT * DMA_BUFFER_SIZE; done++)
+        buf[done] = rand();
+
+    printf("\e[1mMETHOD\t\t\t\tSPEED(Gbps)\e[0m\n");
+
+    /* fwrite, flushed to the target. */
+    fo = fopen(filename, "wb");
+    if (!fo) {
+        perror(filename);
+        exit(1);
+    }
+    start = get_time_ms();
+    for (done = 0; done < size && keep_running; done += DMA_BUFFER_SIZE)
+        fwrite(buf + (done / DMA_BUFFER_SIZE % DMA_BUFFER_COUNT) * DMA_BUFFER_SIZE, 1, DMA_BUFFER_SIZE, fo);
+    fflush(fo);
+    fsync(fileno(fo));
+    fclose(fo);
+    printf("%-32s%10.2f\n", "fwrite", (double)done * 8 / ((double)(get_time_ms() - start) * 1e6));
+
+    /* Recorder. */
+    ret = litepcie_recorder_open(&rec, filename, DMA_BUFFER_SIZE, depth, 0);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
+        exit(1);
+    }
+    start = get_time_ms();
+    for (done = 0; done < size && keep_running && ret == 0; done += DMA_BUFFER_SIZE)
+        ret = litepcie_recorder_write(&rec, buf + (done / DMA_BUFFER_SIZE % DMA_BUFFER_COUNT) * DMA_BUFFER_SIZE,
+                                      DMA_BUFFER_SIZE);
+    if (litepcie_recorder_close(&rec) < 0 || ret < 0)
+        fprintf(stderr, "%s: write failed\n", filename);
+    printf("%-16s%-16s%10.2f\n",
+           rec.ring_fd >= 0 || rec.fixed ? "io_uring" : "recorder",
+           rec.direct ? "O_DIRECT" : "page cache",
+           (double)done * 8 / ((double)(get_time_ms() - start) * 1e6));
+
+    free(buf);
+}
+
 /* Play (DMA TX) */
 /*---------------*/
 
+/* Read-ahead of the file played, enough to cover disk hiccups of a few 100ms
+   at full rate. */
+#define PLAY_READAHEAD (64 * 1024 * 1024)
+
 static void litepcie_play(const char *device_name, const char *filename, uint32_t loops, uint8_t zero_copy)
 {
     static struct litepcie_dma_ctrl dma = {.use_reader = 1};
+    static struct litepcie_player player;
 
-    FILE * fo;
     int i = 0;
-    size_t len;
+    int ret;
     int64_t reader_sw_count_last = 0;
     int64_t last_time;
-    uint32_t current_loop = 0;
     uint64_t sw_underflows = 0;
+    uint64_t total_underflows = 0;
 
     /* Open File to read from. */
-    fo = fopen(filename, "rb");
-    if (!fo) {
-        perror(filename);
+    ret = litepcie_player_open(&player, filename, PLAY_READAHEAD);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
         exit(1);
     }
 
@@ -163,16 +330,10 @@ static void litepcie_play(const char *device_name, const char *filename, uint32_
             /* Detect DMA underflows. */
             if (dma.reader_sw_count - dma.reader_hw_count < 0)
                 sw_underflows += (dma.reader_hw_count - dma.reader_sw_count);
-            /* Read data from File and fill Write buffer */
-            len = fread(buf_wr, 1, DMA_BUFFER_SIZE, fo);
-            if (feof(fo)) {
-                /* Rewind on end of file. */
-                current_loop += 1;
-                if (current_loop >= loops)
-                    keep_running = 0;
-                rewind(fo);
-                len += fread(buf_wr + len, 1, DMA_BUFFER_SIZE - len, fo);
-            }
+            /* Fill Write buffer from File, continuing from its start at the end. */
+            litepcie_player_read(&player, buf_wr, DMA_BUFFER_SIZE, 1);
+            if (player.loops >= loops)
+                keep_running = 0;
         }
 
         /* Statistics every 200ms. */
@@ -183,24 +344,103 @@ static void litepcie_play(const char *device_name, const char *filename, uint32_
                 printf("\e[1mSPEED(Gbps)\tBUFFERS\tSIZE(MB)\tLOOP\tUNDERFLOWS\e[0m\n");
             i++;
             /* Print statistics. */
-            printf("%10.2f\t%10" PRIu64 "\t%10" PRIu64 "\t%6d\t%10ld\n",
+            printf("%10.2f\t%10" PRIu64 "\t%10" PRIu64 "\t%6" PRIu64 "\t%10" PRIu64 "\n",
                    (double)(dma.reader_sw_count - reader_sw_count_last) * DMA_BUFFER_SIZE * 8 / ((double)duration * 1e6),
                    dma.reader_sw_count,
                    (dma.reader_sw_count * DMA_BUFFER_SIZE) / 1024 / 1024,
-                   current_loop,
+                   player.loops,
                    sw_underflows);
            /* Update time/count/underflows. */
             last_time = get_time_ms();
             reader_sw_count_last = dma.reader_hw_count;
+            total_underflows += sw_underflows;
             sw_underflows = 0;
         }
     }
+    total_underflows += sw_underflows;
+    printf("Played %" PRIu64 " MB (%" PRIu64 " loops), %" PRIu64 " underflows\n",
+           player.bytes / 1024 / 1024, player.loops, total_underflows);
 
     /* Cleanup DMA. */
     litepcie_dma_cleanup(&dma);
 
     /* Close File. */
+    litepcie_player_close(&player);
+}
+
+/* Play Benchmark */
+/*----------------*/
+
+static int64_t get_time_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Fills `size` bytes worth of DMA-sized buffers from `filename`, looping over
+   it, with fread/rewind (as play used to) and with the player, and reports the
+   throughput and the longest time a buffer took: the latency the TX path has
+   to absorb before underflowing. */
+static void litepcie_play_bench(const char *filename, uint64_t size)
+{
+    static struct litepcie_player player;
+    char *buf;
+    uint64_t done;
+    int64_t start, t, worst;
+    size_t len;
+    FILE *fo;
+    int ret;
+
+    buf = malloc(DMA_BUFFER_SIZE);
+    if (!buf)
+        exit(1);
+
+    printf("\e[1mMETHOD\t\tSPEED(Gbps)\tWORST BUFFER(us)\e[0m\n");
+
+    /* fread, with a rewind at the end of the file. */
+    fo = fopen(filename, "rb");
+    if (!fo) {
+        perror(filename);
+        exit(1);
+    }
+    worst = 0;
+    start = get_time_us();
+    for (done = 0; done < size && keep_running; done += DMA_BUFFER_SIZE) {
+        t = get_time_us();
+        len = fread(buf, 1, DMA_BUFFER_SIZE, fo);
+        if (feof(fo)) {
+            rewind(fo);
+            len += fread(buf + len, 1, DMA_BUFFER_SIZE - len, fo);
+        }
+        t = get_time_us() - t;
+        if (t > worst)
+            worst = t;
+    }
     fclose(fo);
+    printf("%-16s%10.2f\t%16" PRId64 "\n", "fread",
+           (double)done * 8 / ((double)(get_time_us() - start) * 1e3), worst);
+
+    /* Player. */
+    ret = litepcie_player_open(&player, filename, PLAY_READAHEAD);
+    if (ret < 0) {
+        fprintf(stderr, "%s: %s\n", filename, strerror(-ret));
+        exit(1);
+    }
+    worst = 0;
+    start = get_time_us();
+    for (done = 0; done < size && keep_running; done += DMA_BUFFER_SIZE) {
+        t = get_time_us();
+        litepcie_player_read(&player, buf, DMA_BUFFER_SIZE, 1);
+        t = get_time_us() - t;
+        if (t > worst)
+            worst = t;
+    }
+    litepcie_player_close(&player);
+    printf("%-16s%10.2f\t%16" PRId64 "\n", "mmap",
+           (double)done * 8 / ((double)(get_time_us() - start) * 1e3), worst);
+
+    free(buf);
 }
 
 /* Help */
@@ -217,7 +457,12 @@ static void help(void)
            "-z                               Enable zero-copy DMA mode.\n"
            "\n"
            "record [filename] [size]         Record DMA stream to file.\n"
+           "record_direct filename [size] [roll_size] [depth]\n"
+           "                                 Record DMA stream to file(s) with O_DIRECT and io_uring.\n"
+           "record_bench filename [size] [depth]\n"
+           "                                 Compare fwrite and the direct recorder on a target.\n"
            "play filename [loops]            Play DMA stream from file.\n"
+           "play_bench filename [size]       Compare fread and the mmap player on a file.\n"
            );
     exit(1);
 }
@@ -285,6 +530,35 @@ int main(int argc, char **argv)
             size = strtoul(argv[optind++], NULL, 0);
         }
         litepcie_record(litepcie_device, filename, size, litepcie_device_zero_copy);
+    /* Direct Record cmd. */
+    } else if (!strcmp(cmd, "record_direct")) {
+        const char *filename;
+        uint64_t size = 0;
+        uint64_t roll_size = 0;
+        unsigned depth = RECORD_DEPTH;
+        if (optind + 1 > argc)
+            goto show_help;
+        filename = argv[optind++];
+        if (optind < argc)
+            size = strtoull(argv[optind++], NULL, 0);
+        if (optind < argc)
+            roll_size = strtoull(argv[optind++], NULL, 0);
+        if (optind < argc)
+            depth = strtoul(argv[optind++], NULL, 0);
+        litepcie_record_direct(litepcie_device, filename, size, roll_size, depth, litepcie_device_zero_copy);
+    /* Record Benchmark cmd. */
+    } else if (!strcmp(cmd, "record_bench")) {
+        const char *filename;
+        uint64_t size = 1024 * 1024 * 1024;
+        unsigned depth = RECORD_DEPTH;
+        if (optind + 1 > argc)
+            goto show_help;
+        filename = argv[optind++];
+        if (optind < argc)
+            size = strtoull(argv[optind++], NULL, 0);
+        if (optind < argc)
+            depth = strtoul(argv[optind++], NULL, 0);
+        litepcie_record_bench(filename, size, depth);
     /* Play cmd. */
     } else if (!strcmp(cmd, "play")) {
         const char *filename;
@@ -295,6 +569,16 @@ int main(int argc, char **argv)
         if (optind < argc)
             loops = strtoul(argv[optind++], NULL, 0);
         litepcie_play(litepcie_device, filename, loops, litepcie_device_zero_copy);
+    /* Play Benchmark cmd. */
+    } else if (!strcmp(cmd, "play_bench")) {
+        const char *filename;
+        uint64_t size = 4ULL * 1024 * 1024 * 1024;
+        if (optind + 1 > argc)
+            goto show_help;
+        filename = argv[optind++];
+        if (optind < argc)
+            size = strtoull(argv[optind++], NULL, 0);
+        litepcie_play_bench(filename, size);
     /* Show help otherwise. */
     } else
 show_help:
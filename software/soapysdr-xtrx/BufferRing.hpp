@@ -0,0 +1,128 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Ring of fixed-size buffers handed from one thread to another, used to put a
+// much larger software buffer in front of the DMA ring than the kernel can
+// provide. Each buffer carries a tag, e.g. the DMA buffer it was copied from.
+//
+// It is a lock-free single-producer single-consumer queue: the producer fills
+// `back()` and then `push()`es it, while the consumer reads `front()` and then
+// `pop()`s it. The memory is backed by hugepages when the system has some
+// reserved, and by transparent hugepages otherwise, to keep TLB misses down
+// when walking gigabytes of samples.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <sys/mman.h>
+
+class BufferRing {
+  public:
+    BufferRing() : _mem(nullptr), _mem_size(0), _count(0), _size(0),
+                   _hugepages(false), _head(0), _tail(0) {}
+    ~BufferRing() { release(); }
+
+    BufferRing(const BufferRing &) = delete;
+    BufferRing &operator=(const BufferRing &) = delete;
+
+    void allocate(const size_t count, const size_t size) {
+        release();
+
+        // explicit hugepages need a multiple of their size
+        const size_t hugepage_size = 2 * 1024 * 1024;
+        _mem_size = (count * size + hugepage_size - 1) / hugepage_size * hugepage_size;
+        _mem = mmap(NULL, _mem_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        _hugepages = _mem != MAP_FAILED;
+        if (!_hugepages) {
+            _mem = mmap(NULL, _mem_size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+            if (_mem == MAP_FAILED) {
+                _mem = nullptr;
+                throw std::runtime_error("BufferRing: could not allocate " +
+                                         std::to_string(_mem_size) + " bytes");
+            }
+            madvise(_mem, _mem_size, MADV_HUGEPAGE);
+        }
+
+        _count = count;
+        _size = size;
+        _tags.assign(count, 0);
+        reset();
+    }
+
+    void release(void) {
+        if (_mem)
+            munmap(_mem, _mem_size);
+        _mem = nullptr;
+        _count = 0;
+    }
+
+    // Drop all buffers. Only safe while neither side is using the ring.
+    void reset(void) {
+        _head.store(0, std::memory_order_relaxed);
+        _tail.store(0, std::memory_order_relaxed);
+    }
+
+    bool allocated(void) const { return _mem != nullptr; }
+    bool hugepages(void) const { return _hugepages; }
+    size_t count(void) const { return _count; }
+    size_t size(void) const { return _size; }
+
+    // Number of buffers filled and not yet consumed.
+    size_t fill(void) const {
+        return _head.load(std::memory_order_acquire) -
+               _tail.load(std::memory_order_acquire);
+    }
+
+    // Producer: the next buffer to fill, or NULL if the ring is full.
+    int8_t *back(void) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == _count)
+            return nullptr;
+        return slot(head);
+    }
+
+    void push(const int64_t tag) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        _tags[head % _count] = tag;
+        _head.store(head + 1, std::memory_order_release);
+    }
+
+    // Consumer: the next buffer to read, or NULL if the ring is empty.
+    int8_t *front(int64_t &tag) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) == tail)
+            return nullptr;
+        tag = _tags[tail % _count];
+        return slot(tail);
+    }
+
+    void pop(void) {
+        _tail.store(_tail.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_release);
+    }
+
+  private:
+    int8_t *slot(const size_t index) {
+        return (int8_t *)_mem + (index % _count) * _size;
+    }
+
+    void *_mem;
+    size_t _mem_size;
+    size_t _count, _size;
+    bool _hugepages;
+    std::vector<int64_t> _tags;
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+};
@@ -0,0 +1,973 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Sample conversion between the DMA wire format and the user-facing formats.
+//
+// Every kernel comes in a scalar version, which is the reference, and in
+// vectorized versions for the instruction sets we care about. The x86 kernels
+// are compiled with per-function target attributes so that a single build
+// works on any CPU; the best set is picked using CPUID when the module gets
+// loaded.
+//
+// The vectorized kernels are all built the same way: gather the CS8 samples of
+// one channel from a block of frames into a single register, then widen them
+// into the user format (or the other way around), so that every sample is only
+// touched once.
+
+#include "Conversion.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CONVERSION_X86
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define CONVERSION_NEON
+#include <arm_neon.h>
+#endif
+
+// wire sample -> floating point, and back
+#define RX_SCALE (256.0 / NATIVE_FULL_SCALE)
+#define TX_SCALE (NATIVE_FULL_SCALE / 256.0)
+
+
+/*******************************************************************
+ * Scalar kernels
+ ******************************************************************/
+
+template <typename T>
+static inline int8_t quantize(const T x) {
+    const T v = std::min(std::max(x * (T)TX_SCALE, (T)-128), (T)127);
+    return (int8_t)std::lrint(v);
+}
+
+static void deinterleave_cs8_scalar(const int8_t *src, int8_t *dst,
+                                    size_t frames, size_t channel) {
+    src += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[2 * i] = src[i * BYTES_PER_FRAME];
+        dst[2 * i + 1] = src[i * BYTES_PER_FRAME + 1];
+    }
+}
+
+static void deinterleave_cs16_scalar(const int8_t *src, int16_t *dst,
+                                     size_t frames, size_t channel) {
+    src += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[2 * i] = (int16_t)(src[i * BYTES_PER_FRAME] << 8);
+        dst[2 * i + 1] = (int16_t)(src[i * BYTES_PER_FRAME + 1] << 8);
+    }
+}
+
+template <typename T>
+static void deinterleave_cf_scalar(const int8_t *src, T *dst,
+                                   size_t frames, size_t channel) {
+    src += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[2 * i] = src[i * BYTES_PER_FRAME] * (T)RX_SCALE;
+        dst[2 * i + 1] = src[i * BYTES_PER_FRAME + 1] * (T)RX_SCALE;
+    }
+}
+
+static void interleave_cs8_scalar(const int8_t *src, int8_t *dst,
+                                  size_t frames, size_t channel) {
+    dst += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[i * BYTES_PER_FRAME] = src[2 * i];
+        dst[i * BYTES_PER_FRAME + 1] = src[2 * i + 1];
+    }
+}
+
+static void interleave_cs16_scalar(const int16_t *src, int8_t *dst,
+                                   size_t frames, size_t channel) {
+    dst += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[i * BYTES_PER_FRAME] = (int8_t)(src[2 * i] >> 8);
+        dst[i * BYTES_PER_FRAME + 1] = (int8_t)(src[2 * i + 1] >> 8);
+    }
+}
+
+template <typename T>
+static void interleave_cf_scalar(const T *src, int8_t *dst,
+                                 size_t frames, size_t channel) {
+    dst += channel * BYTES_PER_SAMPLE;
+    for (size_t i = 0; i < frames; i++) {
+        dst[i * BYTES_PER_FRAME] = quantize(src[2 * i]);
+        dst[i * BYTES_PER_FRAME + 1] = quantize(src[2 * i + 1]);
+    }
+}
+
+static const ConversionKernels scalar_kernels = {
+    "scalar",
+    deinterleave_cs8_scalar, deinterleave_cs16_scalar,
+    deinterleave_cf_scalar<float>, deinterleave_cf_scalar<double>,
+    interleave_cs8_scalar, interleave_cs16_scalar,
+    interleave_cf_scalar<float>, interleave_cf_scalar<double>};
+
+
+#ifdef CONVERSION_X86
+
+/*******************************************************************
+ * SSE2 kernels
+ ******************************************************************/
+
+#define SSE2 __attribute__((target("sse2")))
+
+// A frame is 32 bits wide, with channel 0 in the bottom half. We isolate the
+// requested channel by shifting it into the bottom half with sign extension,
+// so that the 32 -> 16 bit saturating packs are lossless.
+
+// Gather the samples of a channel from 8 frames.
+SSE2 static inline __m128i load_channel_sse2(const int8_t *src, size_t channel) {
+    __m128i a = _mm_loadu_si128((const __m128i *)src);
+    __m128i b = _mm_loadu_si128((const __m128i *)(src + 16));
+    if (channel == 0) {
+        a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+        b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+    } else {
+        a = _mm_srai_epi32(a, 16);
+        b = _mm_srai_epi32(b, 16);
+    }
+    return _mm_packs_epi32(a, b);
+}
+
+// Scatter the samples of a channel into 8 frames.
+SSE2 static inline void store_channel_sse2(int8_t *dst, size_t channel, __m128i iq) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i keep = _mm_set1_epi32(channel == 0 ? 0xffff0000 : 0x0000ffff);
+    const __m128i lo = (channel == 0) ? _mm_unpacklo_epi16(iq, zero)
+                                      : _mm_unpacklo_epi16(zero, iq);
+    const __m128i hi = (channel == 0) ? _mm_unpackhi_epi16(iq, zero)
+                                      : _mm_unpackhi_epi16(zero, iq);
+
+    __m128i *wire = (__m128i *)dst;
+    _mm_storeu_si128(wire, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(wire), keep), lo));
+    _mm_storeu_si128(wire + 1, _mm_or_si128(_mm_and_si128(_mm_loadu_si128(wire + 1), keep), hi));
+}
+
+// Sign-extend 16 samples to 32 bits.
+SSE2 static inline void widen_sse2(__m128i iq, __m128i v[4]) {
+    const __m128i lo = _mm_srai_epi16(_mm_unpacklo_epi8(iq, iq), 8);
+    const __m128i hi = _mm_srai_epi16(_mm_unpackhi_epi8(iq, iq), 8);
+    v[0] = _mm_srai_epi32(_mm_unpacklo_epi16(lo, lo), 16);
+    v[1] = _mm_srai_epi32(_mm_unpackhi_epi16(lo, lo), 16);
+    v[2] = _mm_srai_epi32(_mm_unpacklo_epi16(hi, hi), 16);
+    v[3] = _mm_srai_epi32(_mm_unpackhi_epi16(hi, hi), 16);
+}
+
+// Narrow 16 in-range samples from 32 bits.
+SSE2 static inline __m128i narrow_sse2(const __m128i v[4]) {
+    return _mm_packs_epi16(_mm_packs_epi32(v[0], v[1]), _mm_packs_epi32(v[2], v[3]));
+}
+
+SSE2 static inline __m128i quantize_ps_sse2(__m128 x) {
+    x = _mm_mul_ps(x, _mm_set1_ps(TX_SCALE));
+    x = _mm_min_ps(_mm_max_ps(x, _mm_set1_ps(-128)), _mm_set1_ps(127));
+    return _mm_cvtps_epi32(x);
+}
+
+SSE2 static inline __m128i quantize_pd_sse2(__m128d x) {
+    x = _mm_mul_pd(x, _mm_set1_pd(TX_SCALE));
+    x = _mm_min_pd(_mm_max_pd(x, _mm_set1_pd(-128)), _mm_set1_pd(127));
+    return _mm_cvtpd_epi32(x);
+}
+
+SSE2 static void deinterleave_cs8_sse2(const int8_t *src, int8_t *dst,
+                                       size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        _mm_storeu_si128((__m128i *)(dst + 2 * i),
+                         load_channel_sse2(src + i * BYTES_PER_FRAME, channel));
+    deinterleave_cs8_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                            frames - i, channel);
+}
+
+SSE2 static void deinterleave_cs16_sse2(const int8_t *src, int16_t *dst,
+                                        size_t frames, size_t channel) {
+    const __m128i zero = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const __m128i iq = load_channel_sse2(src + i * BYTES_PER_FRAME, channel);
+
+        // placing a zero byte below every sample shifts it left by 8
+        _mm_storeu_si128((__m128i *)(dst + 2 * i), _mm_unpacklo_epi8(zero, iq));
+        _mm_storeu_si128((__m128i *)(dst + 2 * i + 8), _mm_unpackhi_epi8(zero, iq));
+    }
+    deinterleave_cs16_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                             frames - i, channel);
+}
+
+SSE2 static void deinterleave_cf32_sse2(const int8_t *src, float *dst,
+                                        size_t frames, size_t channel) {
+    const __m128 scale = _mm_set1_ps(RX_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v[4];
+        widen_sse2(load_channel_sse2(src + i * BYTES_PER_FRAME, channel), v);
+        for (int k = 0; k < 4; k++)
+            _mm_storeu_ps(dst + 2 * i + 4 * k, _mm_mul_ps(_mm_cvtepi32_ps(v[k]), scale));
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+SSE2 static void deinterleave_cf64_sse2(const int8_t *src, double *dst,
+                                        size_t frames, size_t channel) {
+    const __m128d scale = _mm_set1_pd(RX_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v[4];
+        widen_sse2(load_channel_sse2(src + i * BYTES_PER_FRAME, channel), v);
+        for (int k = 0; k < 4; k++) {
+            _mm_storeu_pd(dst + 2 * i + 4 * k,
+                          _mm_mul_pd(_mm_cvtepi32_pd(v[k]), scale));
+            _mm_storeu_pd(dst + 2 * i + 4 * k + 2,
+                          _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(v[k], 8)), scale));
+        }
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+SSE2 static void interleave_cs8_sse2(const int8_t *src, int8_t *dst,
+                                     size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        store_channel_sse2(dst + i * BYTES_PER_FRAME, channel,
+                           _mm_loadu_si128((const __m128i *)(src + 2 * i)));
+    interleave_cs8_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                          frames - i, channel);
+}
+
+SSE2 static void interleave_cs16_sse2(const int16_t *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const __m128i a = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        const __m128i b = _mm_loadu_si128((const __m128i *)(src + 2 * i + 8));
+        store_channel_sse2(dst + i * BYTES_PER_FRAME, channel,
+                           _mm_packs_epi16(_mm_srai_epi16(a, 8), _mm_srai_epi16(b, 8)));
+    }
+    interleave_cs16_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                           frames - i, channel);
+}
+
+SSE2 static void interleave_cf32_sse2(const float *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = quantize_ps_sse2(_mm_loadu_ps(src + 2 * i + 4 * k));
+        store_channel_sse2(dst + i * BYTES_PER_FRAME, channel, narrow_sse2(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+SSE2 static void interleave_cf64_sse2(const double *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m128i v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = _mm_unpacklo_epi64(
+                quantize_pd_sse2(_mm_loadu_pd(src + 2 * i + 4 * k)),
+                quantize_pd_sse2(_mm_loadu_pd(src + 2 * i + 4 * k + 2)));
+        store_channel_sse2(dst + i * BYTES_PER_FRAME, channel, narrow_sse2(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+static const ConversionKernels sse2_kernels = {
+    "sse2",
+    deinterleave_cs8_sse2, deinterleave_cs16_sse2,
+    deinterleave_cf32_sse2, deinterleave_cf64_sse2,
+    interleave_cs8_sse2, interleave_cs16_sse2,
+    interleave_cf32_sse2, interleave_cf64_sse2};
+
+
+/*******************************************************************
+ * AVX2 kernels
+ ******************************************************************/
+
+#define AVX2 __attribute__((target("avx2")))
+
+// AVX2 packs and unpacks operate within 128-bit lanes, hence the permutes.
+
+// Gather the samples of a channel from 16 frames.
+AVX2 static inline __m256i load_channel_avx2(const int8_t *src, size_t channel) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)src);
+    __m256i b = _mm256_loadu_si256((const __m256i *)(src + 32));
+    if (channel == 0) {
+        a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+        b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+    } else {
+        a = _mm256_srai_epi32(a, 16);
+        b = _mm256_srai_epi32(b, 16);
+    }
+    return _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xd8);
+}
+
+// Scatter the samples of a channel into 16 frames.
+AVX2 static inline void store_channel_avx2(int8_t *dst, size_t channel, __m256i iq) {
+    __m256i lo = _mm256_cvtepu16_epi32(_mm256_castsi256_si128(iq));
+    __m256i hi = _mm256_cvtepu16_epi32(_mm256_extracti128_si256(iq, 1));
+
+    __m256i *wire = (__m256i *)dst;
+    if (channel == 0) {
+        _mm256_storeu_si256(wire, _mm256_blend_epi16(_mm256_loadu_si256(wire), lo, 0x55));
+        _mm256_storeu_si256(wire + 1, _mm256_blend_epi16(_mm256_loadu_si256(wire + 1), hi, 0x55));
+    } else {
+        lo = _mm256_slli_epi32(lo, 16);
+        hi = _mm256_slli_epi32(hi, 16);
+        _mm256_storeu_si256(wire, _mm256_blend_epi16(_mm256_loadu_si256(wire), lo, 0xaa));
+        _mm256_storeu_si256(wire + 1, _mm256_blend_epi16(_mm256_loadu_si256(wire + 1), hi, 0xaa));
+    }
+}
+
+// Narrow 32 in-range samples from 32 bits.
+AVX2 static inline __m256i narrow_avx2(const __m256i v[4]) {
+    const __m256i packed = _mm256_packs_epi16(_mm256_packs_epi32(v[0], v[1]),
+                                              _mm256_packs_epi32(v[2], v[3]));
+    return _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+}
+
+AVX2 static inline __m256i quantize_ps_avx2(__m256 x) {
+    x = _mm256_mul_ps(x, _mm256_set1_ps(TX_SCALE));
+    x = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-128)), _mm256_set1_ps(127));
+    return _mm256_cvtps_epi32(x);
+}
+
+AVX2 static inline __m128i quantize_pd_avx2(__m256d x) {
+    x = _mm256_mul_pd(x, _mm256_set1_pd(TX_SCALE));
+    x = _mm256_min_pd(_mm256_max_pd(x, _mm256_set1_pd(-128)), _mm256_set1_pd(127));
+    return _mm256_cvtpd_epi32(x);
+}
+
+AVX2 static void deinterleave_cs8_avx2(const int8_t *src, int8_t *dst,
+                                       size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i),
+                            load_channel_avx2(src + i * BYTES_PER_FRAME, channel));
+    deinterleave_cs8_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                            frames - i, channel);
+}
+
+AVX2 static void deinterleave_cs16_avx2(const int8_t *src, int16_t *dst,
+                                        size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx2(src + i * BYTES_PER_FRAME, channel);
+        const __m256i lo = _mm256_cvtepi8_epi16(_mm256_castsi256_si128(iq));
+        const __m256i hi = _mm256_cvtepi8_epi16(_mm256_extracti128_si256(iq, 1));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i), _mm256_slli_epi16(lo, 8));
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i + 16), _mm256_slli_epi16(hi, 8));
+    }
+    deinterleave_cs16_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                             frames - i, channel);
+}
+
+AVX2 static void deinterleave_cf32_avx2(const int8_t *src, float *dst,
+                                        size_t frames, size_t channel) {
+    const __m256 scale = _mm256_set1_ps(RX_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx2(src + i * BYTES_PER_FRAME, channel);
+        const __m128i half[2] = {_mm256_castsi256_si128(iq),
+                                 _mm256_extracti128_si256(iq, 1)};
+        for (int k = 0; k < 4; k++) {
+            const __m128i chunk = (k % 2) ? _mm_srli_si128(half[k / 2], 8) : half[k / 2];
+            const __m256 f = _mm256_cvtepi32_ps(_mm256_cvtepi8_epi32(chunk));
+            _mm256_storeu_ps(dst + 2 * i + 8 * k, _mm256_mul_ps(f, scale));
+        }
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+AVX2 static void deinterleave_cf64_avx2(const int8_t *src, double *dst,
+                                        size_t frames, size_t channel) {
+    const __m256d scale = _mm256_set1_pd(RX_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx2(src + i * BYTES_PER_FRAME, channel);
+        const __m256i lo = _mm256_cvtepi8_epi32(_mm256_castsi256_si128(iq));
+        const __m256i hi = _mm256_cvtepi8_epi32(_mm_srli_si128(_mm256_castsi256_si128(iq), 8));
+        const __m256i lo2 = _mm256_cvtepi8_epi32(_mm256_extracti128_si256(iq, 1));
+        const __m256i hi2 = _mm256_cvtepi8_epi32(_mm_srli_si128(_mm256_extracti128_si256(iq, 1), 8));
+        const __m256i v[4] = {lo, hi, lo2, hi2};
+        for (int k = 0; k < 4; k++) {
+            _mm256_storeu_pd(dst + 2 * i + 8 * k,
+                             _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_castsi256_si128(v[k])), scale));
+            _mm256_storeu_pd(dst + 2 * i + 8 * k + 4,
+                             _mm256_mul_pd(_mm256_cvtepi32_pd(_mm256_extracti128_si256(v[k], 1)), scale));
+        }
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+AVX2 static void interleave_cs8_avx2(const int8_t *src, int8_t *dst,
+                                     size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16)
+        store_channel_avx2(dst + i * BYTES_PER_FRAME, channel,
+                           _mm256_loadu_si256((const __m256i *)(src + 2 * i)));
+    interleave_cs8_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                          frames - i, channel);
+}
+
+AVX2 static void interleave_cs16_avx2(const int16_t *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i a = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(src + 2 * i)), 8);
+        const __m256i b = _mm256_srai_epi16(_mm256_loadu_si256((const __m256i *)(src + 2 * i + 16)), 8);
+        store_channel_avx2(dst + i * BYTES_PER_FRAME, channel,
+                           _mm256_permute4x64_epi64(_mm256_packs_epi16(a, b), 0xd8));
+    }
+    interleave_cs16_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                           frames - i, channel);
+}
+
+AVX2 static void interleave_cf32_avx2(const float *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = quantize_ps_avx2(_mm256_loadu_ps(src + 2 * i + 8 * k));
+        store_channel_avx2(dst + i * BYTES_PER_FRAME, channel, narrow_avx2(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+AVX2 static void interleave_cf64_avx2(const double *src, int8_t *dst,
+                                      size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256i v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = _mm256_set_m128i(
+                quantize_pd_avx2(_mm256_loadu_pd(src + 2 * i + 8 * k + 4)),
+                quantize_pd_avx2(_mm256_loadu_pd(src + 2 * i + 8 * k)));
+        store_channel_avx2(dst + i * BYTES_PER_FRAME, channel, narrow_avx2(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+static const ConversionKernels avx2_kernels = {
+    "avx2",
+    deinterleave_cs8_avx2, deinterleave_cs16_avx2,
+    deinterleave_cf32_avx2, deinterleave_cf64_avx2,
+    interleave_cs8_avx2, interleave_cs16_avx2,
+    interleave_cf32_avx2, interleave_cf64_avx2};
+
+
+/*******************************************************************
+ * AVX-512 kernels
+ ******************************************************************/
+
+#define AVX512 __attribute__((target("avx512f,avx512bw")))
+
+// AVX-512 has truncating down-conversions and masked stores, so we can select
+// and write back a channel without any shuffling.
+
+// Gather the samples of a channel from 16 frames.
+AVX512 static inline __m256i load_channel_avx512(const int8_t *src, size_t channel) {
+    __m512i f = _mm512_loadu_si512((const void *)src);
+    if (channel != 0)
+        f = _mm512_srli_epi32(f, 16);
+    return _mm512_cvtepi32_epi16(f);
+}
+
+// Scatter the samples of a channel into 16 frames.
+AVX512 static inline void store_channel_avx512(int8_t *dst, size_t channel, __m256i iq) {
+    __m512i w = _mm512_cvtepu16_epi32(iq);
+    if (channel != 0)
+        w = _mm512_slli_epi32(w, 16);
+    _mm512_mask_storeu_epi16((void *)dst, (channel == 0) ? 0x55555555 : 0xaaaaaaaa, w);
+}
+
+AVX512 static inline __m512i quantize_ps_avx512(__m512 x) {
+    x = _mm512_mul_ps(x, _mm512_set1_ps(TX_SCALE));
+    x = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-128)), _mm512_set1_ps(127));
+    return _mm512_cvtps_epi32(x);
+}
+
+AVX512 static inline __m256i quantize_pd_avx512(__m512d x) {
+    x = _mm512_mul_pd(x, _mm512_set1_pd(TX_SCALE));
+    x = _mm512_min_pd(_mm512_max_pd(x, _mm512_set1_pd(-128)), _mm512_set1_pd(127));
+    return _mm512_cvtpd_epi32(x);
+}
+
+AVX512 static void deinterleave_cs8_avx512(const int8_t *src, int8_t *dst,
+                                           size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16)
+        _mm256_storeu_si256((__m256i *)(dst + 2 * i),
+                            load_channel_avx512(src + i * BYTES_PER_FRAME, channel));
+    deinterleave_cs8_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                            frames - i, channel);
+}
+
+AVX512 static void deinterleave_cs16_avx512(const int8_t *src, int16_t *dst,
+                                            size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx512(src + i * BYTES_PER_FRAME, channel);
+        _mm512_storeu_si512((void *)(dst + 2 * i),
+                            _mm512_slli_epi16(_mm512_cvtepi8_epi16(iq), 8));
+    }
+    deinterleave_cs16_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                             frames - i, channel);
+}
+
+AVX512 static void deinterleave_cf32_avx512(const int8_t *src, float *dst,
+                                            size_t frames, size_t channel) {
+    const __m512 scale = _mm512_set1_ps(RX_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx512(src + i * BYTES_PER_FRAME, channel);
+        const __m512i lo = _mm512_cvtepi8_epi32(_mm256_castsi256_si128(iq));
+        const __m512i hi = _mm512_cvtepi8_epi32(_mm256_extracti128_si256(iq, 1));
+        _mm512_storeu_ps(dst + 2 * i, _mm512_mul_ps(_mm512_cvtepi32_ps(lo), scale));
+        _mm512_storeu_ps(dst + 2 * i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(hi), scale));
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+AVX512 static void deinterleave_cf64_avx512(const int8_t *src, double *dst,
+                                            size_t frames, size_t channel) {
+    const __m512d scale = _mm512_set1_pd(RX_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m256i iq = load_channel_avx512(src + i * BYTES_PER_FRAME, channel);
+        const __m512i v[2] = {_mm512_cvtepi8_epi32(_mm256_castsi256_si128(iq)),
+                              _mm512_cvtepi8_epi32(_mm256_extracti128_si256(iq, 1))};
+        for (int k = 0; k < 2; k++) {
+            _mm512_storeu_pd(dst + 2 * i + 16 * k,
+                             _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_castsi512_si256(v[k])), scale));
+            _mm512_storeu_pd(dst + 2 * i + 16 * k + 8,
+                             _mm512_mul_pd(_mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(v[k], 1)), scale));
+        }
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+AVX512 static void interleave_cs8_avx512(const int8_t *src, int8_t *dst,
+                                         size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16)
+        store_channel_avx512(dst + i * BYTES_PER_FRAME, channel,
+                             _mm256_loadu_si256((const __m256i *)(src + 2 * i)));
+    interleave_cs8_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                          frames - i, channel);
+}
+
+AVX512 static void interleave_cs16_avx512(const int16_t *src, int8_t *dst,
+                                          size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m512i s = _mm512_srai_epi16(_mm512_loadu_si512((const void *)(src + 2 * i)), 8);
+        store_channel_avx512(dst + i * BYTES_PER_FRAME, channel, _mm512_cvtepi16_epi8(s));
+    }
+    interleave_cs16_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                           frames - i, channel);
+}
+
+AVX512 static void interleave_cf32_avx512(const float *src, int8_t *dst,
+                                          size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        const __m128i lo = _mm512_cvtepi32_epi8(quantize_ps_avx512(_mm512_loadu_ps(src + 2 * i)));
+        const __m128i hi = _mm512_cvtepi32_epi8(quantize_ps_avx512(_mm512_loadu_ps(src + 2 * i + 16)));
+        store_channel_avx512(dst + i * BYTES_PER_FRAME, channel, _mm256_set_m128i(hi, lo));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+AVX512 static void interleave_cf64_avx512(const double *src, int8_t *dst,
+                                          size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m128i half[2];
+        for (int k = 0; k < 2; k++) {
+            const __m256i lo = quantize_pd_avx512(_mm512_loadu_pd(src + 2 * i + 16 * k));
+            const __m256i hi = quantize_pd_avx512(_mm512_loadu_pd(src + 2 * i + 16 * k + 8));
+            half[k] = _mm512_cvtepi32_epi8(
+                _mm512_inserti64x4(_mm512_castsi256_si512(lo), hi, 1));
+        }
+        store_channel_avx512(dst + i * BYTES_PER_FRAME, channel,
+                             _mm256_set_m128i(half[1], half[0]));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+static const ConversionKernels avx512_kernels = {
+    "avx512",
+    deinterleave_cs8_avx512, deinterleave_cs16_avx512,
+    deinterleave_cf32_avx512, deinterleave_cf64_avx512,
+    interleave_cs8_avx512, interleave_cs16_avx512,
+    interleave_cf32_avx512, interleave_cf64_avx512};
+
+#endif // CONVERSION_X86
+
+
+#ifdef CONVERSION_NEON
+
+/*******************************************************************
+ * NEON kernels
+ ******************************************************************/
+
+// Frames are pairs of 16-bit words, so the structured loads and stores
+// separate and merge the channels for us.
+
+// Gather the samples of a channel from 8 frames.
+static inline int8x16_t load_channel_neon(const int8_t *src, size_t channel) {
+    return vreinterpretq_s8_s16(vld2q_s16((const int16_t *)src).val[channel]);
+}
+
+// Scatter the samples of a channel into 8 frames.
+static inline void store_channel_neon(int8_t *dst, size_t channel, int8x16_t iq) {
+    int16x8x2_t f = vld2q_s16((const int16_t *)dst);
+    f.val[channel] = vreinterpretq_s16_s8(iq);
+    vst2q_s16((int16_t *)dst, f);
+}
+
+// Sign-extend 16 samples to 32 bits.
+static inline void widen_neon(int8x16_t iq, int32x4_t v[4]) {
+    const int16x8_t lo = vmovl_s8(vget_low_s8(iq));
+    const int16x8_t hi = vmovl_s8(vget_high_s8(iq));
+    v[0] = vmovl_s16(vget_low_s16(lo));
+    v[1] = vmovl_s16(vget_high_s16(lo));
+    v[2] = vmovl_s16(vget_low_s16(hi));
+    v[3] = vmovl_s16(vget_high_s16(hi));
+}
+
+// Narrow 16 in-range samples from 32 bits.
+static inline int8x16_t narrow_neon(const int32x4_t v[4]) {
+    const int16x8_t lo = vcombine_s16(vmovn_s32(v[0]), vmovn_s32(v[1]));
+    const int16x8_t hi = vcombine_s16(vmovn_s32(v[2]), vmovn_s32(v[3]));
+    return vcombine_s8(vmovn_s16(lo), vmovn_s16(hi));
+}
+
+static inline int32x4_t quantize_f32_neon(float32x4_t x) {
+    x = vmulq_n_f32(x, TX_SCALE);
+    x = vminq_f32(vmaxq_f32(x, vdupq_n_f32(-128)), vdupq_n_f32(127));
+    return vcvtnq_s32_f32(x);
+}
+
+static inline int32x2_t quantize_f64_neon(float64x2_t x) {
+    x = vmulq_n_f64(x, TX_SCALE);
+    x = vminq_f64(vmaxq_f64(x, vdupq_n_f64(-128)), vdupq_n_f64(127));
+    return vmovn_s64(vcvtnq_s64_f64(x));
+}
+
+static void deinterleave_cs8_neon(const int8_t *src, int8_t *dst,
+                                  size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        vst1q_s8(dst + 2 * i, load_channel_neon(src + i * BYTES_PER_FRAME, channel));
+    deinterleave_cs8_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                            frames - i, channel);
+}
+
+static void deinterleave_cs16_neon(const int8_t *src, int16_t *dst,
+                                   size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const int8x16_t iq = load_channel_neon(src + i * BYTES_PER_FRAME, channel);
+        vst1q_s16(dst + 2 * i, vshll_n_s8(vget_low_s8(iq), 8));
+        vst1q_s16(dst + 2 * i + 8, vshll_n_s8(vget_high_s8(iq), 8));
+    }
+    deinterleave_cs16_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                             frames - i, channel);
+}
+
+static void deinterleave_cf32_neon(const int8_t *src, float *dst,
+                                   size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int32x4_t v[4];
+        widen_neon(load_channel_neon(src + i * BYTES_PER_FRAME, channel), v);
+        for (int k = 0; k < 4; k++)
+            vst1q_f32(dst + 2 * i + 4 * k, vmulq_n_f32(vcvtq_f32_s32(v[k]), RX_SCALE));
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+static void deinterleave_cf64_neon(const int8_t *src, double *dst,
+                                   size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int32x4_t v[4];
+        widen_neon(load_channel_neon(src + i * BYTES_PER_FRAME, channel), v);
+        for (int k = 0; k < 4; k++) {
+            const float64x2_t lo = vcvtq_f64_s64(vmovl_s32(vget_low_s32(v[k])));
+            const float64x2_t hi = vcvtq_f64_s64(vmovl_s32(vget_high_s32(v[k])));
+            vst1q_f64(dst + 2 * i + 4 * k, vmulq_n_f64(lo, RX_SCALE));
+            vst1q_f64(dst + 2 * i + 4 * k + 2, vmulq_n_f64(hi, RX_SCALE));
+        }
+    }
+    deinterleave_cf_scalar(src + i * BYTES_PER_FRAME, dst + 2 * i,
+                           frames - i, channel);
+}
+
+static void interleave_cs8_neon(const int8_t *src, int8_t *dst,
+                                size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8)
+        store_channel_neon(dst + i * BYTES_PER_FRAME, channel, vld1q_s8(src + 2 * i));
+    interleave_cs8_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                          frames - i, channel);
+}
+
+static void interleave_cs16_neon(const int16_t *src, int8_t *dst,
+                                 size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        const int8x16_t iq = vcombine_s8(vshrn_n_s16(vld1q_s16(src + 2 * i), 8),
+                                         vshrn_n_s16(vld1q_s16(src + 2 * i + 8), 8));
+        store_channel_neon(dst + i * BYTES_PER_FRAME, channel, iq);
+    }
+    interleave_cs16_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                           frames - i, channel);
+}
+
+static void interleave_cf32_neon(const float *src, int8_t *dst,
+                                 size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int32x4_t v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = quantize_f32_neon(vld1q_f32(src + 2 * i + 4 * k));
+        store_channel_neon(dst + i * BYTES_PER_FRAME, channel, narrow_neon(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+static void interleave_cf64_neon(const double *src, int8_t *dst,
+                                 size_t frames, size_t channel) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        int32x4_t v[4];
+        for (int k = 0; k < 4; k++)
+            v[k] = vcombine_s32(quantize_f64_neon(vld1q_f64(src + 2 * i + 4 * k)),
+                                quantize_f64_neon(vld1q_f64(src + 2 * i + 4 * k + 2)));
+        store_channel_neon(dst + i * BYTES_PER_FRAME, channel, narrow_neon(v));
+    }
+    interleave_cf_scalar(src + 2 * i, dst + i * BYTES_PER_FRAME,
+                         frames - i, channel);
+}
+
+static const ConversionKernels neon_kernels = {
+    "neon",
+    deinterleave_cs8_neon, deinterleave_cs16_neon,
+    deinterleave_cf32_neon, deinterleave_cf64_neon,
+    interleave_cs8_neon, interleave_cs16_neon,
+    interleave_cf32_neon, interleave_cf64_neon};
+
+#endif // CONVERSION_NEON
+
+
+/*******************************************************************
+ * Dispatch
+ ******************************************************************/
+
+std::vector<const ConversionKernels *> listConversionKernels(void) {
+    std::vector<const ConversionKernels *> kernels;
+    kernels.push_back(&scalar_kernels);
+#if defined(CONVERSION_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels.push_back(&sse2_kernels);
+    if (__builtin_cpu_supports("avx2"))
+        kernels.push_back(&avx2_kernels);
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        kernels.push_back(&avx512_kernels);
+#elif defined(CONVERSION_NEON)
+    kernels.push_back(&neon_kernels);
+#endif
+    return kernels;
+}
+
+// resolved when the module gets loaded, so the streaming code never checks
+static const ConversionKernels *selected_kernels = listConversionKernels().back();
+
+const ConversionKernels &getConversionKernels(void) {
+    return *selected_kernels;
+}
+
+
+/*******************************************************************
+ * Stream converters
+ ******************************************************************/
+
+// Converters are specialized on the user format and on the channel mapping, so
+// that streaming doesn't need to look at either.
+
+template <typename T> struct FormatKernels;
+#define FORMAT_KERNELS(T, suffix)                                                 \
+    template <> struct FormatKernels<T> {                                         \
+        static deinterleave_t<T> rx(void) { return selected_kernels->deinterleave_##suffix; } \
+        static interleave_t<T> tx(void) { return selected_kernels->interleave_##suffix; }     \
+    };
+FORMAT_KERNELS(int8_t, cs8)
+FORMAT_KERNELS(int16_t, cs16)
+FORMAT_KERNELS(float, cf32)
+FORMAT_KERNELS(double, cf64)
+#undef FORMAT_KERNELS
+
+template <typename T, size_t... Channels>
+static void rx_converter(const int8_t *src, void *const *buffs,
+                         size_t offset, size_t frames) {
+    const deinterleave_t<T> kernel = FormatKernels<T>::rx();
+    const size_t channels[] = {Channels...};
+    for (size_t i = 0; i < sizeof...(Channels); i++)
+        kernel(src, (T *)buffs[i] + offset * 2, frames, channels[i]);
+}
+
+template <typename T, size_t... Channels>
+static void tx_converter(const void *const *buffs, int8_t *dst,
+                         size_t offset, size_t frames) {
+    const interleave_t<T> kernel = FormatKernels<T>::tx();
+    const size_t channels[] = {Channels...};
+    for (size_t i = 0; i < sizeof...(Channels); i++)
+        kernel((const T *)buffs[i] + offset * 2, dst, frames, channels[i]);
+}
+
+// Supported channel mappings: either channel on its own, or both in any order.
+template <typename Converter>
+static Converter lookup_converter(const std::vector<size_t> &channels,
+                                  Converter ch0, Converter ch1,
+                                  Converter ch01, Converter ch10) {
+    if (channels == std::vector<size_t>{0})
+        return ch0;
+    else if (channels == std::vector<size_t>{1})
+        return ch1;
+    else if (channels == std::vector<size_t>{0, 1})
+        return ch01;
+    else if (channels == std::vector<size_t>{1, 0})
+        return ch10;
+    else
+        return NULL;
+}
+
+template <typename T>
+static rx_converter_t lookup_rx_converter(const std::vector<size_t> &channels) {
+    return lookup_converter<rx_converter_t>(
+        channels, rx_converter<T, 0>, rx_converter<T, 1>,
+        rx_converter<T, 0, 1>, rx_converter<T, 1, 0>);
+}
+
+template <typename T>
+static tx_converter_t lookup_tx_converter(const std::vector<size_t> &channels) {
+    return lookup_converter<tx_converter_t>(
+        channels, tx_converter<T, 0>, tx_converter<T, 1>,
+        tx_converter<T, 0, 1>, tx_converter<T, 1, 0>);
+}
+
+rx_converter_t getRXConverter(StreamFormat format,
+                              const std::vector<size_t> &channels) {
+    switch (format) {
+    case StreamFormat::CS8:  return lookup_rx_converter<int8_t>(channels);
+    case StreamFormat::CS16: return lookup_rx_converter<int16_t>(channels);
+    case StreamFormat::CF32: return lookup_rx_converter<float>(channels);
+    case StreamFormat::CF64: return lookup_rx_converter<double>(channels);
+    }
+    return NULL;
+}
+
+tx_converter_t getTXConverter(StreamFormat format,
+                              const std::vector<size_t> &channels) {
+    switch (format) {
+    case StreamFormat::CS8:  return lookup_tx_converter<int8_t>(channels);
+    case StreamFormat::CS16: return lookup_tx_converter<int16_t>(channels);
+    case StreamFormat::CF32: return lookup_tx_converter<float>(channels);
+    case StreamFormat::CF64: return lookup_tx_converter<double>(channels);
+    }
+    return NULL;
+}
+
+
+/*******************************************************************
+ * Parallel conversion
+ ******************************************************************/
+
+// Below this many frames per worker, waking up the workers costs more than it
+// saves.
+#define PARALLEL_MIN_FRAMES 2048
+
+// Chunks start on a multiple of this many frames, i.e. a cache line of wire
+// frames, so that workers don't write to the same cache lines.
+#define PARALLEL_ALIGN_FRAMES 16
+
+struct ParallelConversion {
+    rx_converter_t rx;
+    tx_converter_t tx;
+    const int8_t *src;
+    int8_t *dst;
+    const void *const *tx_buffs;
+    void *const *rx_buffs;
+    size_t offset;
+    size_t frames;
+};
+
+static size_t chunk_start(size_t frames, size_t worker, size_t workers) {
+    if (worker == workers)
+        return frames;
+    return frames * worker / workers / PARALLEL_ALIGN_FRAMES * PARALLEL_ALIGN_FRAMES;
+}
+
+static void convert_chunk(void *ctx, size_t worker, size_t workers) {
+    const ParallelConversion &job = *(const ParallelConversion *)ctx;
+    const size_t begin = chunk_start(job.frames, worker, workers);
+    const size_t end = chunk_start(job.frames, worker + 1, workers);
+    if (job.rx)
+        job.rx(job.src + begin * BYTES_PER_FRAME, job.rx_buffs,
+               job.offset + begin, end - begin);
+    else
+        job.tx(job.tx_buffs, job.dst + begin * BYTES_PER_FRAME,
+               job.offset + begin, end - begin);
+}
+
+void convertParallel(WorkerPool &pool, rx_converter_t convert,
+                     const int8_t *src, void *const *buffs, size_t offset,
+                     size_t frames) {
+    if (pool.size() == 1 || frames < PARALLEL_MIN_FRAMES * pool.size()) {
+        convert(src, buffs, offset, frames);
+        return;
+    }
+    ParallelConversion job = {convert, NULL, src, NULL, NULL, buffs, offset, frames};
+    pool.run(convert_chunk, &job);
+}
+
+void convertParallel(WorkerPool &pool, tx_converter_t convert,
+                     const void *const *buffs, int8_t *dst, size_t offset,
+                     size_t frames) {
+    if (pool.size() == 1 || frames < PARALLEL_MIN_FRAMES * pool.size()) {
+        convert(buffs, dst, offset, frames);
+        return;
+    }
+    ParallelConversion job = {NULL, convert, NULL, dst, buffs, NULL, offset, frames};
+    pool.run(convert_chunk, &job);
+}
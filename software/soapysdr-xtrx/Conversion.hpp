@@ -0,0 +1,104 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// The DMA engine carries both channels in every frame, each as an interleaved
+// CS8 sample: [I0 Q0 I1 Q1].
+#define BYTES_PER_SAMPLE 2 // TODO validate this
+#define WIRE_CHANNELS 2
+#define BYTES_PER_FRAME (WIRE_CHANNELS * BYTES_PER_SAMPLE)
+
+// Full scale of the CS16 samples we produce, with the wire's CS8 samples ending
+// up in the top byte. Floating-point samples are normalized to it.
+#define NATIVE_FULL_SCALE 32768
+
+// Plain C++ loops written for the auto-vectorizer (see StreamDSP), compiled for
+// several instruction sets and picked at load time, like the conversion
+// kernels. AVX-512 is left out: the shuffles of interleaved IQ pairs make it
+// slower than AVX2 on the small blocks we process.
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && !defined(__clang__)
+#define DSP_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define DSP_CLONES
+#endif
+
+
+/*******************************************************************
+ * Conversion kernels
+ ******************************************************************/
+
+// Convert `frames` samples of wire channel `channel` to a user format.
+template <typename T>
+using deinterleave_t = void (*)(const int8_t *src, T *dst, size_t frames,
+                                size_t channel);
+
+// Convert `frames` samples of a user format into wire channel `channel`,
+// leaving the other channel untouched. Floating-point samples are rounded to
+// the nearest wire value and saturated.
+template <typename T>
+using interleave_t = void (*)(const T *src, int8_t *dst, size_t frames,
+                              size_t channel);
+
+// A set of kernels targeting a single instruction set. All of them are
+// bit-exact with the scalar kernels.
+struct ConversionKernels {
+    const char *name;
+    deinterleave_t<int8_t> deinterleave_cs8;
+    deinterleave_t<int16_t> deinterleave_cs16;
+    deinterleave_t<float> deinterleave_cf32;
+    deinterleave_t<double> deinterleave_cf64;
+    interleave_t<int8_t> interleave_cs8;
+    interleave_t<int16_t> interleave_cs16;
+    interleave_t<float> interleave_cf32;
+    interleave_t<double> interleave_cf64;
+};
+
+// The kernels for the best instruction set this CPU supports, as selected when
+// the module was loaded.
+const ConversionKernels &getConversionKernels(void);
+
+// All kernels usable on this CPU, from the scalar reference up to the selected
+// kernels (e.g. for testing and benchmarking).
+std::vector<const ConversionKernels *> listConversionKernels(void);
+
+
+/*******************************************************************
+ * Stream converters
+ ******************************************************************/
+
+enum class StreamFormat { CS8, CS16, CF32, CF64 };
+
+// Convert `frames` DMA frames from/to the user buffers of all channels of a
+// stream, starting `offset` elements into those buffers.
+typedef void (*rx_converter_t)(const int8_t *src, void *const *buffs,
+                               size_t offset, size_t frames);
+typedef void (*tx_converter_t)(const void *const *buffs, int8_t *dst,
+                               size_t offset, size_t frames);
+
+// Look up the converter specialized for a stream's format and channel mapping,
+// or return NULL if that mapping isn't supported.
+rx_converter_t getRXConverter(StreamFormat format,
+                              const std::vector<size_t> &channels);
+tx_converter_t getTXConverter(StreamFormat format,
+                              const std::vector<size_t> &channels);
+
+// Run a converter with the calling thread and the workers of `pool`, each
+// converting a contiguous chunk of the frames. Small conversions aren't worth
+// waking up the workers for, and run on the calling thread only.
+class WorkerPool;
+void convertParallel(WorkerPool &pool, rx_converter_t convert,
+                     const int8_t *src, void *const *buffs, size_t offset,
+                     size_t frames);
+void convertParallel(WorkerPool &pool, tx_converter_t convert,
+                     const void *const *buffs, int8_t *dst, size_t offset,
+                     size_t frames);
@@ -0,0 +1,66 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Queue of stream events (overflows, underflows, late and finished bursts),
+// recorded by the thread streaming data and drained by readStreamStatus().
+//
+// It is a bounded single-producer single-consumer ring, so that recording an
+// event never blocks or allocates on the data path. When it is full, new events
+// are dropped and counted instead.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct StreamEvent {
+    int code;       // SOAPY_SDR_OVERFLOW, SOAPY_SDR_UNDERFLOW, SOAPY_SDR_TIME_ERROR or 0
+    int flags;      // SOAPY_SDR_HAS_TIME, SOAPY_SDR_END_BURST, ...
+    long long timeNs;
+    size_t lost;    // DMA buffers dropped (RX) or replayed (TX)
+};
+
+class EventQueue {
+  public:
+    static const size_t SIZE = 64;
+
+    EventQueue() : _head(0), _tail(0), _dropped(0) {}
+
+    // Called by the producer only.
+    bool push(const StreamEvent &event) {
+        const size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == SIZE) {
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        _events[head % SIZE] = event;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Called by the consumer only.
+    bool pop(StreamEvent &event) {
+        const size_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) == tail)
+            return false;
+        event = _events[tail % SIZE];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    uint64_t dropped(void) const {
+        return _dropped.load(std::memory_order_relaxed);
+    }
+
+  private:
+    StreamEvent _events[SIZE];
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    std::atomic<uint64_t> _dropped;
+};
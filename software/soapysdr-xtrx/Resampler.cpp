@@ -0,0 +1,392 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#include "Resampler.hpp"
+#include "Conversion.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+// Non-zero taps on either side of a halfband filter's center, for 4K-1 taps.
+#define HALFBAND_K 12
+
+// Taps per phase of the polyphase stage.
+#define POLYPHASE_TAPS 32
+
+// Largest numerator and denominator of a resampling factor.
+#define MAX_FACTOR_TERM 256
+
+// Kaiser window parameter, for about 80 dB of stopband attenuation.
+#define KAISER_BETA 8.0
+
+
+/*******************************************************************
+ * Filter design
+ ******************************************************************/
+
+static double bessel_i0(const double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Kaiser-windowed sinc lowpass with a cutoff in cycles per sample.
+static std::vector<double> design_lowpass(const size_t len, const double cutoff) {
+    std::vector<double> h(len);
+    const double center = (len - 1) / 2.0;
+    for (size_t n = 0; n < len; n++) {
+        const double t = n - center;
+        const double x = 2 * cutoff * t;
+        const double sinc = (t == 0) ? 1 : std::sin(M_PI * x) / (M_PI * x);
+        const double r = t / center;
+        const double window = bessel_i0(KAISER_BETA * std::sqrt(std::max(0.0, 1 - r * r))) /
+                              bessel_i0(KAISER_BETA);
+        h[n] = 2 * cutoff * sinc * window;
+    }
+    return h;
+}
+
+// Taps applied to interleaved IQ pairs, i.e. with every tap duplicated.
+static std::vector<float> duplicate_taps(const std::vector<double> &taps, const double gain) {
+    std::vector<float> dup(2 * taps.size());
+    for (size_t k = 0; k < taps.size(); k++)
+        dup[2 * k] = dup[2 * k + 1] = (float)(taps[k] * gain);
+    return dup;
+}
+
+// The symmetric taps of a halfband filter that aren't zero or its center,
+// normalized for unity gain at DC.
+static std::vector<double> design_halfband(void) {
+    const size_t K = HALFBAND_K;
+    const std::vector<double> h = design_lowpass(4 * K - 1, 0.25);
+    const size_t c = 2 * K - 1;
+
+    // f[i] weights e[m - 2K + 1 + i], see the decimator
+    std::vector<double> f(2 * K);
+    double sum = 0;
+    for (size_t j = 0; j < K; j++) {
+        f[K - 1 - j] = f[K + j] = h[c + 2 * j + 1];
+        sum += 2 * h[c + 2 * j + 1];
+    }
+    for (auto &tap : f)
+        tap *= 0.5 / sum;
+    return f;
+}
+
+
+/*******************************************************************
+ * Filter stages
+ ******************************************************************/
+
+// Dot product of interleaved IQ pairs with duplicated real taps, over `len`
+// floats (a multiple of 8). The 8 lanes keep the loop vectorizable without
+// reassociating floating-point additions.
+static inline void dot_iq(const float *x, const float *taps, const size_t len,
+                          float &re, float &im) {
+    float acc[8] = {0};
+    for (size_t k = 0; k < len; k += 8)
+        for (int j = 0; j < 8; j++)
+            acc[j] += x[k + j] * taps[k + j];
+    re = acc[0] + acc[2] + acc[4] + acc[6];
+    im = acc[1] + acc[3] + acc[5] + acc[7];
+}
+
+// Decimation by 2 of the samples in `x`, the first `history` of which are the
+// history. With the non-zero taps f around the center tap of 0.5, output m is
+// 0.5 * x[2m - 2K + 1] plus the dot product of f with the even samples
+// x[2m - 4K + 2], ..., x[2m], which we gather in `e` first. `phase` is the
+// parity of x[0], counting from the start of the stream.
+DSP_CLONES static size_t halfband_decimate(const float *x, float *e, const size_t phase,
+                                           const size_t history, const size_t frames,
+                                           const float *taps, float *out) {
+    const size_t K = HALFBAND_K;
+    const size_t evens = (history + frames - phase + 1) / 2;
+    for (size_t i = 0; i < evens; i++) {
+        e[2 * i] = x[2 * (phase + 2 * i)];
+        e[2 * i + 1] = x[2 * (phase + 2 * i) + 1];
+    }
+
+    size_t count = 0;
+    for (size_t p = history + phase; p < history + frames; p += 2, count++) {
+        const size_t j = (p - phase) / 2;
+        float re, im;
+        dot_iq(e + 2 * (j - 2 * K + 1), taps, 4 * K, re, im);
+        out[2 * count] = re + 0.5f * x[2 * (p - 2 * K + 1)];
+        out[2 * count + 1] = im + 0.5f * x[2 * (p - 2 * K + 1) + 1];
+    }
+    return count;
+}
+
+// Interpolation by 2: the even outputs are the dot product of 2f with the last
+// 2K inputs, the odd outputs the input at the filter's center.
+DSP_CLONES static void halfband_interpolate(const float *x, const size_t history,
+                                            const size_t frames, const float *taps,
+                                            float *out) {
+    const size_t K = HALFBAND_K;
+    for (size_t i = 0; i < frames; i++) {
+        const size_t p = history + i;
+        float re, im;
+        dot_iq(x + 2 * (p - 2 * K + 1), taps, 4 * K, re, im);
+        out[4 * i] = re;
+        out[4 * i + 1] = im;
+        out[4 * i + 2] = x[2 * (p - K + 1)];
+        out[4 * i + 3] = x[2 * (p - K + 1) + 1];
+    }
+}
+
+// Rational resampling by L/M. Output positions advance by M in units of 1/L
+// input samples, counting from the first new sample; the output at position
+// `pos` is the dot product of phase `pos % L` of the filter with the inputs up
+// to `pos / L`.
+DSP_CLONES static size_t polyphase_resample(const float *x, const size_t frames,
+                                            const unsigned L, const unsigned M,
+                                            uint64_t &pos,
+                                            const std::vector<float> *phases,
+                                            float *out) {
+    const size_t K = POLYPHASE_TAPS;
+    const uint64_t end = (uint64_t)frames * L;
+    size_t count = 0;
+    for (; pos < end; pos += M, count++) {
+        float re, im;
+        dot_iq(x + 2 * (pos / L), phases[pos % L].data(), 2 * K, re, im);
+        out[2 * count] = re;
+        out[2 * count + 1] = im;
+    }
+    pos -= end;
+    return count;
+}
+
+struct Resampler::Stage {
+    Stage(const size_t history, const size_t max_input)
+        : _history(history), _buf(2 * (history + max_input)) {}
+    virtual ~Stage() {}
+
+    virtual size_t process(const float *in, const size_t frames, float *out) = 0;
+    virtual size_t maxOutput(const size_t frames) const = 0;
+    virtual double ratio(void) const = 0;
+    virtual void reset(void) {
+        std::fill(_buf.begin(), _buf.end(), 0.0f);
+    }
+
+    size_t history(void) const { return _history; }
+
+  protected:
+    // Put the new samples behind the history.
+    float *append(const float *in, const size_t frames) {
+        memcpy(&_buf[2 * _history], in, 2 * frames * sizeof(float));
+        return _buf.data();
+    }
+
+    // Keep the last samples as the history of the next call.
+    void retire(const size_t frames) {
+        memmove(_buf.data(), &_buf[2 * frames], 2 * _history * sizeof(float));
+    }
+
+    const size_t _history;
+    std::vector<float> _buf;
+};
+
+class HalfbandDecimator : public Resampler::Stage {
+  public:
+    explicit HalfbandDecimator(const size_t max_input)
+        : Stage(4 * HALFBAND_K - 2, max_input),
+          _taps(duplicate_taps(design_halfband(), 1)),
+          _even(2 * ((4 * HALFBAND_K - 2 + max_input) / 2 + 1)), _phase(0) {}
+
+    size_t process(const float *in, const size_t frames, float *out) override {
+        const size_t count = halfband_decimate(append(in, frames), _even.data(), _phase,
+                                               _history, frames, _taps.data(), out);
+        retire(frames);
+        _phase = (_phase + frames) % 2;
+        return count;
+    }
+
+    size_t maxOutput(const size_t frames) const override { return (frames + 1) / 2; }
+    double ratio(void) const override { return 0.5; }
+    void reset(void) override {
+        Stage::reset();
+        _phase = 0;
+    }
+
+  private:
+    const std::vector<float> _taps;
+    std::vector<float> _even;
+    size_t _phase;
+};
+
+class HalfbandInterpolator : public Resampler::Stage {
+  public:
+    explicit HalfbandInterpolator(const size_t max_input)
+        : Stage(2 * HALFBAND_K - 1, max_input),
+          _taps(duplicate_taps(design_halfband(), 2)) {}
+
+    size_t process(const float *in, const size_t frames, float *out) override {
+        halfband_interpolate(append(in, frames), _history, frames, _taps.data(), out);
+        retire(frames);
+        return 2 * frames;
+    }
+
+    size_t maxOutput(const size_t frames) const override { return 2 * frames; }
+    double ratio(void) const override { return 2; }
+
+  private:
+    const std::vector<float> _taps;
+};
+
+class PolyphaseResampler : public Resampler::Stage {
+  public:
+    PolyphaseResampler(const unsigned L, const unsigned M, const size_t max_input)
+        : Stage(POLYPHASE_TAPS - 1, max_input), _L(L), _M(M), _pos(0) {
+        const size_t K = POLYPHASE_TAPS;
+        const std::vector<double> h = design_lowpass(L * K, 0.45 / std::max(L, M));
+        double sum = 0;
+        for (const double tap : h)
+            sum += tap;
+
+        // phase p, reversed to line up with the oldest input first
+        _phases.resize(L);
+        for (unsigned p = 0; p < L; p++) {
+            std::vector<double> taps(K);
+            for (size_t q = 0; q < K; q++)
+                taps[q] = h[p + (K - 1 - q) * L];
+            _phases[p] = duplicate_taps(taps, L / sum);
+        }
+    }
+
+    size_t process(const float *in, const size_t frames, float *out) override {
+        const size_t count = polyphase_resample(append(in, frames), frames, _L, _M, _pos,
+                                                _phases.data(), out);
+        retire(frames);
+        return count;
+    }
+
+    size_t maxOutput(const size_t frames) const override {
+        return ((uint64_t)frames * _L + _M - 1) / _M + 1;
+    }
+    double ratio(void) const override { return (double)_L / _M; }
+    void reset(void) override {
+        Stage::reset();
+        _pos = 0;
+    }
+
+  private:
+    const unsigned _L, _M;
+    std::vector<std::vector<float>> _phases;
+    uint64_t _pos;
+};
+
+
+/*******************************************************************
+ * Cascade
+ ******************************************************************/
+
+Resampler::Resampler(const bool interpolate, const unsigned num, const unsigned den,
+                     const size_t max_input)
+    : _max_input(max_input) {
+    if (den == 0 || num < den)
+        throw std::runtime_error("Resampler: the factor should be at least 1");
+
+    // halfbands for the largest power of two, the rest in a polyphase stage
+    unsigned halfbands = 0;
+    while ((uint64_t)num >= ((uint64_t)den << (halfbands + 1)))
+        halfbands++;
+    unsigned L = interpolate ? num : den << halfbands;
+    unsigned M = interpolate ? den << halfbands : num;
+    const unsigned g = std::gcd(L, M);
+    L /= g;
+    M /= g;
+
+    size_t frames = max_input;
+    auto add = [&](Stage *stage) {
+        _stages.emplace_back(stage);
+        frames = stage->maxOutput(frames);
+    };
+    if (interpolate && L != M)
+        add(new PolyphaseResampler(L, M, frames));
+    for (unsigned i = 0; i < halfbands; i++) {
+        if (interpolate)
+            add(new HalfbandInterpolator(frames));
+        else
+            add(new HalfbandDecimator(frames));
+    }
+    if (!interpolate && L != M)
+        add(new PolyphaseResampler(L, M, frames));
+
+    // ping-pong buffers between the stages
+    size_t largest = 0;
+    frames = max_input;
+    for (auto &stage : _stages) {
+        frames = stage->maxOutput(frames);
+        largest = std::max(largest, frames);
+    }
+    _scratch[0].resize(2 * largest);
+    _scratch[1].resize(2 * largest);
+}
+
+Resampler::~Resampler() {}
+
+size_t Resampler::process(const float *in, const size_t frames, float *out) {
+    if (frames > _max_input)
+        throw std::runtime_error("Resampler: too many frames");
+    if (_stages.empty()) {
+        memcpy(out, in, 2 * frames * sizeof(float));
+        return frames;
+    }
+
+    const float *src = in;
+    size_t n = frames;
+    for (size_t s = 0; s < _stages.size(); s++) {
+        float *dst = (s + 1 == _stages.size()) ? out : _scratch[s % 2].data();
+        n = _stages[s]->process(src, n, dst);
+        src = dst;
+    }
+    return n;
+}
+
+size_t Resampler::maxOutput(const size_t frames) const {
+    size_t n = frames;
+    for (auto &stage : _stages)
+        n = stage->maxOutput(n);
+    return n;
+}
+
+size_t Resampler::historyFrames(void) const {
+    double frames = 0, rate = 1;
+    for (auto &stage : _stages) {
+        frames += stage->history() / rate;
+        rate *= stage->ratio();
+    }
+    return (size_t)std::ceil(frames) + 1;
+}
+
+void Resampler::reset(void) {
+    for (auto &stage : _stages)
+        stage->reset();
+}
+
+void parseResamplingFactor(const std::string &value, unsigned &num, unsigned &den) {
+    const size_t slash = value.find('/');
+    const long n = std::stol(value.substr(0, slash));
+    const long d = (slash == std::string::npos) ? 1 : std::stol(value.substr(slash + 1));
+    if (n < 1 || d < 1 || n < d)
+        throw std::runtime_error("Invalid resampling factor \"" + value +
+                                 "\", expected an integer or a fraction of at least 1");
+    const long g = std::gcd(n, d);
+    if (n / g > MAX_FACTOR_TERM || d / g > MAX_FACTOR_TERM)
+        throw std::runtime_error("Invalid resampling factor \"" + value + "\", the terms "
+                                 "should be at most " + std::to_string(MAX_FACTOR_TERM));
+    num = n / g;
+    den = d / g;
+}
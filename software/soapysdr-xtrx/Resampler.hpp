@@ -0,0 +1,63 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Polyphase FIR resampling of a complex CF32 channel by a rational factor.
+//
+// The factor is split into a cascade of halfband stages, each changing the rate
+// by 2 at the cost of a single short FIR, and a final polyphase stage covering
+// the remaining factor between 1 and 2. Decimation runs the halfbands first, so
+// that the expensive stage runs at the lowest rate; interpolation runs them
+// last.
+//
+// Every stage keeps its input history in front of the new samples, so that the
+// filters are plain dot products over contiguous memory.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class Resampler {
+  public:
+    // Change the rate by `num/den`: decimate (output rate = input rate *
+    // den/num) or interpolate (output rate = input rate * num/den). The factor
+    // should be at least 1. At most `max_input` frames are processed at once.
+    Resampler(const bool interpolate, const unsigned num, const unsigned den,
+              const size_t max_input);
+    ~Resampler();
+
+    Resampler(const Resampler &) = delete;
+    Resampler &operator=(const Resampler &) = delete;
+
+    // Process `frames` samples, writing the output to `out` and returning how
+    // many were produced (at most maxOutput(frames)).
+    size_t process(const float *in, const size_t frames, float *out);
+
+    // Upper bound on the output of `frames` samples.
+    size_t maxOutput(const size_t frames) const;
+
+    // Input samples needed to flush the filters' history.
+    size_t historyFrames(void) const;
+
+    // Forget all history, as after a discontinuity.
+    void reset(void);
+
+    struct Stage;
+
+  private:
+    std::vector<std::unique_ptr<Stage>> _stages;
+    std::vector<float> _scratch[2];
+    size_t _max_input;
+};
+
+// Parse a resampling factor, as an integer or a "num/den" fraction, and
+// reduce it. Throws if it is invalid or below 1.
+void parseResamplingFactor(const std::string &value, unsigned &num, unsigned &den);
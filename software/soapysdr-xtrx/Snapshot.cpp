@@ -0,0 +1,127 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#include "Snapshot.hpp"
+#include "Conversion.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+// Samples the power threshold is evaluated over, which is also the resolution
+// of the trigger position.
+#define SNAPSHOT_BLOCK 256
+
+Snapshot::Snapshot(const size_t pre, const size_t post, const double threshold,
+                   const std::vector<size_t> &channels)
+    : _pre(pre), _post(post), _capacity(pre + post), _channels(channels),
+      _ring(_capacity * BYTES_PER_FRAME), _oldest(0), _next(0), _software(false),
+      _trigger(-1), _ready(false), _end(0), _read(0), _count(0),
+      _threshold_triggers(0) {
+    if (_capacity == 0)
+        throw std::runtime_error("Snapshot: no samples to capture");
+
+    // compared with the sum of |x|^2 over a block, in wire units
+    const double sum = threshold * 128 * 128 * SNAPSHOT_BLOCK;
+    _threshold = (uint32_t)std::min(std::max(sum, 0.0), (double)UINT32_MAX);
+}
+
+// Sum of |x|^2 over `frames` samples of each wire channel, in one pass over
+// the interleaved frames.
+DSP_CLONES
+static void blockPower(const int8_t *__restrict src, const size_t frames,
+                       uint32_t sums[WIRE_CHANNELS]) {
+    uint32_t acc[BYTES_PER_FRAME] = {0};
+    for (size_t k = 0; k < frames; k++)
+        for (size_t b = 0; b < BYTES_PER_FRAME; b++)
+            acc[b] += (int32_t)src[BYTES_PER_FRAME * k + b] * src[BYTES_PER_FRAME * k + b];
+    for (size_t c = 0; c < WIRE_CHANNELS; c++)
+        sums[c] = acc[2 * c] + acc[2 * c + 1];
+}
+
+bool Snapshot::overThreshold(const int8_t *src, const size_t frames) const {
+    uint32_t sums[WIRE_CHANNELS];
+    blockPower(src, frames, sums);
+    for (const size_t wire : _channels) {
+        // a short block at the end of a buffer is scaled up
+        if ((uint64_t)sums[wire] * SNAPSHOT_BLOCK > (uint64_t)_threshold * frames)
+            return true;
+    }
+    return false;
+}
+
+size_t Snapshot::push(const int8_t *src, const int64_t index, const size_t frames) {
+    if (_ready)
+        return 0;
+
+    if (index != _next) {
+        // a gap ends a snapshot in progress early, and the history otherwise
+        if (_trigger >= 0 && _next > _trigger) {
+            complete();
+            return 0;
+        }
+        _oldest = _next = index;
+    }
+
+    size_t done = 0;
+    while (done < frames || (_trigger >= 0 && _post == 0)) {
+        const int8_t *block = src + done * BYTES_PER_FRAME;
+        size_t n = std::min((size_t)SNAPSHOT_BLOCK, frames - done);
+
+        if (_trigger < 0) {
+            if (_software.load(std::memory_order_acquire) &&
+                _software.exchange(false, std::memory_order_acq_rel)) {
+                _trigger = _next;
+            } else if (_threshold > 0 && n > 0 && overThreshold(block, n)) {
+                _trigger = _next;
+                _threshold_triggers++;
+            }
+        }
+        if (_trigger >= 0)
+            n = std::min(n, (size_t)(_trigger + (int64_t)_post - _next));
+
+        // copy into the ring, which may wrap around
+        const size_t pos = _next % _capacity;
+        const size_t first = std::min(n, _capacity - pos);
+        memcpy(&_ring[pos * BYTES_PER_FRAME], block, first * BYTES_PER_FRAME);
+        memcpy(&_ring[0], block + first * BYTES_PER_FRAME, (n - first) * BYTES_PER_FRAME);
+        _next += n;
+        done += n;
+        _oldest = std::max(_oldest, _next - (int64_t)_capacity);
+
+        if (_trigger >= 0 && _next == _trigger + (int64_t)_post) {
+            complete();
+            break;
+        }
+    }
+    return done;
+}
+
+// Hold the samples from `pre` before the trigger up to the last one pushed,
+// ignoring software triggers until they are read out.
+void Snapshot::complete(void) {
+    _read = std::max(_trigger - (int64_t)_pre, _oldest);
+    _end = _next;
+    _ready = true;
+    _software.store(false, std::memory_order_relaxed);
+    _count++;
+}
+
+const int8_t *Snapshot::peek(size_t &frames) const {
+    const size_t pos = _read % _capacity;
+    frames = std::min({frames, remaining(), _capacity - pos});
+    return &_ring[pos * BYTES_PER_FRAME];
+}
+
+void Snapshot::consume(const size_t frames) {
+    _read += frames;
+    if (_read == _end) {
+        _ready = false;
+        _trigger = -1;
+    }
+}
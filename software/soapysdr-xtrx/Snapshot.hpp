@@ -0,0 +1,76 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Pre-trigger capture of the RX stream.
+//
+// The stream's wire samples are copied into a history ring as they are drained
+// from the DMA ring, which keeps the last `pre` samples around. Once triggered,
+// by software or by the power of the samples crossing a threshold, the ring
+// keeps filling until `post` more samples came in, and then holds the snapshot
+// (the `pre` samples before the trigger and the `post` from it on) until it has
+// been read out, at which point the next trigger is armed.
+//
+// Samples are indexed by their position in the stream, so that a gap (e.g. an
+// overflow) can be detected: the history then starts over after the gap,
+// shortening the pre-trigger part of a snapshot.
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+class Snapshot {
+  public:
+    // `threshold` is the mean power over a block of samples of any of the
+    // `channels` (wire channels) that triggers, relative to full scale, or
+    // 0 to only trigger from software.
+    Snapshot(const size_t pre, const size_t post, const double threshold,
+             const std::vector<size_t> &channels);
+
+    // Trigger on the next sample pushed, unless a snapshot is in progress.
+    void trigger(void) { _software.store(true, std::memory_order_release); }
+
+    // Copy wire samples starting at stream position `index` into the history,
+    // until a snapshot is complete. Returns the number of samples consumed.
+    size_t push(const int8_t *src, const int64_t index, const size_t frames);
+
+    // Whether a snapshot is waiting to be read out, the stream position of its
+    // next sample to read, and the samples left to read.
+    bool ready(void) const { return _ready; }
+    int64_t position(void) const { return _read; }
+    size_t remaining(void) const { return _end - _read; }
+
+    // Next contiguous run of wire samples of the snapshot, at most `frames`,
+    // to be consumed once converted. Reading the last one re-arms the trigger.
+    const int8_t *peek(size_t &frames) const;
+    void consume(const size_t frames);
+
+    // Snapshots completed, and triggers by the threshold.
+    uint64_t count(void) const { return _count.load(); }
+    uint64_t thresholdTriggers(void) const { return _threshold_triggers.load(); }
+
+  private:
+    bool overThreshold(const int8_t *src, const size_t frames) const;
+    void complete(void);
+
+    const size_t _pre, _post, _capacity;
+    const std::vector<size_t> _channels;
+    uint32_t _threshold;
+
+    std::vector<int8_t> _ring;
+    int64_t _oldest, _next;
+
+    std::atomic<bool> _software;
+    int64_t _trigger;
+    bool _ready;
+    int64_t _end, _read;
+
+    std::atomic<uint64_t> _count, _threshold_triggers;
+};
@@ -0,0 +1,236 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#include "Spectrum.hpp"
+#include "Conversion.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+
+// Range of FFT sizes, the largest spanning a couple of DMA buffers.
+#define MIN_FFT_SIZE 16
+#define MAX_FFT_SIZE 65536
+
+SpectrumConfig::SpectrumConfig()
+    : fft_size(1024), window("hann"), max_hold(false), averages(16), rate(10) {}
+
+
+/*******************************************************************
+ * FFT
+ ******************************************************************/
+
+FFT::FFT(const size_t size) : _twiddles(size / 2), _reversed(size) {
+    size_t bits = 0;
+    while (((size_t)1 << bits) < size)
+        bits++;
+    for (size_t k = 0; k < size / 2; k++)
+        _twiddles[k] = std::polar(1.0f, (float)(-2 * M_PI * k / size));
+    for (size_t i = 0; i < size; i++) {
+        uint32_t r = 0;
+        for (size_t b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        _reversed[i] = r;
+    }
+}
+
+// Iterative decimation in time. The butterflies multiply by hand, as
+// std::complex multiplication checks for infinities without -ffast-math.
+void FFT::transform(std::complex<float> *data) const {
+    const size_t n = size();
+    for (size_t i = 0; i < n; i++) {
+        const size_t j = _reversed[i];
+        if (i < j)
+            std::swap(data[i], data[j]);
+    }
+
+    float *d = reinterpret_cast<float *>(data);
+    const float *tw = reinterpret_cast<const float *>(_twiddles.data());
+    for (size_t half = 1, step = n / 2; half < n; half *= 2, step /= 2) {
+        for (size_t i = 0; i < n; i += 2 * half) {
+            float *a = d + 2 * i, *b = d + 2 * (i + half);
+            for (size_t k = 0; k < half; k++) {
+                const float wr = tw[2 * k * step], wi = tw[2 * k * step + 1];
+                const float vr = b[2 * k] * wr - b[2 * k + 1] * wi;
+                const float vi = b[2 * k] * wi + b[2 * k + 1] * wr;
+                const float ur = a[2 * k], ui = a[2 * k + 1];
+                a[2 * k] = ur + vr;
+                a[2 * k + 1] = ui + vi;
+                b[2 * k] = ur - vr;
+                b[2 * k + 1] = ui - vi;
+            }
+        }
+    }
+}
+
+
+/*******************************************************************
+ * Spectrum
+ ******************************************************************/
+
+static std::vector<float> makeWindow(const std::string &name, const size_t size) {
+    std::vector<float> w(size);
+    for (size_t k = 0; k < size; k++) {
+        const double x = 2 * M_PI * k / size;
+        if (name == "rect")
+            w[k] = 1;
+        else if (name == "hann")
+            w[k] = 0.5 - 0.5 * cos(x);
+        else if (name == "hamming")
+            w[k] = 0.54 - 0.46 * cos(x);
+        else if (name == "blackmanharris")
+            w[k] = 0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) -
+                   0.01168 * cos(3 * x);
+        else
+            throw std::runtime_error("Unknown PSD window: " + name);
+    }
+    return w;
+}
+
+static size_t checkedFFTSize(const size_t size) {
+    if (size < MIN_FFT_SIZE || size > MAX_FFT_SIZE || (size & (size - 1)))
+        throw std::runtime_error("PSD FFT size should be a power of two between " +
+                                 std::to_string(MIN_FFT_SIZE) + " and " +
+                                 std::to_string(MAX_FFT_SIZE));
+    return size;
+}
+
+Spectrum::Spectrum(const SpectrumConfig &config, const std::vector<size_t> &channels)
+    : _config(config), _channels(channels), _fft(checkedFFTSize(config.fft_size)),
+      _window(makeWindow(config.window, config.fft_size)), _wanted(false),
+      _capture(config.fft_size * BYTES_PER_FRAME), _filled(0), _stop(false),
+      _work(config.fft_size), _power(channels.size() * config.fft_size),
+      _updates(0) {
+    if (config.averages < 1)
+        throw std::runtime_error("PSD averages should be at least 1");
+    if (!(config.rate > 0))
+        throw std::runtime_error("PSD rate should be positive");
+
+    // a full-scale tone at the center of a bin reads 0 dBFS, whatever the
+    // window; wire samples are scaled to [-1, 1)
+    double gain = 0;
+    for (const float w : _window)
+        gain += w;
+    _scale = 1.0 / (gain * gain * 128 * 128);
+    if (!config.max_hold)
+        _scale /= config.averages;
+
+    _thread = std::thread(&Spectrum::work, this);
+}
+
+Spectrum::~Spectrum() {
+    {
+        std::lock_guard<std::mutex> lock(_capture_mutex);
+        _stop = true;
+    }
+    _captured.notify_all();
+    _thread.join();
+}
+
+std::vector<float> Spectrum::read(const size_t index) const {
+    const size_t n = _config.fft_size;
+    std::lock_guard<std::mutex> lock(_result_mutex);
+    if (_result.empty() || index >= _channels.size())
+        return std::vector<float>();
+    return std::vector<float>(_result.begin() + index * n, _result.begin() + (index + 1) * n);
+}
+
+void Spectrum::capture(const int8_t *src, const size_t frames) {
+    std::lock_guard<std::mutex> lock(_capture_mutex);
+    if (!_wanted.load(std::memory_order_relaxed))
+        return;
+
+    // frames may span consecutive buffers
+    const size_t n = std::min(frames, _config.fft_size - _filled);
+    memcpy(&_capture[_filled * BYTES_PER_FRAME], src, n * BYTES_PER_FRAME);
+    _filled += n;
+    if (_filled == _config.fft_size) {
+        _wanted.store(false, std::memory_order_release);
+        _captured.notify_one();
+    }
+}
+
+void Spectrum::accumulate(const int8_t *src, const bool first) {
+    const size_t n = _config.fft_size;
+    for (size_t i = 0; i < _channels.size(); i++) {
+        const size_t wire = _channels[i];
+        for (size_t k = 0; k < n; k++)
+            _work[k] = std::complex<float>(src[BYTES_PER_FRAME * k + 2 * wire] * _window[k],
+                                           src[BYTES_PER_FRAME * k + 2 * wire + 1] * _window[k]);
+        _fft.transform(_work.data());
+
+        float *power = &_power[i * n];
+        for (size_t k = 0; k < n; k++) {
+            const float p = _work[k].real() * _work[k].real() + _work[k].imag() * _work[k].imag();
+            if (first)
+                power[k] = p;
+            else if (_config.max_hold)
+                power[k] = std::max(power[k], p);
+            else
+                power[k] += p;
+        }
+    }
+}
+
+void Spectrum::work(void) {
+    const auto period = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>(1 / _config.rate));
+    const size_t n = _config.fft_size;
+    std::vector<int8_t> frame(_capture.size());
+    std::vector<float> result(_power.size());
+    auto next = std::chrono::steady_clock::now();
+
+    std::unique_lock<std::mutex> lock(_capture_mutex);
+    while (!_stop) {
+        // collect and transform the frames of an update, one at a time
+        for (size_t a = 0; a < _config.averages; a++) {
+            _filled = 0;
+            _wanted.store(true, std::memory_order_release);
+            _captured.wait(lock, [&] {
+                return _stop || !_wanted.load(std::memory_order_relaxed);
+            });
+            if (_stop)
+                return;
+            frame.swap(_capture);
+
+            lock.unlock();
+            accumulate(frame.data(), a == 0);
+            lock.lock();
+        }
+
+        // publish in dBFS, with DC in the middle
+        for (size_t i = 0; i < _channels.size(); i++)
+            for (size_t k = 0; k < n; k++)
+                result[i * n + k] =
+                    10 * log10f(_power[i * n + ((k + n / 2) % n)] * _scale + 1e-20f);
+        {
+            std::lock_guard<std::mutex> result_lock(_result_mutex);
+            _result.swap(result);
+            result.resize(_power.size());
+        }
+        _updates++;
+
+        // don't try to catch up on updates missed while the stream was idle
+        next = std::max(next + period, std::chrono::steady_clock::now());
+        _captured.wait_until(lock, next, [&] { return _stop; });
+    }
+}
+
+std::string formatPSD(const std::vector<float> &psd) {
+    std::string s;
+    s.reserve(psd.size() * 7);
+    char value[16];
+    for (size_t k = 0; k < psd.size(); k++) {
+        snprintf(value, sizeof(value), k ? ",%.1f" : "%.1f", psd[k]);
+        s += value;
+    }
+    return s;
+}
@@ -0,0 +1,114 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Averaged power spectral density of the RX stream, computed in the background.
+//
+// The streaming thread taps the RX buffers it acquires, but only copies samples
+// out of them when the worker asked for an FFT frame, so the stream only pays
+// an atomic load per buffer otherwise. The worker collects `averages` frames
+// per update, windows and transforms them, and averages their power spectra
+// before publishing the result, then sleeps until the next update is due.
+
+#pragma once
+
+#include <atomic>
+#include <complex>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct SpectrumConfig {
+    SpectrumConfig();
+
+    // power-of-two number of bins
+    size_t fft_size;
+
+    // "rect", "hann", "hamming" or "blackmanharris"
+    std::string window;
+
+    // average the power of `averages` frames per update, or keep its maximum
+    bool max_hold;
+    size_t averages;
+
+    // updates per second
+    double rate;
+};
+
+// Radix-2 FFT of a fixed size, in place.
+class FFT {
+  public:
+    explicit FFT(const size_t size);
+
+    void transform(std::complex<float> *data) const;
+    size_t size(void) const { return _twiddles.size() * 2; }
+
+  private:
+    std::vector<std::complex<float>> _twiddles;
+    std::vector<uint32_t> _reversed;
+};
+
+class Spectrum {
+  public:
+    // `channels` are the wire channels of the RX stream.
+    Spectrum(const SpectrumConfig &config, const std::vector<size_t> &channels);
+    ~Spectrum();
+
+    Spectrum(const Spectrum &) = delete;
+    Spectrum &operator=(const Spectrum &) = delete;
+
+    // Called for every RX buffer of `frames` wire samples.
+    void tap(const int8_t *src, const size_t frames) {
+        if (_wanted.load(std::memory_order_acquire))
+            capture(src, frames);
+    }
+
+    // The latest PSD of the `index`th stream channel, in dBFS per bin from
+    // -rate/2 to +rate/2, or an empty vector before the first update.
+    std::vector<float> read(const size_t index) const;
+
+    uint64_t updates(void) const { return _updates.load(); }
+    const SpectrumConfig &config(void) const { return _config; }
+
+    // Window, transform and accumulate the power of a frame of wire samples,
+    // starting over with the first frame of an update. Exposed for benchmarks.
+    void accumulate(const int8_t *src, const bool first);
+
+  private:
+    void capture(const int8_t *src, const size_t frames);
+    void work(void);
+
+    const SpectrumConfig _config;
+    const std::vector<size_t> _channels;
+    const FFT _fft;
+    std::vector<float> _window;
+    float _scale;
+
+    // frame requested from the streaming thread
+    std::mutex _capture_mutex;
+    std::condition_variable _captured;
+    std::atomic<bool> _wanted;
+    std::vector<int8_t> _capture;
+    size_t _filled;
+    bool _stop;
+
+    std::vector<std::complex<float>> _work;
+    std::vector<float> _power;
+
+    mutable std::mutex _result_mutex;
+    std::vector<float> _result;
+    std::atomic<uint64_t> _updates;
+
+    std::thread _thread;
+};
+
+// A PSD as comma-separated dB values, with 0.1 dB resolution.
+std::string formatPSD(const std::vector<float> &psd);
@@ -0,0 +1,463 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#include "StreamDSP.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+
+ChannelCorrection::ChannelCorrection()
+    : iq_matrix{1, 0, 0, 1}, dc_tracking(false), dc_tau(1 << 16), dc_offset(0),
+      nco_freq(0) {}
+
+void parseFloatList(const std::string &value, float *out, const size_t count) {
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        const size_t end = value.find(',', pos);
+        if ((i + 1 < count) != (end != std::string::npos))
+            throw std::runtime_error("Expected " + std::to_string(count) +
+                                     " comma-separated values, got \"" + value + "\"");
+        out[i] = std::stof(value.substr(pos, end - pos));
+        pos = end + 1;
+    }
+}
+
+std::string formatFloatList(const float *values, const size_t count) {
+    std::string s;
+    for (size_t i = 0; i < count; i++)
+        s += (i ? "," : "") + std::to_string(values[i]);
+    return s;
+}
+
+
+/*******************************************************************
+ * Format conversion
+ ******************************************************************/
+
+// Between CF32 and the user formats, with the same scaling as the conversion
+// kernels: the wire's full scale is 1.0 in CF32/CF64, 128 in CS8 and 32768 in
+// CS16.
+
+template <typename T> struct FormatScale;
+template <> struct FormatScale<int8_t> { static constexpr float value = 128.0f; };
+template <> struct FormatScale<int16_t> { static constexpr float value = 32768.0f; };
+
+template <typename T>
+static inline T saturate(const float x) {
+    const float lo = std::numeric_limits<T>::min(), hi = std::numeric_limits<T>::max();
+    const float v = std::min(std::max(x, lo), hi);
+    return (T)(v + (v >= 0 ? 0.5f : -0.5f));
+}
+
+template <typename T>
+DSP_CLONES static void to_cf32(const T *src, float *dst, size_t n) {
+    const float scale = 1.0f / FormatScale<T>::value;
+    for (size_t k = 0; k < n; k++)
+        dst[k] = src[k] * scale;
+}
+
+template <>
+void to_cf32<float>(const float *src, float *dst, size_t n) {
+    memcpy(dst, src, n * sizeof(float));
+}
+
+template <>
+DSP_CLONES void to_cf32<double>(const double *src, float *dst, size_t n) {
+    for (size_t k = 0; k < n; k++)
+        dst[k] = (float)src[k];
+}
+
+template <typename T>
+DSP_CLONES static void from_cf32(const float *src, T *dst, size_t n) {
+    const float scale = FormatScale<T>::value;
+    for (size_t k = 0; k < n; k++)
+        dst[k] = saturate<T>(src[k] * scale);
+}
+
+template <>
+DSP_CLONES void from_cf32<double>(const float *src, double *dst, size_t n) {
+    for (size_t k = 0; k < n; k++)
+        dst[k] = src[k];
+}
+
+
+/*******************************************************************
+ * Corrections
+ ******************************************************************/
+
+// Subtract the DC offset and apply the IQ matrix, while summing the original
+// samples to estimate the DC offset. Accumulating in 8 lanes keeps the loop
+// vectorizable without reassociating floating-point additions.
+DSP_CLONES static void correct_rx(float *iq, size_t frames, const float m[4],
+                                  const float dc[2], float sum[2]) {
+    // local copies, as the stores to `iq` could otherwise alias them
+    const float m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+    const float dc_i = dc[0], dc_q = dc[1];
+    float acc[8] = {0};
+    size_t k = 0;
+    for (; k + 4 <= frames; k += 4) {
+        float *v = iq + 2 * k;
+        for (int j = 0; j < 8; j++)
+            acc[j] += v[j];
+        for (int j = 0; j < 8; j += 2) {
+            const float i = v[j] - dc_i, q = v[j + 1] - dc_q;
+            v[j] = m0 * i + m1 * q;
+            v[j + 1] = m2 * i + m3 * q;
+        }
+    }
+    for (; k < frames; k++) {
+        float *v = iq + 2 * k;
+        acc[0] += v[0];
+        acc[1] += v[1];
+        const float i = v[0] - dc_i, q = v[1] - dc_q;
+        v[0] = m0 * i + m1 * q;
+        v[1] = m2 * i + m3 * q;
+    }
+    sum[0] = acc[0] + acc[2] + acc[4] + acc[6];
+    sum[1] = acc[1] + acc[3] + acc[5] + acc[7];
+}
+
+// Apply the IQ matrix, then add the DC offset.
+DSP_CLONES static void correct_tx(float *iq, size_t frames, const float m[4],
+                                  const float dc[2]) {
+    const float m0 = m[0], m1 = m[1], m2 = m[2], m3 = m[3];
+    const float dc_i = dc[0], dc_q = dc[1];
+    for (size_t k = 0; k < frames; k++) {
+        const float i = iq[2 * k], q = iq[2 * k + 1];
+        iq[2 * k] = m0 * i + m1 * q + dc_i;
+        iq[2 * k + 1] = m2 * i + m3 * q + dc_q;
+    }
+}
+
+// Multiply by the NCO's phasors, i.e. the table rotated by the phasor `p`.
+DSP_CLONES static void mix_nco(float *__restrict iq, size_t frames,
+                               const float *__restrict table,
+                               const float p_re, const float p_im) {
+    for (size_t k = 0; k < frames; k++) {
+        const float t_re = table[2 * k], t_im = table[2 * k + 1];
+        const float o_re = t_re * p_re - t_im * p_im;
+        const float o_im = t_re * p_im + t_im * p_re;
+        const float i = iq[2 * k], q = iq[2 * k + 1];
+        iq[2 * k] = i * o_re - q * o_im;
+        iq[2 * k + 1] = i * o_im + q * o_re;
+    }
+}
+
+void StreamDSP::correctRX(Channel &ch, float *iq, const size_t frames) {
+    if (ch.identity)
+        return;
+
+    float sum[2];
+    correct_rx(iq, frames, ch.correction.iq_matrix, ch.dc, sum);
+
+    if (ch.correction.dc_tracking) {
+        // first-order tracking, with a gain matching the time constant
+        const float gain = 1.0f - std::exp(-(float)frames / ch.correction.dc_tau);
+        for (int k = 0; k < 2; k++) {
+            ch.dc[k] += gain * (sum[k] / frames - ch.dc[k]);
+            ch.dc_published[k].store(ch.dc[k], std::memory_order_relaxed);
+        }
+    }
+}
+
+void StreamDSP::correctTX(Channel &ch, float *iq, const size_t frames) {
+    if (ch.identity)
+        return;
+
+    const float dc[2] = {ch.correction.dc_offset.real(), ch.correction.dc_offset.imag()};
+    correct_tx(iq, frames, ch.correction.iq_matrix, dc);
+}
+
+void StreamDSP::mix(Channel &ch, float *iq, const size_t frames) {
+    if (!ch.nco)
+        return;
+
+    // start each block from the exact phase, so that errors don't accumulate
+    const double sign = _rx ? -1 : 1;
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        const size_t n = std::min((size_t)BLOCK_FRAMES, frames - done);
+        const std::complex<double> p = std::polar(1.0, sign * 2 * M_PI * ch.nco_phase);
+        mix_nco(iq + 2 * done, n, ch.nco_table, (float)p.real(), (float)p.imag());
+
+        ch.nco_phase += n * ch.nco_step;
+        ch.nco_phase -= std::floor(ch.nco_phase);
+    }
+}
+
+
+/*******************************************************************
+ * Stream processing
+ ******************************************************************/
+
+StreamDSP::StreamDSP(const bool rx, const StreamFormat format,
+                     const std::vector<size_t> &channels)
+    : _rx(rx), _format(format), _count(channels.size()), _rate(0), _updated(false),
+      _num(1), _den(1), _max_input(0), _output_count(0), _output_pos(0), _output_index(0) {
+    if (_count > WIRE_CHANNELS)
+        throw std::runtime_error("StreamDSP: too many channels");
+    for (size_t i = 0; i < _count; i++) {
+        Channel &ch = _channels[i];
+        ch.wire = channels[i];
+        ch.identity = true;
+        ch.dc[0] = ch.dc[1] = 0;
+        ch.dc_published[0] = ch.dc_published[1] = 0;
+        ch.nco = false;
+        ch.nco_phase = ch.nco_step = 0;
+    }
+}
+
+void StreamDSP::setCorrection(const size_t index, const ChannelCorrection &correction) {
+    if (index >= _count)
+        throw std::runtime_error("StreamDSP: invalid channel");
+    if (correction.dc_tau <= 0)
+        throw std::runtime_error("StreamDSP: the DC time constant should be positive");
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (correction.nco_freq != 0 && !(std::abs(correction.nco_freq) <= _rate / 2))
+        throw std::runtime_error("StreamDSP: the NCO frequency should be within "
+                                 "half the sample rate");
+    _pending[index] = correction;
+    _updated.store(true, std::memory_order_release);
+}
+
+ChannelCorrection StreamDSP::getCorrection(const size_t index) const {
+    if (index >= _count)
+        throw std::runtime_error("StreamDSP: invalid channel");
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _pending[index];
+}
+
+std::complex<float> StreamDSP::getDCEstimate(const size_t index) const {
+    if (index >= _count)
+        throw std::runtime_error("StreamDSP: invalid channel");
+    return std::complex<float>(_channels[index].dc_published[0].load(std::memory_order_relaxed),
+                               _channels[index].dc_published[1].load(std::memory_order_relaxed));
+}
+
+void StreamDSP::setSampleRate(const double rate) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _rate = rate;
+    _updated.store(true, std::memory_order_release);
+}
+
+void StreamDSP::applySettings(void) {
+    if (!_updated.exchange(false, std::memory_order_acquire))
+        return;
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (size_t i = 0; i < _count; i++) {
+        Channel &ch = _channels[i];
+        ch.correction = _pending[i];
+
+        const float *m = ch.correction.iq_matrix;
+        const bool iq = !(m[0] == 1 && m[1] == 0 && m[2] == 0 && m[3] == 1);
+        if (_rx) {
+            // keep the estimate when tracking, forget it otherwise
+            if (!ch.correction.dc_tracking) {
+                ch.dc[0] = ch.dc[1] = 0;
+                ch.dc_published[0] = ch.dc_published[1] = 0;
+            }
+            ch.identity = !iq && !ch.correction.dc_tracking;
+        } else {
+            ch.identity = !iq && ch.correction.dc_offset == std::complex<float>(0);
+        }
+
+        // keep the phase, only the rate it advances at changes
+        const double step = (_rate > 0) ? ch.correction.nco_freq / _rate : 0;
+        ch.nco = step != 0;
+        if (step != ch.nco_step) {
+            const double sign = _rx ? -1 : 1;
+            for (size_t k = 0; k < BLOCK_FRAMES; k++) {
+                const std::complex<double> t = std::polar(1.0, sign * 2 * M_PI * step * k);
+                ch.nco_table[2 * k] = (float)t.real();
+                ch.nco_table[2 * k + 1] = (float)t.imag();
+            }
+            ch.nco_step = step;
+        }
+    }
+}
+
+void StreamDSP::rx(const int8_t *src, void *const *buffs, size_t offset, size_t frames) {
+    applySettings();
+    const ConversionKernels &kernels = getConversionKernels();
+    float scratch[2 * BLOCK_FRAMES];
+
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        const size_t n = std::min((size_t)BLOCK_FRAMES, frames - done);
+        const int8_t *block = src + done * BYTES_PER_FRAME;
+        const size_t pos = 2 * (offset + done);
+        for (size_t i = 0; i < _count; i++) {
+            Channel &ch = _channels[i];
+
+            // CF32 streams are processed in place
+            float *iq = (_format == StreamFormat::CF32) ? (float *)buffs[i] + pos : scratch;
+            kernels.deinterleave_cf32(block, iq, n, ch.wire);
+            correctRX(ch, iq, n);
+            mix(ch, iq, n);
+
+            switch (_format) {
+            case StreamFormat::CS8:  from_cf32(iq, (int8_t *)buffs[i] + pos, 2 * n); break;
+            case StreamFormat::CS16: from_cf32(iq, (int16_t *)buffs[i] + pos, 2 * n); break;
+            case StreamFormat::CF32: break;
+            case StreamFormat::CF64: from_cf32(iq, (double *)buffs[i] + pos, 2 * n); break;
+            }
+        }
+    }
+}
+
+void StreamDSP::tx(const void *const *buffs, int8_t *dst, size_t offset, size_t frames) {
+    applySettings();
+    const ConversionKernels &kernels = getConversionKernels();
+    float scratch[2 * BLOCK_FRAMES];
+
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        const size_t n = std::min((size_t)BLOCK_FRAMES, frames - done);
+        int8_t *block = dst + done * BYTES_PER_FRAME;
+        const size_t pos = 2 * (offset + done);
+        for (size_t i = 0; i < _count; i++) {
+            Channel &ch = _channels[i];
+
+            // the user's samples are read-only, so always work on a copy
+            switch (_format) {
+            case StreamFormat::CS8:  to_cf32((const int8_t *)buffs[i] + pos, scratch, 2 * n); break;
+            case StreamFormat::CS16: to_cf32((const int16_t *)buffs[i] + pos, scratch, 2 * n); break;
+            case StreamFormat::CF32: to_cf32((const float *)buffs[i] + pos, scratch, 2 * n); break;
+            case StreamFormat::CF64: to_cf32((const double *)buffs[i] + pos, scratch, 2 * n); break;
+            }
+            mix(ch, scratch, n);
+            correctTX(ch, scratch, n);
+            kernels.interleave_cf32(scratch, block, n, ch.wire);
+        }
+    }
+}
+
+
+/*******************************************************************
+ * Resampling
+ ******************************************************************/
+
+// Input accepted at once: RX keeps whole DMA buffers' worth of blocks together,
+// TX has to fit the interpolated output.
+#define RX_RESAMPLING_BLOCKS 16
+#define TX_RESAMPLING_BLOCKS 4
+
+void StreamDSP::setResampling(const unsigned num, const unsigned den) {
+    _num = num;
+    _den = den;
+    const size_t blocks = _rx ? RX_RESAMPLING_BLOCKS : TX_RESAMPLING_BLOCKS;
+    _max_input = blocks * BLOCK_FRAMES;
+    for (size_t i = 0; i < _count; i++) {
+        _resamplers[i].reset(new Resampler(!_rx, num, den, BLOCK_FRAMES));
+        _output[i].assign(2 * blocks * _resamplers[i]->maxOutput(BLOCK_FRAMES), 0.0f);
+    }
+    resetResampling();
+}
+
+double StreamDSP::resamplingRatio(void) const {
+    return _rx ? (double)_den / _num : (double)_num / _den;
+}
+
+void StreamDSP::resetResampling(void) {
+    for (size_t i = 0; i < _count; i++)
+        if (_resamplers[i])
+            _resamplers[i]->reset();
+    _output_count = _output_pos = _output_index = 0;
+}
+
+void StreamDSP::rxInput(const int8_t *src, const size_t frames) {
+    if (pending() != 0 || frames > _max_input)
+        throw std::runtime_error("StreamDSP: output still pending");
+    applySettings();
+    const ConversionKernels &kernels = getConversionKernels();
+    float scratch[2 * BLOCK_FRAMES];
+
+    _output_count = _output_pos = 0;
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        const size_t n = std::min((size_t)BLOCK_FRAMES, frames - done);
+        const int8_t *block = src + done * BYTES_PER_FRAME;
+        size_t produced = 0;
+        for (size_t i = 0; i < _count; i++) {
+            Channel &ch = _channels[i];
+            kernels.deinterleave_cf32(block, scratch, n, ch.wire);
+            correctRX(ch, scratch, n);
+            mix(ch, scratch, n);
+            produced = _resamplers[i]->process(scratch, n, &_output[i][2 * _output_count]);
+        }
+        _output_count += produced;
+    }
+}
+
+size_t StreamDSP::rxOutput(void *const *buffs, const size_t offset, const size_t frames) {
+    const size_t n = std::min(frames, pending());
+    for (size_t i = 0; i < _count; i++) {
+        const float *iq = &_output[i][2 * _output_pos];
+        const size_t pos = 2 * offset;
+        switch (_format) {
+        case StreamFormat::CS8:  from_cf32(iq, (int8_t *)buffs[i] + pos, 2 * n); break;
+        case StreamFormat::CS16: from_cf32(iq, (int16_t *)buffs[i] + pos, 2 * n); break;
+        case StreamFormat::CF32: memcpy((float *)buffs[i] + pos, iq, 2 * n * sizeof(float)); break;
+        case StreamFormat::CF64: from_cf32(iq, (double *)buffs[i] + pos, 2 * n); break;
+        }
+    }
+    _output_pos += n;
+    _output_index += n;
+    return n;
+}
+
+void StreamDSP::txInput(const void *const *buffs, const size_t offset, const size_t frames) {
+    if (pending() != 0 || frames > _max_input)
+        throw std::runtime_error("StreamDSP: output still pending");
+    applySettings();
+    float scratch[2 * BLOCK_FRAMES];
+
+    _output_count = _output_pos = 0;
+    for (size_t done = 0; done < frames; done += BLOCK_FRAMES) {
+        const size_t n = std::min((size_t)BLOCK_FRAMES, frames - done);
+        const size_t pos = 2 * (offset + done);
+        size_t produced = 0;
+        for (size_t i = 0; i < _count; i++) {
+            Channel &ch = _channels[i];
+            if (buffs) {
+                switch (_format) {
+                case StreamFormat::CS8:  to_cf32((const int8_t *)buffs[i] + pos, scratch, 2 * n); break;
+                case StreamFormat::CS16: to_cf32((const int16_t *)buffs[i] + pos, scratch, 2 * n); break;
+                case StreamFormat::CF32: to_cf32((const float *)buffs[i] + pos, scratch, 2 * n); break;
+                case StreamFormat::CF64: to_cf32((const double *)buffs[i] + pos, scratch, 2 * n); break;
+                }
+            } else {
+                memset(scratch, 0, 2 * n * sizeof(float));
+            }
+
+            float *iq = &_output[i][2 * _output_count];
+            produced = _resamplers[i]->process(scratch, n, iq);
+            mix(ch, iq, produced);
+            correctTX(ch, iq, produced);
+        }
+        _output_count += produced;
+    }
+}
+
+void StreamDSP::txFlush(void) {
+    // feed silence until the last samples made it through the filters
+    const size_t frames = std::min(_resamplers[0]->historyFrames(), _max_input);
+    txInput(nullptr, 0, frames);
+    for (size_t i = 0; i < _count; i++)
+        _resamplers[i]->reset();
+}
+
+size_t StreamDSP::txOutput(int8_t *dst, const size_t frames) {
+    const ConversionKernels &kernels = getConversionKernels();
+    const size_t n = std::min(frames, pending());
+    for (size_t i = 0; i < _count; i++)
+        kernels.interleave_cf32(&_output[i][2 * _output_pos], dst, n, _channels[i].wire);
+    _output_pos += n;
+    _output_index += n;
+    return n;
+}
@@ -0,0 +1,154 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Optional signal processing fused into the sample conversion of a stream:
+// DC and IQ corrections, a frequency shift by a numerically controlled
+// oscillator (NCO), and resampling.
+//
+// Samples are converted in blocks small enough to stay in L1: a block of wire
+// samples is unpacked to CF32 by the regular conversion kernels, corrected in
+// place, and only then written out in the user format (or the other way around
+// for TX). That way the processing adds arithmetic, but no memory traffic.
+//
+// Settings can be changed while streaming: they are handed to the streaming
+// thread under a lock, and picked up at the start of its next call.
+//
+// When resampling, the number of samples differs on both sides, so the output
+// is buffered: input is only accepted once the previous output has been read
+// out, and the stream alternates between the two.
+
+#pragma once
+
+#include "Conversion.hpp"
+#include "Resampler.hpp"
+
+#include <atomic>
+#include <complex>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Processing of a single channel.
+struct ChannelCorrection {
+    ChannelCorrection();
+
+    // IQ imbalance correction, as a real matrix applied to [I Q], row-major
+    float iq_matrix[4];
+
+    // RX: estimate the DC offset with a time constant of `dc_tau` samples,
+    //     and subtract it (before the IQ correction)
+    bool dc_tracking;
+    double dc_tau;
+
+    // TX: DC offset added to the samples (after the IQ correction)
+    std::complex<float> dc_offset;
+
+    // Frequency shift in Hz, phase-continuous across calls and changes:
+    // RX moves a signal at +nco_freq down to DC (after the corrections),
+    // TX moves DC up to +nco_freq (before the corrections)
+    double nco_freq;
+};
+
+// Parse `count` comma-separated numbers, as used by the stream args and
+// settings, e.g. "1,0,0,1" for an IQ matrix.
+void parseFloatList(const std::string &value, float *out, const size_t count);
+std::string formatFloatList(const float *values, const size_t count);
+
+class StreamDSP {
+  public:
+    StreamDSP(const bool rx, const StreamFormat format,
+              const std::vector<size_t> &channels);
+
+    // `index` is the position of a channel in the stream's channel list
+    void setCorrection(const size_t index, const ChannelCorrection &correction);
+    ChannelCorrection getCorrection(const size_t index) const;
+
+    // RX: the DC offset currently estimated, in normalized units
+    std::complex<float> getDCEstimate(const size_t index) const;
+
+    // The sample rate the NCO frequencies are relative to.
+    void setSampleRate(const double rate);
+
+    // Drop-in replacements for the stream converters, without resampling.
+    void rx(const int8_t *src, void *const *buffs, size_t offset, size_t frames);
+    void tx(const void *const *buffs, int8_t *dst, size_t offset, size_t frames);
+
+    // Resample by `num/den`, at least 1: RX decimates after the corrections
+    // and the NCO, TX interpolates before them. Only before streaming.
+    void setResampling(const unsigned num, const unsigned den);
+    bool resampling(void) const { return _resamplers[0] != nullptr; }
+
+    // Output samples per input sample.
+    double resamplingRatio(void) const;
+
+    // Forget the filters' history and the buffered output, e.g. after samples
+    // were lost.
+    void resetResampling(void);
+
+    // Most samples accepted by rxInput/txInput, which need pending() == 0.
+    size_t maxInput(void) const { return _max_input; }
+
+    // Output buffered, and output handed out since the last reset.
+    size_t pending(void) const { return _output_count - _output_pos; }
+    uint64_t outputIndex(void) const { return _output_index; }
+
+    // RX: resample wire samples, then hand out up to `frames` of the output.
+    void rxInput(const int8_t *src, size_t frames);
+    size_t rxOutput(void *const *buffs, size_t offset, size_t frames);
+
+    // TX: resample user samples (or silence if `buffs` is null), then write
+    // out up to `frames` of the output. txFlush pushes the filters' history
+    // out, e.g. at the end of a burst.
+    void txInput(const void *const *buffs, size_t offset, size_t frames);
+    void txFlush(void);
+    size_t txOutput(int8_t *dst, size_t frames);
+
+    // Frames processed at once, keeping a block of CF32 samples well within L1.
+    static const size_t BLOCK_FRAMES = 256;
+
+  private:
+    struct Channel {
+        size_t wire;
+        ChannelCorrection correction;
+        bool identity;
+        float dc[2];
+        std::atomic<float> dc_published[2];
+
+        // the NCO's phase (in cycles) and increment per sample, and its
+        // phasors over a block, starting from a phase of 0
+        bool nco;
+        double nco_phase, nco_step;
+        float nco_table[2 * BLOCK_FRAMES];
+    };
+
+    void applySettings(void);
+    void correctRX(Channel &ch, float *iq, const size_t frames);
+    void correctTX(Channel &ch, float *iq, const size_t frames);
+    void mix(Channel &ch, float *iq, const size_t frames);
+
+    const bool _rx;
+    const StreamFormat _format;
+    size_t _count;
+    Channel _channels[WIRE_CHANNELS];
+
+    mutable std::mutex _mutex;
+    ChannelCorrection _pending[WIRE_CHANNELS];
+    double _rate;
+    std::atomic<bool> _updated;
+
+    // resampling state, and output buffered per channel
+    std::unique_ptr<Resampler> _resamplers[WIRE_CHANNELS];
+    unsigned _num, _den;
+    size_t _max_input;
+    std::vector<float> _output[WIRE_CHANNELS];
+    size_t _output_count, _output_pos;
+    uint64_t _output_index;
+};
@@ -11,27 +11,611 @@
 #include "XTRXDevice.hpp"
 
 #include <chrono>
+#include <SoapySDR/Time.hpp>
 #include <cassert>
+#include <cmath>
 #include <thread>
+#include <pthread.h>
+#include <sys/eventfd.h>
 #include <sys/mman.h>
+#include <unistd.h>
+
+static StreamFormat parseStreamFormat(const std::string &format) {
+    if (format == SOAPY_SDR_CS8)
+        return StreamFormat::CS8;
+    else if (format == SOAPY_SDR_CS16)
+        return StreamFormat::CS16;
+    else if (format == SOAPY_SDR_CF32)
+        return StreamFormat::CF32;
+    else if (format == SOAPY_SDR_CF64)
+        return StreamFormat::CF64;
+    else
+        throw std::runtime_error("Unsupported format: " + format);
+}
+
+// Buffer retirement defaults. Receiving can afford to hand buffers back to the
+// DMA engine in batches, while transmit buffers are submitted right away so as
+// not to add latency.
+#define RX_RETIRE_EVERY 8
+#define RX_RETIRE_US    1000
+#define RX_DETECT_EVERY 8
+#define TX_RETIRE_EVERY 1
+#define TX_RETIRE_US    0
+#define TX_DETECT_EVERY 1
+
+// Default spin budget for the "spin" wait mode.
+#define SPIN_US 50
+
+// Default number of buffers being written to disk at a time when recording,
+// and how far ahead of the playback position a file played is read.
+#define RECORD_QUEUE 32
+#define PLAY_READAHEAD_MB 64
+
+// Synchronizer modes gating the DMA engines on the PPS edge.
+#define TX_SYNCHRONIZER_MODE 1
+#define RX_SYNCHRONIZER_MODE 2
+
+SoapySDR::ArgInfoList SoapyLiteXXTRX::getStreamArgsInfo(const int direction,
+                                                        const size_t /*channel*/) const {
+    SoapySDR::ArgInfoList infos;
+    const bool rx = (direction == SOAPY_SDR_RX);
+
+    SoapySDR::ArgInfo retireEveryArg;
+    retireEveryArg.key = "retire_every";
+    retireEveryArg.value = std::to_string(rx ? RX_RETIRE_EVERY : TX_RETIRE_EVERY);
+    retireEveryArg.name = "Retire every";
+    retireEveryArg.description = "Number of buffers to hand back to the DMA engine at once.";
+    retireEveryArg.units = "buffers";
+    retireEveryArg.type = SoapySDR::ArgInfo::INT;
+    infos.push_back(retireEveryArg);
+
+    SoapySDR::ArgInfo retireUsArg;
+    retireUsArg.key = "retire_us";
+    retireUsArg.value = std::to_string(rx ? RX_RETIRE_US : TX_RETIRE_US);
+    retireUsArg.name = "Retire interval";
+    retireUsArg.description = "Maximum time a buffer can wait before being handed back to the DMA engine.";
+    retireUsArg.units = "us";
+    retireUsArg.type = SoapySDR::ArgInfo::INT;
+    infos.push_back(retireUsArg);
+
+    SoapySDR::ArgInfo detectEveryArg;
+    detectEveryArg.key = "detect_every";
+    detectEveryArg.value = std::to_string(rx ? RX_DETECT_EVERY : TX_DETECT_EVERY);
+    detectEveryArg.name = "Detect every";
+    detectEveryArg.description = std::string("Number of buffers between checks for ") +
+                                 (rx ? "overflows." : "underflows.");
+    detectEveryArg.units = "buffers";
+    detectEveryArg.type = SoapySDR::ArgInfo::INT;
+    infos.push_back(detectEveryArg);
+
+    SoapySDR::ArgInfo waitModeArg;
+    waitModeArg.key = "wait_mode";
+    waitModeArg.value = "sleep";
+    waitModeArg.name = "Wait mode";
+    waitModeArg.description = "How to wait for the DMA engine: sleep in ppoll, "
+                              "spin for spin_us before sleeping, or busy-poll.";
+    waitModeArg.type = SoapySDR::ArgInfo::STRING;
+    waitModeArg.options = {"sleep", "spin", "busy"};
+    infos.push_back(waitModeArg);
+
+    SoapySDR::ArgInfo spinUsArg;
+    spinUsArg.key = "spin_us";
+    spinUsArg.value = std::to_string(SPIN_US);
+    spinUsArg.name = "Spin time";
+    spinUsArg.description = "Time to spin on the DMA counters before sleeping, with wait_mode=spin.";
+    spinUsArg.units = "us";
+    spinUsArg.type = SoapySDR::ArgInfo::INT;
+    infos.push_back(spinUsArg);
+
+    SoapySDR::ArgInfo convertWorkersArg;
+    convertWorkersArg.key = "convert_workers";
+    convertWorkersArg.value = "1";
+    convertWorkersArg.name = "Conversion workers";
+    convertWorkersArg.description = "Number of threads, including the caller's, converting samples.";
+    convertWorkersArg.type = SoapySDR::ArgInfo::INT;
+    infos.push_back(convertWorkersArg);
+
+    SoapySDR::ArgInfo dspArg;
+    dspArg.key = "dsp";
+    dspArg.value = "false";
+    dspArg.name = "Software processing";
+    dspArg.description = "Correct and shift samples in software while converting them, so "
+                         "that the processing can be changed with the channel settings. "
+                         "Implied by the processing args.";
+    dspArg.type = SoapySDR::ArgInfo::BOOL;
+    infos.push_back(dspArg);
+
+    SoapySDR::ArgInfo iqCorrectionArg;
+    iqCorrectionArg.key = "iq_correction";
+    iqCorrectionArg.value = "1,0,0,1";
+    iqCorrectionArg.name = "IQ correction";
+    iqCorrectionArg.description = "Real matrix applied to [I Q] in software, as \"m00,m01,m10,m11\".";
+    iqCorrectionArg.type = SoapySDR::ArgInfo::STRING;
+    infos.push_back(iqCorrectionArg);
+
+    SoapySDR::ArgInfo ncoFreqArg;
+    ncoFreqArg.key = "nco_freq";
+    ncoFreqArg.value = "0";
+    ncoFreqArg.name = "NCO frequency";
+    ncoFreqArg.description = std::string("Frequency shift applied in software, ") +
+                             (rx ? "moving a signal at this offset down to DC."
+                                 : "moving DC up to this offset.");
+    ncoFreqArg.units = "Hz";
+    ncoFreqArg.type = SoapySDR::ArgInfo::FLOAT;
+    infos.push_back(ncoFreqArg);
+
+    SoapySDR::ArgInfo resamplingArg;
+    resamplingArg.key = rx ? "decimation" : "interpolation";
+    resamplingArg.value = "1";
+    resamplingArg.name = rx ? "Decimation" : "Interpolation";
+    resamplingArg.description = std::string("Factor between the sample rate and the stream's "
+                                            "rate, as an integer or a fraction like 5/2, ") +
+                                (rx ? "applied after the corrections and the NCO."
+                                    : "applied before the NCO and the corrections.");
+    resamplingArg.type = SoapySDR::ArgInfo::STRING;
+    infos.push_back(resamplingArg);
+
+    if (rx) {
+        SoapySDR::ArgInfo dcTrackingArg;
+        dcTrackingArg.key = "dc_tracking";
+        dcTrackingArg.value = "false";
+        dcTrackingArg.name = "DC tracking";
+        dcTrackingArg.description = "Track and remove the residual DC offset in software.";
+        dcTrackingArg.type = SoapySDR::ArgInfo::BOOL;
+        infos.push_back(dcTrackingArg);
+
+        SoapySDR::ArgInfo dcTauArg;
+        dcTauArg.key = "dc_tau";
+        dcTauArg.value = std::to_string(1 << 16);
+        dcTauArg.name = "DC time constant";
+        dcTauArg.description = "Time constant of the DC offset tracking.";
+        dcTauArg.units = "samples";
+        dcTauArg.type = SoapySDR::ArgInfo::FLOAT;
+        infos.push_back(dcTauArg);
+
+        SoapySDR::ArgInfo psdArg;
+        psdArg.key = "psd";
+        psdArg.value = "false";
+        psdArg.name = "PSD";
+        psdArg.description = "Compute an averaged power spectrum of the stream in the background, "
+                             "read with the rx_psd sensor or the RX_PSD setting. "
+                             "Implied by the other psd args.";
+        psdArg.type = SoapySDR::ArgInfo::BOOL;
+        infos.push_back(psdArg);
+
+        SoapySDR::ArgInfo psdFFTSizeArg;
+        psdFFTSizeArg.key = "psd_fft_size";
+        psdFFTSizeArg.value = "1024";
+        psdFFTSizeArg.name = "PSD FFT size";
+        psdFFTSizeArg.description = "Number of bins of the power spectrum, a power of two.";
+        psdFFTSizeArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(psdFFTSizeArg);
+
+        SoapySDR::ArgInfo psdWindowArg;
+        psdWindowArg.key = "psd_window";
+        psdWindowArg.value = "hann";
+        psdWindowArg.name = "PSD window";
+        psdWindowArg.description = "Window applied to the FFT frames.";
+        psdWindowArg.type = SoapySDR::ArgInfo::STRING;
+        psdWindowArg.options = {"rect", "hann", "hamming", "blackmanharris"};
+        infos.push_back(psdWindowArg);
+
+        SoapySDR::ArgInfo psdAveragingArg;
+        psdAveragingArg.key = "psd_averaging";
+        psdAveragingArg.value = "mean";
+        psdAveragingArg.name = "PSD averaging";
+        psdAveragingArg.description = "Combine the frames of an update by their mean power, or "
+                                      "hold their maximum.";
+        psdAveragingArg.type = SoapySDR::ArgInfo::STRING;
+        psdAveragingArg.options = {"mean", "max"};
+        infos.push_back(psdAveragingArg);
+
+        SoapySDR::ArgInfo psdAveragesArg;
+        psdAveragesArg.key = "psd_averages";
+        psdAveragesArg.value = "16";
+        psdAveragesArg.name = "PSD averages";
+        psdAveragesArg.description = "Number of FFT frames combined per update.";
+        psdAveragesArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(psdAveragesArg);
+
+        SoapySDR::ArgInfo psdRateArg;
+        psdRateArg.key = "psd_rate";
+        psdRateArg.value = "10";
+        psdRateArg.name = "PSD update rate";
+        psdRateArg.description = "Number of updates of the power spectrum per second; the "
+                                 "samples in between aren't looked at.";
+        psdRateArg.units = "Hz";
+        psdRateArg.type = SoapySDR::ArgInfo::FLOAT;
+        infos.push_back(psdRateArg);
+
+        SoapySDR::ArgInfo snapshotArg;
+        snapshotArg.key = "snapshot";
+        snapshotArg.value = "false";
+        snapshotArg.name = "Snapshot capture";
+        snapshotArg.description = "Keep a history of the stream, and only hand out snapshots "
+                                  "around triggers from readStream, each ending with "
+                                  "END_BURST. Triggered with the SNAPSHOT_TRIGGER setting or "
+                                  "snapshot_threshold. Implied by the other snapshot args.";
+        snapshotArg.type = SoapySDR::ArgInfo::BOOL;
+        infos.push_back(snapshotArg);
+
+        SoapySDR::ArgInfo snapshotPreArg;
+        snapshotPreArg.key = "snapshot_pre_ms";
+        snapshotPreArg.value = "10";
+        snapshotPreArg.name = "Snapshot pre-trigger";
+        snapshotPreArg.description = "History kept before a trigger, at the sample rate the "
+                                     "stream is set up with.";
+        snapshotPreArg.units = "ms";
+        snapshotPreArg.type = SoapySDR::ArgInfo::FLOAT;
+        infos.push_back(snapshotPreArg);
+
+        SoapySDR::ArgInfo snapshotPostArg;
+        snapshotPostArg.key = "snapshot_post_ms";
+        snapshotPostArg.value = "10";
+        snapshotPostArg.name = "Snapshot post-trigger";
+        snapshotPostArg.description = "Samples captured from a trigger on.";
+        snapshotPostArg.units = "ms";
+        snapshotPostArg.type = SoapySDR::ArgInfo::FLOAT;
+        infos.push_back(snapshotPostArg);
+
+        SoapySDR::ArgInfo snapshotThresholdArg;
+        snapshotThresholdArg.key = "snapshot_threshold";
+        snapshotThresholdArg.value = "";
+        snapshotThresholdArg.name = "Snapshot threshold";
+        snapshotThresholdArg.description = "Trigger when the mean power over 256 samples of any "
+                                           "channel exceeds this level, or only from software "
+                                           "if unset.";
+        snapshotThresholdArg.units = "dBFS";
+        snapshotThresholdArg.type = SoapySDR::ArgInfo::FLOAT;
+        infos.push_back(snapshotThresholdArg);
+    } else {
+        SoapySDR::ArgInfo dcOffsetArg;
+        dcOffsetArg.key = "dc_offset";
+        dcOffsetArg.value = "0,0";
+        dcOffsetArg.name = "DC offset";
+        dcOffsetArg.description = "DC offset added in software, as \"i,q\" in normalized units.";
+        dcOffsetArg.type = SoapySDR::ArgInfo::STRING;
+        infos.push_back(dcOffsetArg);
+    }
+
+    if (rx) {
+        SoapySDR::ArgInfo prefetchBuffersArg;
+        prefetchBuffersArg.key = "prefetch_buffers";
+        prefetchBuffersArg.value = "0";
+        prefetchBuffersArg.name = "Prefetch buffers";
+        prefetchBuffersArg.description = "Size of the software ring a background thread drains "
+                                         "the DMA ring into, or 0 to read from the DMA ring directly.";
+        prefetchBuffersArg.units = "buffers";
+        prefetchBuffersArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(prefetchBuffersArg);
+
+        SoapySDR::ArgInfo prefetchCpuArg;
+        prefetchCpuArg.key = "prefetch_cpu";
+        prefetchCpuArg.value = "-1";
+        prefetchCpuArg.name = "Prefetch CPU";
+        prefetchCpuArg.description = "CPU to pin the prefetch (or record) thread to, or -1 to not pin it.";
+        prefetchCpuArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(prefetchCpuArg);
+
+        SoapySDR::ArgInfo recordPathArg;
+        recordPathArg.key = "record_path";
+        recordPathArg.value = "";
+        recordPathArg.name = "Record path";
+        recordPathArg.description = "Record the raw stream to this file (bypassing the page cache "
+                                    "where possible) from a background thread, instead of "
+                                    "handing it out through readStream.";
+        recordPathArg.type = SoapySDR::ArgInfo::STRING;
+        infos.push_back(recordPathArg);
+
+        SoapySDR::ArgInfo recordRollArg;
+        recordRollArg.key = "record_roll_mb";
+        recordRollArg.value = "0";
+        recordRollArg.name = "Record file size";
+        recordRollArg.description = "Start a new file (record_path.0000, .0001, ...) every so "
+                                    "many MiB, or 0 to record to a single file.";
+        recordRollArg.units = "MiB";
+        recordRollArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(recordRollArg);
+
+        SoapySDR::ArgInfo recordQueueArg;
+        recordQueueArg.key = "record_queue";
+        recordQueueArg.value = std::to_string(RECORD_QUEUE);
+        recordQueueArg.name = "Record queue";
+        recordQueueArg.description = "Number of buffers being written to disk at a time.";
+        recordQueueArg.units = "buffers";
+        recordQueueArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(recordQueueArg);
+    } else {
+        SoapySDR::ArgInfo pipelineBuffersArg;
+        pipelineBuffersArg.key = "pipeline_buffers";
+        pipelineBuffersArg.value = "0";
+        pipelineBuffersArg.name = "Pipeline buffers";
+        pipelineBuffersArg.description = "Size of the software ring a background thread refills "
+                                         "the DMA ring from, or 0 to write to the DMA ring directly. "
+                                         "Timed bursts are not supported with the pipeline.";
+        pipelineBuffersArg.units = "buffers";
+        pipelineBuffersArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(pipelineBuffersArg);
+
+        SoapySDR::ArgInfo pipelineCpuArg;
+        pipelineCpuArg.key = "pipeline_cpu";
+        pipelineCpuArg.value = "-1";
+        pipelineCpuArg.name = "Pipeline CPU";
+        pipelineCpuArg.description = "CPU to pin the pipeline thread to, or -1 to not pin it.";
+        pipelineCpuArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(pipelineCpuArg);
+
+        SoapySDR::ArgInfo fillTargetArg;
+        fillTargetArg.key = "fill_target";
+        fillTargetArg.value = std::to_string(_dma_mmap_info.dma_tx_buf_count / 2);
+        fillTargetArg.name = "Fill target";
+        fillTargetArg.description = "Number of buffers the pipeline thread keeps queued in the DMA ring.";
+        fillTargetArg.units = "buffers";
+        fillTargetArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(fillTargetArg);
+
+        SoapySDR::ArgInfo playPathArg;
+        playPathArg.key = "play_path";
+        playPathArg.value = "";
+        playPathArg.name = "Play path";
+        playPathArg.description = "Transmit this file of raw stream data (e.g. recorded with "
+                                  "record_path) from a background thread, instead of the samples "
+                                  "passed to writeStream.";
+        playPathArg.type = SoapySDR::ArgInfo::STRING;
+        infos.push_back(playPathArg);
+
+        SoapySDR::ArgInfo playLoopArg;
+        playLoopArg.key = "play_loop";
+        playLoopArg.value = "true";
+        playLoopArg.name = "Play loop";
+        playLoopArg.description = "Loop over the file played, or end the burst at its end.";
+        playLoopArg.type = SoapySDR::ArgInfo::BOOL;
+        infos.push_back(playLoopArg);
+
+        SoapySDR::ArgInfo playReadaheadArg;
+        playReadaheadArg.key = "play_readahead_mb";
+        playReadaheadArg.value = std::to_string(PLAY_READAHEAD_MB);
+        playReadaheadArg.name = "Play read-ahead";
+        playReadaheadArg.description = "How far ahead of the playback position the file is read.";
+        playReadaheadArg.units = "MiB";
+        playReadaheadArg.type = SoapySDR::ArgInfo::INT;
+        infos.push_back(playReadaheadArg);
+    }
+
+    return infos;
+}
+
+static long streamArg(const SoapySDR::Kwargs &args, const std::string &key,
+                      const long defaultValue) {
+    const auto it = args.find(key);
+    if (it == args.end())
+        return defaultValue;
+    return std::stol(it->second);
+}
+
+// Parse the buffer retirement stream args, making sure that the buffers we
+// hold on to can't be mistaken for an overflow.
+static void configureRetirement(const SoapySDR::Kwargs &args, size_t buf_count,
+                                size_t &retire_every, long &retire_us,
+                                size_t &detect_every, const long default_every,
+                                const long default_us, const long default_detect) {
+    const long every = streamArg(args, "retire_every", default_every);
+    const long us = streamArg(args, "retire_us", default_us);
+    const long detect = streamArg(args, "detect_every", default_detect);
+    if (every < 1 || every > (long)buf_count / 4)
+        throw std::runtime_error("retire_every should be between 1 and " +
+                                 std::to_string(buf_count / 4));
+    if (us < 0)
+        throw std::runtime_error("retire_us should be positive");
+    if (detect < 1)
+        throw std::runtime_error("detect_every should be at least 1");
+    retire_every = every;
+    retire_us = us;
+    detect_every = detect;
+}
+
+// Set up the software processing requested by the stream args, applied to
+// all channels of the stream. Returns NULL if none was requested.
+static StreamDSP *configureDSP(const SoapySDR::Kwargs &args, const bool rx,
+                               const StreamFormat format,
+                               const std::vector<size_t> &channels,
+                               const double rate) {
+    const bool enabled = (args.count("dsp") && args.at("dsp") == "true") ||
+                         args.count("iq_correction") || args.count("dc_tracking") ||
+                         args.count("dc_tau") || args.count("dc_offset") ||
+                         args.count("nco_freq") || args.count("decimation") ||
+                         args.count("interpolation");
+    if (!enabled)
+        return nullptr;
+
+    ChannelCorrection correction;
+    if (args.count("iq_correction"))
+        parseFloatList(args.at("iq_correction"), correction.iq_matrix, 4);
+    if (args.count("nco_freq"))
+        correction.nco_freq = std::stod(args.at("nco_freq"));
+    if (rx) {
+        correction.dc_tracking = args.count("dc_tracking") && args.at("dc_tracking") == "true";
+        if (args.count("dc_tau"))
+            correction.dc_tau = std::stod(args.at("dc_tau"));
+    } else if (args.count("dc_offset")) {
+        float dc[2];
+        parseFloatList(args.at("dc_offset"), dc, 2);
+        correction.dc_offset = std::complex<float>(dc[0], dc[1]);
+    }
+
+    std::unique_ptr<StreamDSP> dsp(new StreamDSP(rx, format, channels));
+    dsp->setSampleRate(rate);
+    const char *resampling = rx ? "decimation" : "interpolation";
+    if (args.count(resampling)) {
+        unsigned num, den;
+        parseResamplingFactor(args.at(resampling), num, den);
+        if (num != den)
+            dsp->setResampling(num, den);
+    }
+    for (size_t i = 0; i < channels.size(); i++)
+        dsp->setCorrection(i, correction);
+    return dsp.release();
+}
+
+// Set up the background power spectrum requested by the stream args. Returns
+// NULL if none was requested.
+static Spectrum *configureSpectrum(const SoapySDR::Kwargs &args,
+                                   const std::vector<size_t> &channels) {
+    const bool enabled = (args.count("psd") && args.at("psd") == "true") ||
+                         args.count("psd_fft_size") || args.count("psd_window") ||
+                         args.count("psd_averaging") || args.count("psd_averages") ||
+                         args.count("psd_rate");
+    if (!enabled)
+        return nullptr;
+
+    SpectrumConfig config;
+    const long fft_size = streamArg(args, "psd_fft_size", config.fft_size);
+    const long averages = streamArg(args, "psd_averages", config.averages);
+    if (fft_size < 1 || averages < 1)
+        throw std::runtime_error("psd_fft_size and psd_averages should be positive");
+    config.fft_size = fft_size;
+    config.averages = averages;
+    if (args.count("psd_window"))
+        config.window = args.at("psd_window");
+    if (args.count("psd_averaging")) {
+        const std::string &averaging = args.at("psd_averaging");
+        if (averaging != "mean" && averaging != "max")
+            throw std::runtime_error("psd_averaging should be mean or max");
+        config.max_hold = averaging == "max";
+    }
+    if (args.count("psd_rate"))
+        config.rate = std::stod(args.at("psd_rate"));
+
+    return new Spectrum(config, channels);
+}
+
+// Set up the snapshot capture requested by the stream args. Returns NULL if
+// none was requested.
+static Snapshot *configureSnapshot(const SoapySDR::Kwargs &args,
+                                   const std::vector<size_t> &channels,
+                                   const double rate) {
+    const bool enabled = (args.count("snapshot") && args.at("snapshot") == "true") ||
+                         args.count("snapshot_pre_ms") || args.count("snapshot_post_ms") ||
+                         args.count("snapshot_threshold");
+    if (!enabled)
+        return nullptr;
+    if (!(rate > 0))
+        throw std::runtime_error("Snapshots need the sample rate to be set first");
+    if (args.count("decimation"))
+        throw std::runtime_error("Snapshots can't be combined with decimation");
+
+    const double pre_ms = args.count("snapshot_pre_ms") ? std::stod(args.at("snapshot_pre_ms")) : 10;
+    const double post_ms = args.count("snapshot_post_ms") ? std::stod(args.at("snapshot_post_ms")) : 10;
+    if (pre_ms < 0 || post_ms < 0)
+        throw std::runtime_error("snapshot_pre_ms and snapshot_post_ms should be positive");
+    const double threshold = args.count("snapshot_threshold") ?
+        pow(10, std::stod(args.at("snapshot_threshold")) / 10) : 0;
+
+    return new Snapshot(llround(pre_ms * 1e-3 * rate), llround(post_ms * 1e-3 * rate),
+                        threshold, channels);
+}
 
 SoapySDR::Stream *SoapyLiteXXTRX::setupStream(const int direction,
                                          const std::string &format,
                                          const std::vector<size_t> &channels,
-                                         const SoapySDR::Kwargs &/*args*/) {
+                                         const SoapySDR::Kwargs &args) {
     std::lock_guard<std::mutex> lock(_mutex);
 
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "Using %s sample conversion kernels",
+                   getConversionKernels().name);
+
+    const StreamFormat stream_format = parseStreamFormat(format);
+    const std::vector<size_t> stream_channels =
+        channels.empty() ? std::vector<size_t>{0, 1} : channels;
+    const WaitMode wait_mode =
+        parseWaitMode(args.count("wait_mode") ? args.at("wait_mode") : "sleep");
+    const long spin_us = streamArg(args, "spin_us", SPIN_US);
+    if (spin_us < 0)
+        throw std::runtime_error("spin_us should be positive");
+    const long convert_workers = streamArg(args, "convert_workers", 1);
+    if (convert_workers < 1)
+        throw std::runtime_error("convert_workers should be at least 1");
+
     if (direction == SOAPY_SDR_RX) {
         if (_rx_stream.opened)
             throw std::runtime_error("RX stream already opened");
 
+        // resolve the converter up front, so that readStream doesn't need to
+        // look at the format or channel mapping
+        _rx_stream.convert = getRXConverter(stream_format, stream_channels);
+        if (_rx_stream.convert == NULL)
+            throw std::runtime_error("Unsupported RX channel mapping");
+
+        configureRetirement(args, _dma_mmap_info.dma_rx_buf_count,
+                            _rx_stream.retire_every, _rx_stream.retire_us,
+                            _rx_stream.detect_every, RX_RETIRE_EVERY,
+                            RX_RETIRE_US, RX_DETECT_EVERY);
+
         // configure the file descriptor watcher
         _rx_stream.fds.fd = _fd;
         _rx_stream.fds.events = POLLIN;
 
+        // check the stream args before taking any resources, so that a bad
+        // one leaves the stream closed
+        const long prefetch_buffers = streamArg(args, "prefetch_buffers", 0);
+        if (prefetch_buffers < 0)
+            throw std::runtime_error("prefetch_buffers should be positive");
+        std::unique_ptr<WorkerPool> workers(new WorkerPool(convert_workers));
+        std::unique_ptr<StreamDSP> dsp(configureDSP(args, true, stream_format, stream_channels,
+                                                    _cachedSampleRates[SOAPY_SDR_RX]));
+        std::unique_ptr<Spectrum> psd(configureSpectrum(args, stream_channels));
+        std::unique_ptr<Snapshot> snapshot(configureSnapshot(args, stream_channels,
+                                                             _cachedSampleRates[SOAPY_SDR_RX]));
+        const bool recording = args.count("record_path") && !args.at("record_path").empty();
+        const long roll_mb = streamArg(args, "record_roll_mb", 0);
+        const long queue = streamArg(args, "record_queue", RECORD_QUEUE);
+        if (recording && (prefetch_buffers > 0 || snapshot))
+            throw std::runtime_error("Recording can't be combined with prefetching or snapshots");
+        if (roll_mb < 0 || queue < 1)
+            throw std::runtime_error("record_roll_mb and record_queue should be positive");
+
+        // set up the software ring for the prefetch thread
+        _rx_stream.prefetch_buffers = prefetch_buffers;
+        _rx_stream.prefetch_cpu = streamArg(args, "prefetch_cpu", -1);
+        _rx_stream.prefetch_running = false;
+        if (_rx_stream.prefetch_buffers > 0) {
+            _rx_stream.prefetch_ring.allocate(_rx_stream.prefetch_buffers,
+                                              _dma_mmap_info.dma_rx_buf_size);
+            _rx_stream.prefetch_fds.fd = eventfd(0, EFD_NONBLOCK);
+            if (_rx_stream.prefetch_fds.fd < 0) {
+                _rx_stream.prefetch_ring.release();
+                throw std::runtime_error("eventfd failed");
+            }
+            _rx_stream.prefetch_fds.events = POLLIN;
+        }
+
+        // open the file(s) to record to
+        _rx_stream.recording = recording;
+        _rx_stream.record_running = false;
+        if (_rx_stream.recording) {
+            const std::string &path = args.at("record_path");
+            int ret = litepcie_recorder_open(&_rx_stream.recorder, path.c_str(),
+                                             _dma_mmap_info.dma_rx_buf_size, queue,
+                                             (uint64_t)roll_mb << 20);
+            if (ret < 0)
+                throw std::runtime_error("Could not record to " + path + ": " + strerror(-ret));
+        }
+
+        // undo the above, if a later step fails
+        const auto release = [this]() {
+            if (_rx_stream.prefetch_buffers > 0) {
+                _rx_stream.prefetch_ring.release();
+                close(_rx_stream.prefetch_fds.fd);
+            }
+            if (_rx_stream.recording)
+                litepcie_recorder_close(&_rx_stream.recorder);
+        };
+
         // initialize the DMA engine
-        if ((litepcie_request_dma(_fd, 0, 1) == 0))
+        if ((litepcie_request_dma(_fd, 0, 1) == 0)) {
+            release();
             throw std::runtime_error("DMA not available");
+        }
 
         // mmap the DMA buffers
         _rx_stream.buf = mmap(NULL,
@@ -39,53 +623,165 @@ SoapySDR::Stream *SoapyLiteXXTRX::setupStream(const int direction,
                                   _dma_mmap_info.dma_rx_buf_size,
                               PROT_READ | PROT_WRITE, MAP_SHARED, _fd,
                               _dma_mmap_info.dma_rx_buf_offset);
-        if (_rx_stream.buf == MAP_FAILED)
+        if (_rx_stream.buf == MAP_FAILED) {
+            litepcie_release_dma(_fd, 0, 1);
+            release();
             throw std::runtime_error("MMAP failed");
+        }
 
         // make sure the DMA is disabled, or counters could be in a bad state
         litepcie_dma_writer(_fd, 0, &_rx_stream.hw_count, &_rx_stream.sw_count);
 
-        _rx_stream.opened = true;
+        if (_rx_stream.prefetch_buffers > 0)
+            SoapySDR::logf(SOAPY_SDR_INFO, "Prefetching RX into %zu buffers (%s)",
+                           _rx_stream.prefetch_buffers,
+                           _rx_stream.prefetch_ring.hugepages() ? "hugepages" : "regular pages");
+        if (_rx_stream.recording)
+            SoapySDR::logf(SOAPY_SDR_INFO, "Recording RX to %s (%s, %s)",
+                           args.at("record_path").c_str(),
+                           _rx_stream.recorder.ring_fd >= 0 ? "io_uring" : "pwrite",
+                           _rx_stream.recorder.direct ? "O_DIRECT" : "page cache");
 
         _rx_stream.format = format;
-
-        if (channels.empty())
-            _rx_stream.channels = {0, 1};
-        else
-            _rx_stream.channels = channels;
+        _rx_stream.channels = stream_channels;
+        _rx_stream.wait_mode = wait_mode;
+        _rx_stream.spin_us = spin_us;
+        _rx_stream.workers = std::move(workers);
+        _rx_stream.dsp = std::move(dsp);
+        _rx_stream.psd = std::move(psd);
+        _rx_stream.snapshot = std::move(snapshot);
+        _rx_stream.overflow = false;
+
+        // only once nothing can fail anymore, or the stream couldn't be set
+        // up again
+        _rx_stream.opened = true;
 
         return RX_STREAM;
     } else if (direction == SOAPY_SDR_TX) {
         if (_tx_stream.opened)
             throw std::runtime_error("TX stream already opened");
 
+        // resolve the converter up front, so that writeStream doesn't need to
+        // look at the format or channel mapping
+        _tx_stream.convert = getTXConverter(stream_format, stream_channels);
+        if (_tx_stream.convert == NULL)
+            throw std::runtime_error("Unsupported TX channel mapping");
+
+        configureRetirement(args, _dma_mmap_info.dma_tx_buf_count,
+                            _tx_stream.retire_every, _tx_stream.retire_us,
+                            _tx_stream.detect_every, TX_RETIRE_EVERY,
+                            TX_RETIRE_US, TX_DETECT_EVERY);
+
         // configure the file descriptor watcher
         _tx_stream.fds.fd = _fd;
         _tx_stream.fds.events = POLLOUT;
 
+        // check the stream args before taking any resources, so that a bad
+        // one leaves the stream closed
+        const long pipeline_buffers = streamArg(args, "pipeline_buffers", 0);
+        const long fill_target = streamArg(args, "fill_target", _dma_mmap_info.dma_tx_buf_count / 2);
+        if (pipeline_buffers < 0)
+            throw std::runtime_error("pipeline_buffers should be positive");
+        if (fill_target < 1 || fill_target > (long)_dma_mmap_info.dma_tx_buf_count)
+            throw std::runtime_error("fill_target should be between 1 and " +
+                                     std::to_string(_dma_mmap_info.dma_tx_buf_count));
+        std::unique_ptr<WorkerPool> workers(new WorkerPool(convert_workers));
+        std::unique_ptr<StreamDSP> dsp(configureDSP(args, false, stream_format, stream_channels,
+                                                    _cachedSampleRates[SOAPY_SDR_TX]));
+        const bool playing = args.count("play_path") && !args.at("play_path").empty();
+        const long readahead_mb = streamArg(args, "play_readahead_mb", PLAY_READAHEAD_MB);
+        if (playing && pipeline_buffers > 0)
+            throw std::runtime_error("Playback can't be combined with pipelining");
+        if (readahead_mb < 0)
+            throw std::runtime_error("play_readahead_mb should be positive");
+
+        // set up the software ring for the pipeline thread
+        _tx_stream.pipeline_buffers = pipeline_buffers;
+        _tx_stream.pipeline_cpu = streamArg(args, "pipeline_cpu", -1);
+        _tx_stream.fill_target = fill_target;
+        _tx_stream.pipeline_running = false;
+        _tx_stream.dma_fill = 0;
+        _tx_stream.underflow_count = 0;
+        if (_tx_stream.pipeline_buffers > 0) {
+            _tx_stream.pipeline_ring.allocate(_tx_stream.pipeline_buffers,
+                                              _dma_mmap_info.dma_tx_buf_size);
+            _tx_stream.pipeline_fds.fd = eventfd(0, EFD_NONBLOCK);
+            _tx_stream.space_fds.fd = eventfd(0, EFD_NONBLOCK);
+            if (_tx_stream.pipeline_fds.fd < 0 || _tx_stream.space_fds.fd < 0) {
+                _tx_stream.pipeline_ring.release();
+                if (_tx_stream.pipeline_fds.fd >= 0)
+                    close(_tx_stream.pipeline_fds.fd);
+                if (_tx_stream.space_fds.fd >= 0)
+                    close(_tx_stream.space_fds.fd);
+                throw std::runtime_error("eventfd failed");
+            }
+            _tx_stream.pipeline_fds.events = POLLIN;
+            _tx_stream.space_fds.events = POLLIN;
+        }
+
+        // open the file to play
+        _tx_stream.playing = playing;
+        _tx_stream.play_running = false;
+        if (_tx_stream.playing) {
+            _tx_stream.play_loop = !args.count("play_loop") || args.at("play_loop") == "true";
+            const std::string &path = args.at("play_path");
+            int ret = litepcie_player_open(&_tx_stream.player, path.c_str(),
+                                           (uint64_t)readahead_mb << 20);
+            if (ret < 0)
+                throw std::runtime_error("Could not play " + path + ": " + strerror(-ret));
+        }
+
+        // undo the above, if a later step fails
+        const auto release = [this]() {
+            if (_tx_stream.pipeline_buffers > 0) {
+                _tx_stream.pipeline_ring.release();
+                close(_tx_stream.pipeline_fds.fd);
+                close(_tx_stream.space_fds.fd);
+            }
+            if (_tx_stream.playing)
+                litepcie_player_close(&_tx_stream.player);
+        };
+
         // initialize the DMA engine
-        if ((litepcie_request_dma(_fd, 1, 0) == 0))
+        if ((litepcie_request_dma(_fd, 1, 0) == 0)) {
+            release();
             throw std::runtime_error("DMA not available");
+        }
 
         // mmap the DMA buffers
         _tx_stream.buf = mmap(
             NULL,
             _dma_mmap_info.dma_tx_buf_count * _dma_mmap_info.dma_tx_buf_size,
             PROT_WRITE, MAP_SHARED, _fd, _dma_mmap_info.dma_tx_buf_offset);
-        if (_tx_stream.buf == MAP_FAILED)
+        if (_tx_stream.buf == MAP_FAILED) {
+            litepcie_release_dma(_fd, 1, 0);
+            release();
             throw std::runtime_error("MMAP failed");
+        }
 
         // make sure the DMA is disabled, or counters could be in a bad state
         litepcie_dma_reader(_fd, 0, &_tx_stream.hw_count, &_tx_stream.sw_count);
 
-        _tx_stream.opened = true;
+        if (_tx_stream.pipeline_buffers > 0)
+            SoapySDR::logf(SOAPY_SDR_INFO, "Pipelining TX through %zu buffers (%s)",
+                           _tx_stream.pipeline_buffers,
+                           _tx_stream.pipeline_ring.hugepages() ? "hugepages" : "regular pages");
+        if (_tx_stream.playing)
+            SoapySDR::logf(SOAPY_SDR_INFO, "Playing TX from %s (%s)",
+                           args.at("play_path").c_str(),
+                           _tx_stream.play_loop ? "looping" : "once");
 
         _tx_stream.format = format;
-
-        if (channels.empty())
-            _tx_stream.channels = {0, 1};
-        else
-            _tx_stream.channels = channels;
+        _tx_stream.channels = stream_channels;
+        _tx_stream.wait_mode = wait_mode;
+        _tx_stream.spin_us = spin_us;
+        _tx_stream.workers = std::move(workers);
+        _tx_stream.dsp = std::move(dsp);
+        _tx_stream.underflow = false;
+
+        // only once nothing can fail anymore, or the stream couldn't be set
+        // up again
+        _tx_stream.opened = true;
 
         return TX_STREAM;
     } else {
@@ -97,33 +793,151 @@ void SoapyLiteXXTRX::closeStream(SoapySDR::Stream *stream) {
     std::lock_guard<std::mutex> lock(_mutex);
 
     if (stream == RX_STREAM) {
+        stopPrefetch();
+        if (_rx_stream.prefetch_buffers > 0) {
+            _rx_stream.prefetch_ring.release();
+            close(_rx_stream.prefetch_fds.fd);
+        }
+        stopRecording();
+        if (_rx_stream.recording) {
+            int ret = litepcie_recorder_close(&_rx_stream.recorder);
+            if (ret < 0)
+                SoapySDR::logf(SOAPY_SDR_ERROR, "Could not finish recording: %s", strerror(-ret));
+        }
+
         // release the DMA engine
         litepcie_release_dma(_fd, 0, 1);
 
         munmap(_rx_stream.buf, _dma_mmap_info.dma_rx_buf_size *
                                    _dma_mmap_info.dma_rx_buf_count);
+        _rx_stream.workers.reset();
+        _rx_stream.dsp.reset();
+        _rx_stream.psd.reset();
+        _rx_stream.snapshot.reset();
         _rx_stream.opened = false;
     } else if (stream == TX_STREAM) {
+        stopPipeline();
+        if (_tx_stream.pipeline_buffers > 0) {
+            _tx_stream.pipeline_ring.release();
+            close(_tx_stream.pipeline_fds.fd);
+            close(_tx_stream.space_fds.fd);
+        }
+        stopPlayback();
+        if (_tx_stream.playing)
+            litepcie_player_close(&_tx_stream.player);
+
         // release the DMA engine
         litepcie_release_dma(_fd, 1, 0);
 
         munmap(_tx_stream.buf, _dma_mmap_info.dma_tx_buf_size *
                                    _dma_mmap_info.dma_tx_buf_count);
+        _tx_stream.workers.reset();
+        _tx_stream.dsp.reset();
         _tx_stream.opened = false;
     }
 }
 
+// Arm the DMA synchronizer for a stream about to be enabled, and return the
+// time of its first sample: the next PPS edge with the "pps" time source, the
+// current device time otherwise.
+//
+// The synchronizer stays synced from the PPS edge until it is disabled, so it
+// is disabled before being armed again, and only once neither stream needs it
+// anymore. A stream enabled while the other one keeps it armed isn't gated
+// again: it starts with the other one's PPS edge if that is still to come, or
+// right away. Each edge starts a single arming: the PPS time set with
+// setHardwareTime is used once, after which the next edge is assumed to come
+// a whole number of seconds later.
+long long SoapyLiteXXTRX::syncStreamStart(const unsigned mode) {
+#ifdef CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR
+    if (_timeSource == "pps") {
+        if (_syncMode != 0) {
+            // mode 2 gates both engines, so widening it keeps it synced
+            if (mode > _syncMode) {
+                litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR,
+                                mode << CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_MODE_OFFSET);
+                _syncMode = mode;
+            }
+            return std::max(_syncTimeNs, this->getHardwareTime());
+        }
+
+        const long long now = this->getHardwareTime();
+        if (_ppsTimeNs <= now)
+            _ppsTimeNs += ((now - _ppsTimeNs) / 1000000000LL + 1) * 1000000000LL;
+        litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_BYPASS_ADDR, 0);
+        litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR, 0);
+        litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR,
+                        mode << CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_MODE_OFFSET);
+        _syncMode = mode;
+        _syncTimeNs = _ppsTimeNs;
+        _ppsTimeNs += 1000000000LL;
+        return _syncTimeNs;
+    }
+    litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_BYPASS_ADDR, 1);
+#else
+    (void)mode;
+#endif
+    return this->getHardwareTime();
+}
+
+// Disable the DMA synchronizer once the last stream using it is disabled.
+void SoapyLiteXXTRX::syncStreamStop(void) {
+#ifdef CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR
+    if (_syncMode == 0 || _rx_stream.active || _tx_stream.active)
+        return;
+    litepcie_writel(_fd, CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR, 0);
+    _syncMode = 0;
+#endif
+}
+
 int SoapyLiteXXTRX::activateStream(SoapySDR::Stream *stream, const int /*flags*/,
                               const long long /*timeNs*/,
                               const size_t /*numElems*/) {
     if (stream == RX_STREAM) {
+        // anchor the sample timestamps
+        _rx_stream.time_rate = _cachedSampleRates[SOAPY_SDR_RX];
+        _rx_stream.time0_ns = syncStreamStart(RX_SYNCHRONIZER_MODE);
+
         // enable the DMA engine
         litepcie_dma_writer(_fd, 1, &_rx_stream.hw_count, &_rx_stream.sw_count);
         _rx_stream.user_count = 0;
+        _rx_stream.retired_count = _rx_stream.release_count = 0;
+        _rx_stream.retire_time = std::chrono::steady_clock::now();
+        _rx_stream.detect_countdown = 0;
+        _rx_stream.resample_next = -1;
+        if (_rx_stream.dsp)
+            _rx_stream.dsp->resetResampling();
+
+        if (_rx_stream.prefetch_buffers > 0)
+            startPrefetch();
+        if (_rx_stream.recording)
+            startRecording();
+        _rx_stream.active = true;
     } else if (stream == TX_STREAM) {
+        // anchor the sample timestamps
+        _tx_stream.time_rate = _cachedSampleRates[SOAPY_SDR_TX];
+        _tx_stream.time0_ns = syncStreamStart(TX_SYNCHRONIZER_MODE);
+
+        // the DMA engine keeps cycling through the ring, so start from silence
+        memset(_tx_stream.buf, 0, _dma_mmap_info.dma_tx_buf_count *
+                                  _dma_mmap_info.dma_tx_buf_size);
+        _tx_stream.dirty_count = 0;
+        _tx_stream.burst_end = false;
+
         // enable the DMA engine
         litepcie_dma_reader(_fd, 1, &_tx_stream.hw_count, &_tx_stream.sw_count);
         _tx_stream.user_count = 0;
+        _tx_stream.retired_count = _tx_stream.release_count = 0;
+        _tx_stream.retire_time = std::chrono::steady_clock::now();
+        _tx_stream.detect_countdown = 0;
+        if (_tx_stream.dsp)
+            _tx_stream.dsp->resetResampling();
+
+        if (_tx_stream.pipeline_buffers > 0)
+            startPipeline();
+        if (_tx_stream.playing)
+            startPlayback();
+        _tx_stream.active = true;
     }
 
     return 0;
@@ -132,11 +946,23 @@ int SoapyLiteXXTRX::activateStream(SoapySDR::Stream *stream, const int /*flags*/
 int SoapyLiteXXTRX::deactivateStream(SoapySDR::Stream *stream, const int /*flags*/,
                                 const long long /*timeNs*/) {
     if (stream == RX_STREAM) {
+        _rx_stream.active = false;
+        stopPrefetch();
+        stopRecording();
+        retireBuffers(stream, _rx_stream.release_count, true);
+
         // disable the DMA engine
         litepcie_dma_writer(_fd, 0, &_rx_stream.hw_count, &_rx_stream.sw_count);
+        syncStreamStop();
     } else if (stream == TX_STREAM) {
+        _tx_stream.active = false;
+        stopPipeline();
+        stopPlayback();
+        retireBuffers(stream, _tx_stream.release_count, true);
+
         // disable the DMA engine
         litepcie_dma_reader(_fd, 1, &_tx_stream.hw_count, &_tx_stream.sw_count);
+        syncStreamStop();
     }
     return 0;
 }
@@ -179,6 +1005,12 @@ int SoapyLiteXXTRX::getDirectAccessBufferAddrs(SoapySDR::Stream *stream,
     return 0;
 }
 
+// Time of a sample, counted from the start of the stream.
+long long SoapyLiteXXTRX::sampleTime(SoapySDR::Stream *stream, const int64_t sample) const {
+    const Stream &s = (stream == RX_STREAM) ? (const Stream &)_rx_stream : (const Stream &)_tx_stream;
+    return s.time0_ns + SoapySDR::ticksToTimeNs(sample, s.time_rate);
+}
+
 // Our DMA readers/writers are zero-copy (i.e. using a single buffer shared with
 // the kernel), and use three counters to index that buffer:
 // - hw_count: where the hardware has read from / written to
@@ -190,25 +1022,97 @@ int SoapyLiteXXTRX::getDirectAccessBufferAddrs(SoapySDR::Stream *stream,
 // library, and is why we do it ourselves.
 //
 // In addition, with a separate user count, the implementation of read/write can
-// advance buffers without performing a syscall (only having to interface with
-// the kernel when retiring buffers). That however results in slower detection
-// of overflows/underflows, so we make that configurable:
-#define DETECT_EVERY_OVERFLOW  true
-#define DETECT_EVERY_UNDERFLOW true
+// advance buffers without performing a syscall, only having to interface with
+// the kernel when retiring buffers and when checking for overflows/underflows.
+// Both are batched, as configured by the stream args:
+// - retirement happens every `retire_every` buffers, or once the oldest pending
+//   buffer has been waiting for `retire_us` microseconds, and before waiting for
+//   the DMA engine (which otherwise would consider these buffers unprocessed);
+// - the DMA counters are refreshed every `detect_every` buffers, bounding the
+//   detection latency of overflows/underflows to that many buffers.
+//
+// When the driver exports a DMA status page, neither needs a syscall: counters
+// are read from, and retired buffers stored to, memory shared with the kernel.
+
+void SoapyLiteXXTRX::refreshCounters(SoapySDR::Stream *stream) {
+    if (stream == RX_STREAM) {
+        if (_dma_status) {
+            _rx_stream.hw_count = litepcie_dma_status_load(&_dma_status->writer_hw_count);
+            _rx_stream.sw_count = litepcie_dma_status_load(&_dma_status->writer_sw_count);
+        } else
+            litepcie_dma_writer(_fd, 1, &_rx_stream.hw_count, &_rx_stream.sw_count);
+    } else {
+        if (_dma_status) {
+            _tx_stream.hw_count = litepcie_dma_status_load(&_dma_status->reader_hw_count);
+            _tx_stream.sw_count = litepcie_dma_status_load(&_dma_status->reader_sw_count);
+        } else
+            litepcie_dma_reader(_fd, 1, &_tx_stream.hw_count, &_tx_stream.sw_count);
+    }
+}
+
+void SoapyLiteXXTRX::retireBuffers(SoapySDR::Stream *stream,
+                                   const int64_t sw_count, const bool flush) {
+    Stream &s = (stream == RX_STREAM) ? (Stream &)_rx_stream : (Stream &)_tx_stream;
+    s.release_count = sw_count;
+    if (s.release_count == s.retired_count)
+        return;
+
+    const auto now = std::chrono::steady_clock::now();
+    if (!flush &&
+        s.release_count - s.retired_count < (int64_t)s.retire_every &&
+        now - s.retire_time < std::chrono::microseconds(s.retire_us))
+        return;
+
+    // update the DMA counters
+    if (_dma_status) {
+        litepcie_dma_status_store((stream == RX_STREAM) ? &_dma_status->writer_sw_count
+                                                        : &_dma_status->reader_sw_count,
+                                  s.release_count);
+    } else {
+        struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
+        mmap_dma_update.sw_count = s.release_count;
+        checked_ioctl(_fd,
+                      (stream == RX_STREAM) ? LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE
+                                            : LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE,
+                      &mmap_dma_update);
+    }
+    s.retired_count = s.release_count;
+    s.retire_time = now;
+}
 
 int SoapyLiteXXTRX::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle,
                                  const void **buffs, int &flags,
-                                 long long &/*timeNs*/, const long timeoutUs) {
+                                 long long &timeNs, const long timeoutUs) {
     if (stream != RX_STREAM)
         return SOAPY_SDR_STREAM_ERROR;
+    if (_rx_stream.recording)
+        return SOAPY_SDR_NOT_SUPPORTED;
+
+    int ret;
+    if (_rx_stream.prefetch_buffers > 0)
+        ret = acquirePrefetchedBuffer(handle, buffs, flags, timeNs, timeoutUs);
+    else
+        ret = acquireDMAReadBuffer(handle, buffs, flags, timeNs, timeoutUs);
+
+    // let the spectrum worker copy a frame, if it is waiting for one
+    if (ret > 0 && _rx_stream.psd)
+        _rx_stream.psd->tap((const int8_t *)buffs[0], ret);
+    return ret;
+}
+
+int SoapyLiteXXTRX::acquireDMAReadBuffer(size_t &handle, const void **buffs,
+                                         int &flags, long long &timeNs,
+                                         const long timeoutUs) {
+    SoapySDR::Stream *stream = RX_STREAM;
 
     // check if there are buffers available
     int buffers_available = _rx_stream.hw_count - _rx_stream.user_count;
     assert(buffers_available >= 0);
 
     // if not, check with the DMA engine
-    if (buffers_available == 0 || DETECT_EVERY_OVERFLOW) {
-        litepcie_dma_writer(_fd, 1, &_rx_stream.hw_count, &_rx_stream.sw_count);
+    if (buffers_available == 0 || _rx_stream.detect_countdown == 0) {
+        _rx_stream.detect_countdown = _rx_stream.detect_every;
+        refreshCounters(stream);
         buffers_available = _rx_stream.hw_count - _rx_stream.user_count;
     }
 
@@ -217,17 +1121,16 @@ int SoapyLiteXXTRX::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle,
         if (timeoutUs == 0) {
             return SOAPY_SDR_TIMEOUT;
         }
-        int ret = poll(&_rx_stream.fds, 1, timeoutUs / 1000);
-        if (ret < 0)
-            throw std::runtime_error(
-                "SoapyLiteXXTRX::acquireReadBuffer(): poll failed, " +
-                std::string(strerror(errno)));
-        else if (ret == 0) {
+        retireBuffers(stream, _rx_stream.release_count, true);
+        bool ready = waitFor(_rx_stream.fds, _rx_stream.wait_mode,
+                             _rx_stream.spin_us, timeoutUs, [&] {
+            // get new DMA counters
+            refreshCounters(stream);
+            return _rx_stream.hw_count > _rx_stream.user_count;
+        });
+        if (!ready)
             return SOAPY_SDR_TIMEOUT;
-        }
 
-        // get new DMA counters
-        litepcie_dma_writer(_fd, 1, &_rx_stream.hw_count, &_rx_stream.sw_count);
         buffers_available = _rx_stream.hw_count - _rx_stream.user_count;
         assert(buffers_available > 0);
     }
@@ -236,9 +1139,10 @@ int SoapyLiteXXTRX::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle,
     if ((_rx_stream.hw_count - _rx_stream.sw_count) >
         ((int64_t)_dma_mmap_info.dma_rx_buf_count / 2)) {
         // drain all buffers to get out of the overflow quicker
-        struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
-        mmap_dma_update.sw_count = _rx_stream.hw_count;
-        checked_ioctl(_fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &mmap_dma_update);
+        retireBuffers(stream, _rx_stream.hw_count, true);
+        pushEvent(stream, SOAPY_SDR_OVERFLOW, SOAPY_SDR_END_ABRUPT,
+                  sampleTime(stream, _rx_stream.user_count * getStreamMTU(stream)),
+                  _rx_stream.hw_count - _rx_stream.user_count);
         _rx_stream.user_count = _rx_stream.hw_count;
         _rx_stream.sw_count = _rx_stream.hw_count;
         handle = -1;
@@ -253,24 +1157,42 @@ int SoapyLiteXXTRX::acquireReadBuffer(SoapySDR::Stream *stream, size_t &handle,
         // update the DMA counters
         handle = _rx_stream.user_count;
         _rx_stream.user_count++;
+        _rx_stream.detect_countdown--;
+
+        // every buffer is full, so its position in the stream gives its time
+        // (even after an overflow, as the dropped buffers are still counted)
+        timeNs = sampleTime(stream, handle * getStreamMTU(stream));
+        flags |= SOAPY_SDR_HAS_TIME;
 
         return getStreamMTU(stream);
     }
 }
 
-void SoapyLiteXXTRX::releaseReadBuffer(SoapySDR::Stream */*stream*/, size_t handle) {
+void SoapyLiteXXTRX::releaseReadBuffer(SoapySDR::Stream *stream, size_t handle) {
     assert(handle != (size_t)-1 && "Attempt to release an invalid buffer (e.g., from an overflow)");
 
-    // update the DMA counters
-    struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
-    mmap_dma_update.sw_count = handle + 1;
-    checked_ioctl(_fd, LITEPCIE_IOCTL_MMAP_DMA_WRITER_UPDATE, &mmap_dma_update);
+    if (_rx_stream.prefetch_buffers > 0)
+        _rx_stream.prefetch_ring.pop();
+    else
+        retireBuffers(stream, handle + 1, false);
 }
 
 int SoapyLiteXXTRX::acquireWriteBuffer(SoapySDR::Stream *stream, size_t &handle,
                                   void **buffs, const long timeoutUs) {
     if (stream != TX_STREAM)
         return SOAPY_SDR_STREAM_ERROR;
+    if (_tx_stream.playing)
+        return SOAPY_SDR_NOT_SUPPORTED;
+
+    if (_tx_stream.pipeline_buffers > 0)
+        return acquirePipelineBuffer(handle, buffs, timeoutUs);
+    else
+        return acquireDMAWriteBuffer(handle, buffs, timeoutUs);
+}
+
+int SoapyLiteXXTRX::acquireDMAWriteBuffer(size_t &handle, void **buffs,
+                                          const long timeoutUs) {
+    SoapySDR::Stream *stream = TX_STREAM;
 
     // check if there are buffers available
     int buffers_pending = _tx_stream.user_count - _tx_stream.hw_count;
@@ -278,8 +1200,9 @@ int SoapyLiteXXTRX::acquireWriteBuffer(SoapySDR::Stream *stream, size_t &handle,
 
     // if not, check with the DMA engine
     if (buffers_pending == ((int64_t)_dma_mmap_info.dma_tx_buf_count) ||
-        DETECT_EVERY_UNDERFLOW) {
-        litepcie_dma_reader(_fd, 1, &_tx_stream.hw_count, &_tx_stream.sw_count);
+        _tx_stream.detect_countdown == 0) {
+        _tx_stream.detect_countdown = _tx_stream.detect_every;
+        refreshCounters(stream);
         buffers_pending = _tx_stream.user_count - _tx_stream.hw_count;
     }
 
@@ -288,16 +1211,17 @@ int SoapyLiteXXTRX::acquireWriteBuffer(SoapySDR::Stream *stream, size_t &handle,
         if (timeoutUs == 0) {
             return SOAPY_SDR_TIMEOUT;
         }
-        int ret = poll(&_tx_stream.fds, 1, timeoutUs / 1000);
-        if (ret < 0)
-            throw std::runtime_error(
-                "SoapyLiteXXTRX::acquireWriteBuffer(): poll failed, " +
-                std::string(strerror(errno)));
-        else if (ret == 0)
+        retireBuffers(stream, _tx_stream.release_count, true);
+        bool ready = waitFor(_tx_stream.fds, _tx_stream.wait_mode,
+                             _tx_stream.spin_us, timeoutUs, [&] {
+            // get new DMA counters
+            refreshCounters(stream);
+            return _tx_stream.user_count - _tx_stream.hw_count <
+                   (int64_t)_dma_mmap_info.dma_tx_buf_count;
+        });
+        if (!ready)
             return SOAPY_SDR_TIMEOUT;
 
-        // get new DMA counters
-        litepcie_dma_reader(_fd, 1, &_tx_stream.hw_count, &_tx_stream.sw_count);
         buffers_pending = _tx_stream.user_count - _tx_stream.hw_count;
         assert(buffers_pending < ((int64_t)_dma_mmap_info.dma_tx_buf_count));
     }
@@ -309,56 +1233,107 @@ int SoapyLiteXXTRX::acquireWriteBuffer(SoapySDR::Stream *stream, size_t &handle,
     // update the DMA counters
     handle = _tx_stream.user_count;
     _tx_stream.user_count++;
+    _tx_stream.detect_countdown--;
 
     // detect underflows
     if (buffers_pending < 0) {
+        _tx_stream.underflow_count.fetch_add(1, std::memory_order_relaxed);
+        pushEvent(stream, SOAPY_SDR_UNDERFLOW, 0,
+                  sampleTime(stream, _tx_stream.hw_count * getStreamMTU(stream)),
+                  -buffers_pending);
         return SOAPY_SDR_UNDERFLOW;
     } else {
         return getStreamMTU(stream);
     }
 }
 
+// The DMA engine always transmits whole buffers, so a partial buffer is padded
+// with zeros. Timed transmission is only supported by writeStream, since the
+// time of a buffer is fixed by its position in the stream.
 void SoapyLiteXXTRX::releaseWriteBuffer(SoapySDR::Stream */*stream*/, size_t handle,
-                                   const size_t /*numElems*/, int &/*flags*/,
+                                   const size_t numElems, int &flags,
                                    const long long /*timeNs*/) {
-    // XXX: inspect user-provided numElems and flags, and act upon them?
-
-    // update the DMA counters so that the engine can submit this buffer
-    struct litepcie_ioctl_mmap_dma_update mmap_dma_update;
-    mmap_dma_update.sw_count = handle + 1;
-    checked_ioctl(_fd, LITEPCIE_IOCTL_MMAP_DMA_READER_UPDATE, &mmap_dma_update);
+    const bool end_burst = (flags & SOAPY_SDR_END_BURST) != 0;
+    if (_tx_stream.pipeline_buffers > 0)
+        releasePipelineBuffer(numElems, end_burst);
+    else
+        releaseDMAWriteBuffer(handle, numElems, end_burst);
 }
 
-void deinterleave(const int8_t *src, void *dst, uint32_t len, std::string format, size_t offset)
-{
-    if (format == SOAPY_SDR_CS16) {
-        int16_t *samples_cs16 = (int16_t *)dst + offset * BYTES_PER_SAMPLE;
-        for (uint32_t i = offset; i < len; i += 2)
-        {
-            samples_cs16[i * BYTES_PER_SAMPLE] = (int16_t)(src[i * BYTES_PER_SAMPLE] << 8);
-            samples_cs16[i * BYTES_PER_SAMPLE + 1] = (int16_t)(src[i * BYTES_PER_SAMPLE + 1] << 8);
-        }
-    }
-    else {
-        SoapySDR_logf(SOAPY_SDR_ERROR, "Unsupported format: %s", format.c_str());
+void SoapyLiteXXTRX::releaseDMAWriteBuffer(const size_t handle, const size_t numElems,
+                                           const bool end_burst) {
+    SoapySDR::Stream *stream = TX_STREAM;
+    const size_t mtu = getStreamMTU(stream);
+    if (numElems < mtu) {
+        int8_t *buf = (int8_t *)_tx_stream.buf +
+                      (handle % _dma_mmap_info.dma_tx_buf_count) * _dma_mmap_info.dma_tx_buf_size;
+        memset(buf + numElems * BYTES_PER_FRAME, 0, (mtu - numElems) * BYTES_PER_FRAME);
     }
+
+    // update the DMA counters so that the engine can submit this buffer,
+    // right away if this ends a burst
+    retireBuffers(stream, handle + 1, end_burst);
+
+    if (end_burst)
+        endBurst(handle * mtu + numElems);
 }
 
-void interleave(const void *src, int8_t *dst, uint32_t len, std::string format, size_t offset)
-{
-    if (format == SOAPY_SDR_CS16) {
-        int16_t *samples_cs16 = (int16_t *)src + offset * BYTES_PER_SAMPLE;
-        for (uint32_t i = offset; i < len; i += 2)
-        {
-            dst[i * BYTES_PER_SAMPLE] = (int8_t)(samples_cs16[i * BYTES_PER_SAMPLE] >> 8);
-            dst[i * BYTES_PER_SAMPLE + 1] = (int8_t)(samples_cs16[i * BYTES_PER_SAMPLE + 1] >> 8);
-        }
-    }
-    else {
-        SoapySDR_logf(SOAPY_SDR_ERROR, "Unsupported format: %s", format.c_str());
+// Record the end of a burst, whose last sample precedes `position`.
+void SoapyLiteXXTRX::endBurst(const int64_t position) {
+    _tx_stream.burst_end = true;
+    refreshCounters(TX_STREAM);
+    cleanTxBuffers();
+    pushEvent(TX_STREAM, 0, SOAPY_SDR_END_BURST, sampleTime(TX_STREAM, position), 0);
+}
+
+// Pick up after a burst: the DMA engine may have run past it, sending silence,
+// in which case we continue after the buffer it is sending now.
+void SoapyLiteXXTRX::resumeBurst(void) {
+    refreshCounters(TX_STREAM);
+    cleanTxBuffers();
+    if (_tx_stream.user_count <= _tx_stream.hw_count) {
+        _tx_stream.user_count = _tx_stream.hw_count + 1;
+        retireBuffers(TX_STREAM, _tx_stream.user_count, true);
     }
+    _tx_stream.burst_end = false;
+}
+
+// Position of the next sample to transmit, counted from the start of the stream.
+int64_t SoapyLiteXXTRX::txPosition(void) const {
+    const int64_t mtu = getStreamMTU(TX_STREAM);
+    if (_tx_stream.remainderHandle >= 0)
+        return _tx_stream.remainderHandle * mtu + _tx_stream.remainderOffset;
+    else
+        return _tx_stream.user_count * mtu;
+}
+
+// Once it runs out of submitted buffers, the DMA engine replays old ones. To
+// transmit silence between bursts instead of stale samples, zero the buffers it
+// has already sent. Those it has yet to send are cleaned by a later call.
+void SoapyLiteXXTRX::cleanTxBuffers(void) {
+    const int64_t buf_count = _dma_mmap_info.dma_tx_buf_count;
+    const int64_t begin = std::max(_tx_stream.dirty_count, _tx_stream.user_count - buf_count);
+    const int64_t end = std::min(_tx_stream.hw_count, _tx_stream.user_count);
+    for (int64_t i = begin; i < end; i++)
+        memset((int8_t *)_tx_stream.buf + (i % buf_count) * _dma_mmap_info.dma_tx_buf_size,
+               0, _dma_mmap_info.dma_tx_buf_size);
+    _tx_stream.dirty_count = std::max(_tx_stream.dirty_count, end);
 }
 
+// Time left until `deadline`, as a timeout for the buffer API.
+static long remainingUs(const std::chrono::steady_clock::time_point &deadline) {
+    const auto left = deadline - std::chrono::steady_clock::now();
+    if (left <= std::chrono::steady_clock::duration::zero())
+        return 0;
+    return std::chrono::duration_cast<std::chrono::microseconds>(left).count();
+}
+
+// readStream and writeStream walk as many DMA buffers as needed to satisfy
+// `numElems` (or a single one with SOAPY_SDR_ONE_PACKET), waiting at most
+// `timeoutUs` in total. If a timeout or overflow interrupts a partial transfer,
+// the samples processed so far are returned, and an overflow gets reported by
+// the next call.
+
 int SoapyLiteXXTRX::readStream(
     SoapySDR::Stream *stream,
     void *const *buffs,
@@ -367,27 +1342,113 @@ int SoapyLiteXXTRX::readStream(
     long long &timeNs,
     const long timeoutUs)
 {
-    if (stream != RX_STREAM)
+    if (stream != RX_STREAM || _rx_stream.recording)
     {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
-    size_t returnedElems = std::min(numElems, this->getStreamMTU(stream));
 
-    size_t samp_avail = 0;
+    // report an overflow that interrupted the previous call
+    if (_rx_stream.overflow)
+    {
+        _rx_stream.overflow = false;
+        flags |= SOAPY_SDR_END_ABRUPT;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    const size_t maxElems = (flags & SOAPY_SDR_ONE_PACKET) ?
+        std::min(numElems, this->getStreamMTU(stream)) : numElems;
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(timeoutUs);
+
+    if (_rx_stream.snapshot)
+    {
+        return readSnapshot(buffs, maxElems, flags, timeNs, deadline);
+    }
+
+    StreamDSP *resampler = (_rx_stream.dsp && _rx_stream.dsp->resampling()) ?
+        _rx_stream.dsp.get() : nullptr;
 
-    if (_rx_stream.remainderHandle >= 0)
+    size_t elems = 0;
+    while (elems < maxElems)
     {
-        const size_t n = std::min(_rx_stream.remainderSamps, returnedElems);
+        // Hand out the samples left by the resampler first
+        if (resampler && resampler->pending() > 0)
+        {
+            // timestamped relative to the first input sample since the last
+            // discontinuity, ignoring the filters' group delay
+            if (elems == 0)
+            {
+                timeNs = sampleTime(stream, _rx_stream.resample_anchor) +
+                         SoapySDR::ticksToTimeNs(resampler->outputIndex(),
+                                                 _rx_stream.time_rate * resampler->resamplingRatio());
+                flags |= SOAPY_SDR_HAS_TIME;
+            }
+            elems += resampler->rxOutput(buffs, elems, maxElems - elems);
+            continue;
+        }
 
-        if (n < returnedElems)
+        // Get a new buffer once the previous one is used up
+        if (_rx_stream.remainderHandle < 0)
         {
-            samp_avail = n;
+            size_t handle;
+            int acquireFlags = 0;
+            long long bufferTimeNs = 0;
+            int ret = this->acquireReadBuffer(stream, handle, (const void **)&_rx_stream.remainderBuff, acquireFlags, bufferTimeNs, remainingUs(deadline));
+
+            if (ret < 0)
+            {
+                if (elems > 0 && ret == SOAPY_SDR_OVERFLOW)
+                {
+                    _rx_stream.overflow = true;
+                    break;
+                }
+                if (elems > 0 && ret == SOAPY_SDR_TIMEOUT)
+                {
+                    break;
+                }
+                flags |= acquireFlags;
+                return ret;
+            }
+
+            _rx_stream.remainderHandle = handle;
+            _rx_stream.remainderSamps = ret;
+            _rx_stream.remainderOffset = 0;
         }
 
-        // Read out channels
-        for (size_t i = 0; i < _rx_stream.channels.size(); i++)
+        const int64_t index = (int64_t)_rx_stream.remainderHandle * this->getStreamMTU(stream) +
+                              _rx_stream.remainderOffset;
+        const int8_t *src = _rx_stream.remainderBuff + _rx_stream.remainderOffset * BYTES_PER_FRAME;
+        size_t n;
+
+        if (resampler)
+        {
+            // Feed the resampler, starting over after lost samples
+            if (index != _rx_stream.resample_next)
+            {
+                resampler->resetResampling();
+                _rx_stream.resample_anchor = index;
+            }
+            n = std::min(_rx_stream.remainderSamps, resampler->maxInput());
+            resampler->rxInput(src, n);
+            _rx_stream.resample_next = index + n;
+        }
+        else
         {
-            deinterleave(_rx_stream.remainderBuff + _rx_stream.remainderOffset * BYTES_PER_SAMPLE, buffs[i], n/2, _rx_stream.format, _rx_stream.channels[i]);
+            n = std::min(_rx_stream.remainderSamps, maxElems - elems);
+
+            // Timestamp the first sample returned
+            if (elems == 0)
+            {
+                timeNs = sampleTime(stream, index);
+                flags |= SOAPY_SDR_HAS_TIME;
+            }
+
+            // Read out channels
+            if (_rx_stream.dsp)
+                _rx_stream.dsp->rx(src, buffs, elems, n);
+            else
+                convertParallel(*_rx_stream.workers, _rx_stream.convert, src, buffs, elems, n);
+            elems += n;
         }
         _rx_stream.remainderSamps -= n;
         _rx_stream.remainderOffset += n;
@@ -398,44 +1459,85 @@ int SoapyLiteXXTRX::readStream(
             _rx_stream.remainderHandle = -1;
             _rx_stream.remainderOffset = 0;
         }
-
-        if (n == returnedElems)
-            return returnedElems;
     }
 
-    size_t handle;
-    int ret = this->acquireReadBuffer(stream, handle, (const void **)&_rx_stream.remainderBuff, flags, timeNs, timeoutUs);
+    return elems;
+}
 
-    if (ret < 0)
+// In snapshot mode, readStream keeps draining the DMA ring into the history
+// until a snapshot is complete, and then hands it out over as many calls as
+// needed, the last one flagged with END_BURST.
+int SoapyLiteXXTRX::readSnapshot(
+    void *const *buffs,
+    const size_t numElems,
+    int &flags,
+    long long &timeNs,
+    const std::chrono::steady_clock::time_point &deadline)
+{
+    SoapySDR::Stream *stream = RX_STREAM;
+    Snapshot &snapshot = *_rx_stream.snapshot;
+
+    while (!snapshot.ready())
     {
-        if ((ret == SOAPY_SDR_TIMEOUT) && (samp_avail > 0))
+        // Get a new buffer once the previous one is used up
+        if (_rx_stream.remainderHandle < 0)
         {
-            return samp_avail;
+            size_t handle;
+            int acquireFlags = 0;
+            long long bufferTimeNs = 0;
+            int ret = this->acquireReadBuffer(stream, handle, (const void **)&_rx_stream.remainderBuff, acquireFlags, bufferTimeNs, remainingUs(deadline));
+
+            // an overflow only shows up as a gap in the history
+            if (ret == SOAPY_SDR_OVERFLOW)
+            {
+                continue;
+            }
+            if (ret < 0)
+            {
+                return ret;
+            }
+
+            _rx_stream.remainderHandle = handle;
+            _rx_stream.remainderSamps = ret;
+            _rx_stream.remainderOffset = 0;
         }
-        return ret;
-    }
 
-    _rx_stream.remainderHandle = handle;
-    _rx_stream.remainderSamps = ret;
+        const int64_t index = (int64_t)_rx_stream.remainderHandle * this->getStreamMTU(stream) +
+                              _rx_stream.remainderOffset;
+        const int8_t *src = _rx_stream.remainderBuff + _rx_stream.remainderOffset * BYTES_PER_FRAME;
+        const size_t n = snapshot.push(src, index, _rx_stream.remainderSamps);
+        _rx_stream.remainderSamps -= n;
+        _rx_stream.remainderOffset += n;
+
+        if (_rx_stream.remainderSamps == 0)
+        {
+            this->releaseReadBuffer(stream, _rx_stream.remainderHandle);
+            _rx_stream.remainderHandle = -1;
+            _rx_stream.remainderOffset = 0;
+        }
+    }
 
-    const size_t n = std::min((returnedElems - samp_avail), _rx_stream.remainderSamps);
+    timeNs = sampleTime(stream, snapshot.position());
+    flags |= SOAPY_SDR_HAS_TIME;
 
-    // Read out channels
-    for (size_t i = 0; i < _rx_stream.channels.size(); i++)
+    size_t elems = 0;
+    while (elems < numElems && snapshot.ready())
     {
-        deinterleave(_rx_stream.remainderBuff, buffs[i], n, _rx_stream.format, samp_avail + _rx_stream.channels[i]);
+        size_t n = numElems - elems;
+        const int8_t *src = snapshot.peek(n);
+        if (_rx_stream.dsp)
+            _rx_stream.dsp->rx(src, buffs, elems, n);
+        else
+            convertParallel(*_rx_stream.workers, _rx_stream.convert, src, buffs, elems, n);
+        snapshot.consume(n);
+        elems += n;
     }
-    _rx_stream.remainderSamps -= n;
-    _rx_stream.remainderOffset += n;
 
-    if (_rx_stream.remainderSamps == 0)
+    if (!snapshot.ready())
     {
-        this->releaseReadBuffer(stream, _rx_stream.remainderHandle);
-        _rx_stream.remainderHandle = -1;
-        _rx_stream.remainderOffset = 0;
+        flags |= SOAPY_SDR_END_BURST;
     }
-
-    return returnedElems;
+    return elems;
 }
 
 int SoapyLiteXXTRX::writeStream(
@@ -446,75 +1548,656 @@ int SoapyLiteXXTRX::writeStream(
     const long long timeNs,
     const long timeoutUs)
 {
-    if (stream != TX_STREAM)
+    if (stream != TX_STREAM || _tx_stream.playing)
     {
         return SOAPY_SDR_NOT_SUPPORTED;
     }
 
-    size_t returnedElems = std::min(numElems, this->getStreamMTU(stream));
+    const int64_t mtu = this->getStreamMTU(stream);
+    const size_t maxElems = (flags & SOAPY_SDR_ONE_PACKET) ?
+        std::min(numElems, (size_t)mtu) : numElems;
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(timeoutUs);
 
-    size_t samp_avail = 0;
+    // With the pipeline, the DMA engine is only known to the pipeline thread
+    const bool pipeline = _tx_stream.pipeline_buffers > 0;
+    if (pipeline && (flags & SOAPY_SDR_HAS_TIME))
+    {
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
 
-    if (_tx_stream.remainderHandle >= 0)
+    if (!pipeline && _tx_stream.burst_end)
+    {
+        resumeBurst();
+    }
+
+    // Pad with zeros up to the requested time
+    if (flags & SOAPY_SDR_HAS_TIME)
     {
+        // a timed burst starts the interpolation filters over
+        if (_tx_stream.dsp)
+        {
+            _tx_stream.dsp->resetResampling();
+        }
 
-        const size_t n = std::min(_tx_stream.remainderSamps, returnedElems);
+        const int64_t start = SoapySDR::timeNsToTicks(timeNs - _tx_stream.time0_ns, _tx_stream.time_rate);
+        const int64_t position = txPosition();
 
-        if (n < returnedElems)
+        // too late if we're past that sample, or the DMA engine is
+        refreshCounters(stream);
+        if (start < position || start / mtu <= _tx_stream.hw_count)
         {
-            samp_avail = n;
+            pushEvent(stream, SOAPY_SDR_TIME_ERROR, 0, timeNs, 0);
+            return SOAPY_SDR_TIME_ERROR;
+        }
+
+        if (start > position)
+        {
+            // padding carries over to the next call if it times out
+            int ret = fillTxBuffers(nullptr, 0, start - position, deadline);
+            if (ret < 0)
+            {
+                return ret;
+            }
+            if (txPosition() < start)
+            {
+                return SOAPY_SDR_TIMEOUT;
+            }
+        }
+    }
+
+    int ret = fillTxBuffers(buffs, 0, maxElems, deadline);
+    if (ret < 0)
+    {
+        return ret;
+    }
+    const size_t elems = ret;
+
+    // Close the burst with a zero-padded buffer, submitted right away
+    if ((flags & SOAPY_SDR_END_BURST) && elems == numElems)
+    {
+        // push the last samples out of the interpolation filters
+        if (_tx_stream.dsp && _tx_stream.dsp->resampling())
+        {
+            ret = fillTxBuffers(nullptr, 0, 0, deadline, true);
+            if (ret < 0)
+            {
+                return ret;
+            }
+        }
+
+        if (_tx_stream.remainderHandle >= 0)
+        {
+            int releaseFlags = SOAPY_SDR_END_BURST;
+            this->releaseWriteBuffer(stream, _tx_stream.remainderHandle, _tx_stream.remainderOffset, releaseFlags, 0);
+            _tx_stream.remainderHandle = -1;
+            _tx_stream.remainderOffset = 0;
+        }
+        else if (pipeline)
+        {
+            // the last buffer has already been queued, so queue an empty one
+            // to end the burst
+            size_t handle;
+            void *buf;
+            if (this->acquireWriteBuffer(stream, handle, &buf, remainingUs(deadline)) >= 0)
+            {
+                int releaseFlags = SOAPY_SDR_END_BURST;
+                this->releaseWriteBuffer(stream, handle, 0, releaseFlags, 0);
+            }
+        }
+        else
+        {
+            retireBuffers(stream, _tx_stream.release_count, true);
+            endBurst(txPosition());
+        }
+    }
+
+    return elems;
+}
+
+// Write `numElems` samples into DMA buffers, or zeros if `buffs` is null,
+// submitting the buffers as they fill up. Returns the number of samples written.
+//
+// When interpolating, `numElems` counts input samples, and the output is
+// buffered by the resampler between calls; `flush` writes out all of it,
+// including the filters' history.
+int SoapyLiteXXTRX::fillTxBuffers(
+    const void *const *buffs,
+    const size_t offset,
+    const size_t numElems,
+    const std::chrono::steady_clock::time_point &deadline,
+    const bool flush)
+{
+    SoapySDR::Stream *stream = TX_STREAM;
+
+    StreamDSP *resampler = (_tx_stream.dsp && _tx_stream.dsp->resampling() &&
+                            (buffs || flush)) ? _tx_stream.dsp.get() : nullptr;
+    bool flushed = false;
+
+    size_t elems = 0;
+    while (elems < numElems || (resampler && flush && (!flushed || resampler->pending() > 0)))
+    {
+        // Refill the resampler once its output is written out
+        if (resampler && resampler->pending() == 0)
+        {
+            if (buffs && elems < numElems)
+            {
+                const size_t in = std::min(resampler->maxInput(), numElems - elems);
+                resampler->txInput(buffs, offset + elems, in);
+                elems += in;
+            }
+            else if (flush && !flushed)
+            {
+                resampler->txFlush();
+                flushed = true;
+            }
+            if (resampler->pending() == 0)
+            {
+                continue;
+            }
+        }
+
+        // Get a new buffer once the previous one is filled up
+        if (_tx_stream.remainderHandle < 0)
+        {
+            size_t handle;
+            int ret = this->acquireWriteBuffer(stream, handle, (void **)&_tx_stream.remainderBuff, remainingUs(deadline));
+
+            // an underflow still hands out a buffer, which we need to fill
+            if (ret == SOAPY_SDR_UNDERFLOW)
+            {
+                _tx_stream.underflow = true;
+                ret = this->getStreamMTU(stream);
+            }
+            else if (ret < 0)
+            {
+                if (elems > 0 && ret == SOAPY_SDR_TIMEOUT)
+                {
+                    break;
+                }
+                return ret;
+            }
+
+            _tx_stream.remainderHandle = handle;
+            _tx_stream.remainderSamps = ret;
+            _tx_stream.remainderOffset = 0;
         }
 
         // Write out channels
-        for (size_t i = 0; i < _tx_stream.channels.size(); i++)
+        int8_t *dst = _tx_stream.remainderBuff + _tx_stream.remainderOffset * BYTES_PER_FRAME;
+        size_t n;
+        if (resampler)
+        {
+            n = resampler->txOutput(dst, _tx_stream.remainderSamps);
+        }
+        else
         {
-            interleave(buffs[i], _tx_stream.remainderBuff + _tx_stream.remainderOffset * BYTES_PER_SAMPLE, n/2, _tx_stream.format, _tx_stream.channels[i]);
+            n = std::min(_tx_stream.remainderSamps, numElems - elems);
+            if (buffs && _tx_stream.dsp)
+            {
+                _tx_stream.dsp->tx(buffs, dst, offset + elems, n);
+            }
+            else if (buffs)
+            {
+                convertParallel(*_tx_stream.workers, _tx_stream.convert, buffs, dst, offset + elems, n);
+            }
+            else
+            {
+                memset(dst, 0, n * BYTES_PER_FRAME);
+            }
+            elems += n;
         }
         _tx_stream.remainderSamps -= n;
         _tx_stream.remainderOffset += n;
 
         if (_tx_stream.remainderSamps == 0)
         {
-            this->releaseWriteBuffer(stream, _tx_stream.remainderHandle, _tx_stream.remainderOffset, flags, timeNs);
+            int releaseFlags = 0;
+            this->releaseWriteBuffer(stream, _tx_stream.remainderHandle, _tx_stream.remainderOffset, releaseFlags, 0);
             _tx_stream.remainderHandle = -1;
             _tx_stream.remainderOffset = 0;
         }
-
-        if (n == returnedElems)
-            return returnedElems;
     }
 
-    size_t handle;
+    return elems;
+}
 
-    int ret = this->acquireWriteBuffer(stream, handle, (void **)&_tx_stream.remainderBuff, timeoutUs);
-    if (ret < 0)
+
+/*******************************************************************
+ * Stream events
+ ******************************************************************/
+
+// Granularity of the wait for new events in readStreamStatus.
+#define STATUS_POLL_US 1000
+
+void SoapyLiteXXTRX::pushEvent(SoapySDR::Stream *stream, const int code,
+                               const int flags, const long long timeNs,
+                               const size_t lost) {
+    Stream &s = (stream == RX_STREAM) ? (Stream &)_rx_stream : (Stream &)_tx_stream;
+    s.lost_count.fetch_add(lost, std::memory_order_relaxed);
+
+    StreamEvent event;
+    event.code = code;
+    event.flags = flags | SOAPY_SDR_HAS_TIME;
+    event.timeNs = timeNs;
+    event.lost = lost;
+    s.events.push(event);
+}
+
+int SoapyLiteXXTRX::readStreamStatus(
+    SoapySDR::Stream *stream,
+    size_t &chanMask,
+    int &flags,
+    long long &timeNs,
+    const long timeoutUs)
+{
+    if (stream != RX_STREAM && stream != TX_STREAM)
     {
-        if ((ret == SOAPY_SDR_TIMEOUT) && (samp_avail > 0))
+        return SOAPY_SDR_NOT_SUPPORTED;
+    }
+    Stream &s = (stream == RX_STREAM) ? (Stream &)_rx_stream : (Stream &)_tx_stream;
+
+    // the event queue is lock-free, so poll it rather than being woken up
+    const auto deadline = std::chrono::steady_clock::now() +
+                          std::chrono::microseconds(timeoutUs);
+    StreamEvent event;
+    while (!s.events.pop(event))
+    {
+        const long left = remainingUs(deadline);
+        if (left == 0)
         {
-            return samp_avail;
+            return SOAPY_SDR_TIMEOUT;
         }
-        return ret;
+        std::this_thread::sleep_for(std::chrono::microseconds(std::min(left, (long)STATUS_POLL_US)));
     }
 
-    _tx_stream.remainderHandle = handle;
-    _tx_stream.remainderSamps = ret;
+    chanMask = 0;
+    for (const size_t channel : s.channels)
+    {
+        chanMask |= 1 << channel;
+    }
+    flags |= event.flags;
+    timeNs = event.timeNs;
+    return event.code;
+}
 
-    const size_t n = std::min((returnedElems - samp_avail), _tx_stream.remainderSamps);
 
-    // Write out channels
-    for (size_t i = 0; i < _tx_stream.channels.size(); i++)
-    {
-        interleave(buffs[i], _tx_stream.remainderBuff, n, _tx_stream.format, samp_avail + _tx_stream.channels[i]);
+/*******************************************************************
+ * RX prefetching
+ ******************************************************************/
+
+// With `prefetch_buffers` set, a thread copies every DMA buffer into a software
+// ring as soon as it arrives, and hands the DMA buffer back right away. The
+// direct buffer API then serves buffers from that ring, so that readStream can
+// fall behind for as long as the ring lasts without overflowing the DMA ring.
+// Buffers keep their DMA handle, to timestamp them. An overflow (of either
+// ring) is passed on as a buffer tagged -1.
+
+// How long the prefetch thread waits for DMA buffers before checking whether
+// it should stop.
+#define PREFETCH_TIMEOUT_US 100000
+
+static void pinThread(std::thread &thread, const int cpu, const char *name) {
+    if (cpu < 0)
+        return;
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int ret = pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+    if (ret != 0)
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Could not pin the %s thread to CPU %d: %s",
+                       name, cpu, strerror(ret));
+}
+
+// Signal the other side of a buffer ring through an eventfd.
+static void signalEventfd(const int fd) {
+    uint64_t one = 1;
+    if (write(fd, &one, sizeof(one)) < 0)
+        throw std::runtime_error("eventfd write failed");
+}
+
+// Reset an eventfd before checking the ring it signals for, so that a buffer
+// pushed after the check can't be missed.
+static void clearEventfd(const int fd) {
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        throw std::runtime_error("eventfd read failed");
+}
+
+void SoapyLiteXXTRX::startPrefetch(void) {
+    // buffers left over from a previous activation are gone
+    _rx_stream.prefetch_ring.reset();
+    _rx_stream.remainderHandle = -1;
+    _rx_stream.prefetch_running = true;
+    _rx_stream.prefetch_thread = std::thread(&SoapyLiteXXTRX::prefetchLoop, this);
+    pinThread(_rx_stream.prefetch_thread, _rx_stream.prefetch_cpu, "prefetch");
+}
+
+void SoapyLiteXXTRX::stopPrefetch(void) {
+    if (!_rx_stream.prefetch_thread.joinable())
+        return;
+    _rx_stream.prefetch_running = false;
+    _rx_stream.prefetch_thread.join();
+}
+
+void SoapyLiteXXTRX::prefetchLoop(void) {
+    BufferRing &ring = _rx_stream.prefetch_ring;
+    bool overflow = false;
+    try {
+        while (_rx_stream.prefetch_running.load(std::memory_order_relaxed)) {
+            size_t handle;
+            const void *buf;
+            int flags = 0;
+            long long timeNs;
+            int ret = acquireDMAReadBuffer(handle, &buf, flags, timeNs, PREFETCH_TIMEOUT_US);
+            if (ret == SOAPY_SDR_TIMEOUT)
+                continue;
+            else if (ret == SOAPY_SDR_OVERFLOW) {
+                overflow = true;
+                continue;
+            } else if (ret < 0)
+                throw std::runtime_error("acquireReadBuffer failed: " + std::to_string(ret));
+
+            // report overflows in order with the data, once there's room for it
+            if (overflow && ring.back()) {
+                ring.push(-1);
+                overflow = false;
+            }
+
+            int8_t *slot = ring.back();
+            if (slot) {
+                memcpy(slot, buf, ring.size());
+                ring.push(handle);
+                signalEventfd(_rx_stream.prefetch_fds.fd);
+            } else if (!overflow) {
+                // the software ring is full, drop the buffer
+                pushEvent(RX_STREAM, SOAPY_SDR_OVERFLOW, SOAPY_SDR_END_ABRUPT,
+                          sampleTime(RX_STREAM, handle * getStreamMTU(RX_STREAM)), 1);
+                overflow = true;
+            } else {
+                _rx_stream.lost_count.fetch_add(1, std::memory_order_relaxed);
+            }
+            retireBuffers(RX_STREAM, handle + 1, false);
+        }
+    } catch (const std::exception &e) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "RX prefetch thread stopped: %s", e.what());
+    }
+}
+
+int SoapyLiteXXTRX::acquirePrefetchedBuffer(size_t &handle, const void **buffs,
+                                            int &flags, long long &timeNs,
+                                            const long timeoutUs) {
+    BufferRing &ring = _rx_stream.prefetch_ring;
+    int64_t tag;
+    int8_t *slot = ring.front(tag);
+
+    // if there are no buffers, wait for the prefetch thread
+    if (!slot) {
+        if (timeoutUs == 0)
+            return SOAPY_SDR_TIMEOUT;
+
+        clearEventfd(_rx_stream.prefetch_fds.fd);
+        bool ready = waitFor(_rx_stream.prefetch_fds, _rx_stream.wait_mode,
+                             _rx_stream.spin_us, timeoutUs, [&] {
+            slot = ring.front(tag);
+            return slot != nullptr;
+        });
+        if (!ready)
+            return SOAPY_SDR_TIMEOUT;
     }
-    _tx_stream.remainderSamps -= n;
-    _tx_stream.remainderOffset += n;
 
-    if (_tx_stream.remainderSamps == 0)
-    {
-        this->releaseWriteBuffer(stream, _tx_stream.remainderHandle, _tx_stream.remainderOffset, flags, timeNs);
-        _tx_stream.remainderHandle = -1;
-        _tx_stream.remainderOffset = 0;
+    if (tag < 0) {
+        ring.pop();
+        handle = -1;
+        flags |= SOAPY_SDR_END_ABRUPT;
+        return SOAPY_SDR_OVERFLOW;
+    }
+
+    buffs[0] = slot;
+    handle = tag;
+    timeNs = sampleTime(RX_STREAM, tag * getStreamMTU(RX_STREAM));
+    flags |= SOAPY_SDR_HAS_TIME;
+    return getStreamMTU(RX_STREAM);
+}
+
+
+/*******************************************************************
+ * RX recording
+ ******************************************************************/
+
+// With `record_path` set, a thread writes every DMA buffer to disk as soon as
+// it arrives, through the LitePCIe recorder (io_uring and O_DIRECT, see
+// litepcie_recorder.h), and hands the DMA buffer back once it has been copied
+// to one of the recorder's slots. The stream isn't handed out to the caller.
+// Overflows show up as a jump in the DMA handles, and are logged next to the
+// files as gaps, so that the recording can be lined up with the stream time.
+
+void SoapyLiteXXTRX::startRecording(void) {
+    _rx_stream.record_running = true;
+    _rx_stream.record_thread = std::thread(&SoapyLiteXXTRX::recordLoop, this);
+    pinThread(_rx_stream.record_thread, _rx_stream.prefetch_cpu, "record");
+}
+
+void SoapyLiteXXTRX::stopRecording(void) {
+    if (!_rx_stream.record_thread.joinable())
+        return;
+    _rx_stream.record_running = false;
+    _rx_stream.record_thread.join();
+}
+
+void SoapyLiteXXTRX::recordLoop(void) {
+    struct litepcie_recorder &rec = _rx_stream.recorder;
+    int64_t expected = _rx_stream.user_count;
+    try {
+        while (_rx_stream.record_running.load(std::memory_order_relaxed)) {
+            size_t handle;
+            const void *buf;
+            int flags = 0;
+            long long timeNs;
+            int ret = acquireDMAReadBuffer(handle, &buf, flags, timeNs, PREFETCH_TIMEOUT_US);
+            if (ret == SOAPY_SDR_TIMEOUT || ret == SOAPY_SDR_OVERFLOW)
+                continue;
+            else if (ret < 0)
+                throw std::runtime_error("acquireReadBuffer failed: " + std::to_string(ret));
+
+            if ((int64_t)handle != expected) {
+                ret = litepcie_recorder_gap(&rec, ((int64_t)handle - expected) *
+                                            _dma_mmap_info.dma_rx_buf_size / BYTES_PER_FRAME);
+                if (ret < 0)
+                    throw std::runtime_error(std::string("gap log failed: ") + strerror(-ret));
+            }
+            expected = handle + 1;
+
+            ret = litepcie_recorder_write(&rec, buf, _dma_mmap_info.dma_rx_buf_size);
+            if (ret < 0)
+                throw std::runtime_error(std::string("write failed: ") + strerror(-ret));
+            retireBuffers(RX_STREAM, handle + 1, false);
+        }
+    } catch (const std::exception &e) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "RX record thread stopped: %s", e.what());
+    }
+}
+
+
+/*******************************************************************
+ * TX pipelining
+ ******************************************************************/
+
+// With `pipeline_buffers` set, writeStream and the direct buffer API fill a
+// software ring instead of the DMA ring, and a thread copies those buffers to
+// the DMA ring, keeping `fill_target` buffers queued. Each buffer is tagged
+// with its number of samples and whether it ends a burst; an empty buffer
+// ending a burst only closes it.
+
+// How long the pipeline thread waits for buffers before checking whether it
+// should stop.
+#define PIPELINE_TIMEOUT_US 100000
+
+static int64_t pipelineTag(const size_t numElems, const bool end_burst) {
+    return ((int64_t)numElems << 1) | end_burst;
+}
+
+int SoapyLiteXXTRX::acquirePipelineBuffer(size_t &handle, void **buffs,
+                                          const long timeoutUs) {
+    BufferRing &ring = _tx_stream.pipeline_ring;
+    int8_t *slot = ring.back();
+
+    // if the ring is full, wait for the pipeline thread
+    if (!slot) {
+        if (timeoutUs == 0)
+            return SOAPY_SDR_TIMEOUT;
+        clearEventfd(_tx_stream.space_fds.fd);
+        bool ready = waitFor(_tx_stream.space_fds, _tx_stream.wait_mode,
+                             _tx_stream.spin_us, timeoutUs, [&] {
+            slot = ring.back();
+            return slot != nullptr;
+        });
+        if (!ready)
+            return SOAPY_SDR_TIMEOUT;
+    }
+
+    buffs[0] = slot;
+    handle = 0;
+    return getStreamMTU(TX_STREAM);
+}
+
+void SoapyLiteXXTRX::releasePipelineBuffer(const size_t numElems, const bool end_burst) {
+    BufferRing &ring = _tx_stream.pipeline_ring;
+    const size_t mtu = getStreamMTU(TX_STREAM);
+    if (numElems < mtu)
+        memset(ring.back() + numElems * BYTES_PER_FRAME, 0, (mtu - numElems) * BYTES_PER_FRAME);
+    ring.push(pipelineTag(numElems, end_burst));
+    signalEventfd(_tx_stream.pipeline_fds.fd);
+}
+
+void SoapyLiteXXTRX::startPipeline(void) {
+    _tx_stream.pipeline_ring.reset();
+    _tx_stream.remainderHandle = -1;
+    _tx_stream.pipeline_running = true;
+    _tx_stream.pipeline_thread = std::thread(&SoapyLiteXXTRX::pipelineLoop, this);
+    pinThread(_tx_stream.pipeline_thread, _tx_stream.pipeline_cpu, "pipeline");
+}
+
+void SoapyLiteXXTRX::stopPipeline(void) {
+    if (!_tx_stream.pipeline_thread.joinable())
+        return;
+    _tx_stream.pipeline_running = false;
+    _tx_stream.pipeline_thread.join();
+}
+
+void SoapyLiteXXTRX::pipelineLoop(void) {
+    BufferRing &ring = _tx_stream.pipeline_ring;
+    const int64_t mtu = getStreamMTU(TX_STREAM);
+    const double buffer_us = 1e6 * mtu / _tx_stream.time_rate;
+    try {
+        while (_tx_stream.pipeline_running.load(std::memory_order_relaxed)) {
+            // wait for a buffer to send
+            int64_t tag;
+            int8_t *slot = ring.front(tag);
+            if (!slot) {
+                clearEventfd(_tx_stream.pipeline_fds.fd);
+                waitFor(_tx_stream.pipeline_fds, WaitMode::SLEEP, 0, PIPELINE_TIMEOUT_US, [&] {
+                    slot = ring.front(tag);
+                    return slot != nullptr;
+                });
+                if (!slot)
+                    continue;
+            }
+            const size_t numElems = tag >> 1;
+            const bool end_burst = tag & 1;
+
+            if (_tx_stream.burst_end)
+                resumeBurst();
+
+            // don't queue more than the fill target, sleeping until the DMA
+            // engine should have sent the excess buffers
+            refreshCounters(TX_STREAM);
+            const int64_t pending = _tx_stream.user_count - _tx_stream.hw_count;
+            _tx_stream.dma_fill.store(pending, std::memory_order_relaxed);
+            if (pending >= _tx_stream.fill_target) {
+                const double excess_us = (pending - _tx_stream.fill_target + 1) * buffer_us;
+                std::this_thread::sleep_for(std::chrono::microseconds(
+                    (long)std::min(excess_us, (double)PIPELINE_TIMEOUT_US)));
+                continue;
+            }
+
+            if (numElems == 0 && end_burst) {
+                retireBuffers(TX_STREAM, _tx_stream.release_count, true);
+                endBurst(_tx_stream.user_count * mtu);
+            } else {
+                size_t handle;
+                void *buf;
+                int ret = acquireDMAWriteBuffer(handle, &buf, PIPELINE_TIMEOUT_US);
+                if (ret == SOAPY_SDR_TIMEOUT)
+                    continue;
+                else if (ret == SOAPY_SDR_UNDERFLOW)
+                    _tx_stream.underflow = true;
+                else if (ret < 0)
+                    throw std::runtime_error("acquireWriteBuffer failed: " + std::to_string(ret));
+
+                memcpy(buf, slot, ring.size());
+                releaseDMAWriteBuffer(handle, numElems, end_burst);
+            }
+
+            ring.pop();
+            signalEventfd(_tx_stream.space_fds.fd);
+        }
+    } catch (const std::exception &e) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "TX pipeline thread stopped: %s", e.what());
     }
+}
+
 
-    return returnedElems;
+/*******************************************************************
+ * TX playback
+ ******************************************************************/
+
+// With `play_path` set, a thread fills the DMA ring from a file as fast as the
+// DMA engine frees buffers, through the LitePCIe player (mmap and read-ahead,
+// see litepcie_player.h), instead of writeStream filling it. Underflows are
+// counted and reported like with writeStream. Without `play_loop`, the burst
+// ends with the file.
+
+void SoapyLiteXXTRX::startPlayback(void) {
+    _tx_stream.play_running = true;
+    _tx_stream.play_thread = std::thread(&SoapyLiteXXTRX::playLoop, this);
+    pinThread(_tx_stream.play_thread, _tx_stream.pipeline_cpu, "play");
+}
+
+void SoapyLiteXXTRX::stopPlayback(void) {
+    if (!_tx_stream.play_thread.joinable())
+        return;
+    _tx_stream.play_running = false;
+    _tx_stream.play_thread.join();
+}
+
+void SoapyLiteXXTRX::playLoop(void) {
+    struct litepcie_player &player = _tx_stream.player;
+    const size_t buf_size = _dma_mmap_info.dma_tx_buf_size;
+    const size_t mtu = getStreamMTU(TX_STREAM);
+    try {
+        while (_tx_stream.play_running.load(std::memory_order_relaxed)) {
+            size_t handle;
+            void *buf;
+            int ret = acquireDMAWriteBuffer(handle, &buf, PIPELINE_TIMEOUT_US);
+            if (ret == SOAPY_SDR_TIMEOUT)
+                continue;
+            else if (ret == SOAPY_SDR_UNDERFLOW)
+                _tx_stream.underflow = true;
+            else if (ret < 0)
+                throw std::runtime_error("acquireWriteBuffer failed: " + std::to_string(ret));
+
+            const size_t len = litepcie_player_read(&player, buf, buf_size, _tx_stream.play_loop);
+            if (len == buf_size) {
+                releaseDMAWriteBuffer(handle, mtu, false);
+            } else {
+                // the end of the file ends the burst, in a partial buffer
+                memset((int8_t *)buf + len, 0, buf_size - len);
+                releaseDMAWriteBuffer(handle, std::min(mtu, len / BYTES_PER_FRAME), true);
+                break;
+            }
+        }
+    } catch (const std::exception &e) {
+        SoapySDR::logf(SOAPY_SDR_ERROR, "TX playback thread stopped: %s", e.what());
+    }
 }
@@ -0,0 +1,170 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+#include "TuneCache.hpp"
+
+#include <SoapySDR/Constants.h>
+#include <SoapySDR/Logger.hpp>
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <sys/stat.h>
+
+TuneCache::TuneCache(const std::string &path)
+    : _path(path), _dirty(false), _tunes{0, 0}, _fallbacks(0),
+      _total_us{0, 0}, _max_us{0, 0} {}
+
+std::string TuneCache::defaultPath(const std::string &serial) {
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+    std::string dir;
+    if (xdg != NULL && xdg[0] != '\0')
+        dir = xdg;
+    else if (home != NULL && home[0] != '\0')
+        dir = std::string(home) + "/.cache";
+    else
+        return "";
+    return dir + "/xtrx/" + serial + ".tune";
+}
+
+TuneCache::Key TuneCache::key(const int direction, const double ref, const double freq) {
+    // tunes are requested in whole Hz in practice; rounding keeps the
+    // frequencies read back from the file from missing by an ulp
+    return Key(direction, llround(ref), llround(freq));
+}
+
+const TuneCache::Entry *TuneCache::find(const int direction, const double ref,
+                                        const double freq) const {
+    const auto it = _entries.find(key(direction, ref, freq));
+    return (it == _entries.end()) ? NULL : &it->second;
+}
+
+void TuneCache::store(const int direction, const double ref, const double freq,
+                      const Entry &entry) {
+    _entries[key(direction, ref, freq)] = entry;
+    _dirty = true;
+}
+
+void TuneCache::erase(const int direction, const double ref, const double freq) {
+    if (_entries.erase(key(direction, ref, freq)) != 0)
+        _dirty = true;
+}
+
+// One line per entry: direction (rx or tx), reference and LO frequency in Hz,
+// resulting LO frequency in Hz, then the registers in hex.
+bool TuneCache::load(void) {
+    if (_path.empty())
+        return true;
+    std::ifstream file(_path);
+    if (!file) {
+        if (errno == ENOENT)
+            return true;
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Failed to load the tunes from %s: %s",
+                       _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::string line;
+    size_t lineno = 0, loaded = 0;
+    while (std::getline(file, line)) {
+        lineno++;
+        if (line.empty() || line[0] == '#')
+            continue;
+        std::istringstream fields(line);
+        std::string dir;
+        int64_t ref, freq;
+        Entry entry;
+        fields >> dir >> ref >> freq >> entry.actual >> std::hex;
+        for (size_t i = 0; i < REGISTERS; i++)
+            fields >> entry.regs[i];
+        if (fields.fail() || (dir != "rx" && dir != "tx")) {
+            SoapySDR::logf(SOAPY_SDR_WARNING, "%s:%zu: invalid tune, ignored",
+                           _path.c_str(), lineno);
+            continue;
+        }
+        _entries[Key(dir == "rx" ? SOAPY_SDR_RX : SOAPY_SDR_TX, ref, freq)] = entry;
+        loaded++;
+    }
+    if (file.bad()) {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Failed to load the tunes from %s: %s",
+                       _path.c_str(), strerror(errno));
+        return false;
+    }
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "Loaded %zu tunes from %s", loaded, _path.c_str());
+    return true;
+}
+
+bool TuneCache::save(void) {
+    if (_path.empty() || !_dirty)
+        return true;
+
+    // create the cache directory and its parent, if needed
+    const size_t slash = _path.rfind('/');
+    if (slash != std::string::npos && slash > 0) {
+        const std::string dir = _path.substr(0, slash);
+        const size_t parent = dir.rfind('/');
+        if (parent != std::string::npos && parent > 0)
+            mkdir(dir.substr(0, parent).c_str(), 0755);
+        mkdir(dir.c_str(), 0755);
+    }
+
+    // write to a temporary file and move it over the old one, so that a
+    // concurrent load never sees half a file
+    const std::string tmp = _path + ".tmp";
+    FILE *file = fopen(tmp.c_str(), "w");
+    if (file == NULL) {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Failed to save the tunes to %s: %s",
+                       tmp.c_str(), strerror(errno));
+        return false;
+    }
+    fprintf(file, "# direction, reference and LO frequency (Hz), resulting LO "
+                  "frequency (Hz), registers 0x%04x-0x%04x\n",
+            FIRST_REGISTER, (unsigned)(FIRST_REGISTER + REGISTERS - 1));
+    for (const auto &it : _entries) {
+        fprintf(file, "%s %lld %lld %.17g", std::get<0>(it.first) == SOAPY_SDR_RX ? "rx" : "tx",
+                (long long)std::get<1>(it.first), (long long)std::get<2>(it.first),
+                it.second.actual);
+        for (size_t i = 0; i < REGISTERS; i++)
+            fprintf(file, " %04x", it.second.regs[i]);
+        fprintf(file, "\n");
+    }
+    const bool written = ferror(file) == 0;
+    if (fclose(file) != 0 || !written || rename(tmp.c_str(), _path.c_str()) != 0) {
+        SoapySDR::logf(SOAPY_SDR_WARNING, "Failed to save the tunes to %s: %s",
+                       _path.c_str(), strerror(errno));
+        remove(tmp.c_str());
+        return false;
+    }
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "Saved %zu tunes to %s", _entries.size(), _path.c_str());
+    _dirty = false;
+    return true;
+}
+
+void TuneCache::recordTune(const bool replayed, const double us) {
+    _tunes[replayed]++;
+    _total_us[replayed] += us;
+    _max_us[replayed] = std::max(_max_us[replayed], us);
+}
+
+std::string TuneCache::stats(void) const {
+    std::string s = "entries: " + std::to_string(_entries.size());
+    const char *names[2] = {" calibrated: ", " replayed: "};
+    for (int i = 0; i < 2; i++) {
+        s += names[i] + std::to_string(_tunes[i]);
+        if (_tunes[i] > 0)
+            s += " (mean " + std::to_string(_total_us[i] / _tunes[i]) + " us, max "
+                 + std::to_string(_max_us[i]) + " us)";
+    }
+    return s + " fallbacks: " + std::to_string(_fallbacks)
+             + " file: " + (_path.empty() ? "none" : _path);
+}
@@ -0,0 +1,78 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Cache of LO tunes.
+//
+// Tuning an LO (LMS7002M_set_lo_freq) computes the dividers of the SXR or SXT
+// synthesizer, then searches the VCO and its capacitor bank (CSW) for one that
+// locks, which takes tens of SPI round-trips. The registers this results in
+// (0x011c to 0x0124 of the synthesizer's channel) are kept here, by direction,
+// reference clock and LO frequency, so that tuning to the same frequency again
+// only takes writing them back.
+//
+// The entries can be saved to and loaded from a file, one line per entry, so
+// that they outlive the device handle: the results are specific to the chip
+// (and drift with temperature, which a failing lock check catches), so there is
+// one file per device serial.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+
+class TuneCache {
+  public:
+    // Registers of a synthesizer that a tune programs.
+    static const uint16_t FIRST_REGISTER = 0x011c;
+    static const size_t REGISTERS = 9;
+
+    struct Entry {
+        double actual;
+        uint16_t regs[REGISTERS];
+    };
+
+    // Entries are saved to and loaded from `path`, unless empty.
+    TuneCache(const std::string &path);
+
+    // Default file for the device with the given serial, under the user's
+    // cache directory ($XDG_CACHE_HOME or ~/.cache), or empty if there is none.
+    static std::string defaultPath(const std::string &serial);
+
+    // Entry for the given tune, or NULL.
+    const Entry *find(const int direction, const double ref, const double freq) const;
+    void store(const int direction, const double ref, const double freq, const Entry &entry);
+    void erase(const int direction, const double ref, const double freq);
+    size_t size(void) const { return _entries.size(); }
+
+    // Load the entries from the file (missing is not an error), and save them
+    // if anything changed. Return false (having logged why) on failure.
+    bool load(void);
+    bool save(void);
+    const std::string &path(void) const { return _path; }
+
+    // Statistics: tunes that took a full calibration and the ones replayed
+    // from the cache (with their total and longest time), and replays that
+    // didn't lock, which fell back to a full calibration.
+    void recordTune(const bool replayed, const double us);
+    void recordFallback(void) { _fallbacks++; }
+    std::string stats(void) const;
+
+  private:
+    typedef std::tuple<int, int64_t, int64_t> Key;
+    static Key key(const int direction, const double ref, const double freq);
+
+    const std::string _path;
+    std::map<Key, Entry> _entries;
+    bool _dirty;
+
+    uint64_t _tunes[2], _fallbacks;
+    double _total_us[2], _max_us[2];
+};
@@ -0,0 +1,104 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Strategies for waiting on the DMA engine, trading CPU time for wakeup latency:
+// - sleep: block in ppoll() until the driver signals new buffers;
+// - spin: check the DMA counters for a bounded time first, then sleep;
+// - busy: keep checking the DMA counters until the timeout expires.
+//
+// Unlike poll(), which only takes milliseconds, all of them honor timeouts
+// with microsecond precision.
+
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <poll.h>
+#include <stdexcept>
+#include <string>
+
+enum class WaitMode { SLEEP, SPIN, BUSY };
+
+inline WaitMode parseWaitMode(const std::string &mode) {
+    if (mode == "sleep")
+        return WaitMode::SLEEP;
+    else if (mode == "spin")
+        return WaitMode::SPIN;
+    else if (mode == "busy")
+        return WaitMode::BUSY;
+    else
+        throw std::runtime_error("Unsupported wait mode: " + mode);
+}
+
+inline const char *waitModeName(const WaitMode mode) {
+    switch (mode) {
+    case WaitMode::SLEEP: return "sleep";
+    case WaitMode::SPIN:  return "spin";
+    case WaitMode::BUSY:  return "busy";
+    }
+    return "unknown";
+}
+
+static inline void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// Wait until `ready()` returns true, for at most `timeoutUs` microseconds.
+// `fds` should become readable/writable when the driver has made progress.
+// Returns whether `ready()` became true.
+template <typename Ready>
+bool waitFor(struct pollfd &fds, const WaitMode mode, const long spinUs,
+             const long timeoutUs, Ready ready) {
+    using clock = std::chrono::steady_clock;
+
+    if (ready())
+        return true;
+
+    const auto start = clock::now();
+    const auto deadline = start + std::chrono::microseconds(timeoutUs);
+
+    // check the counters without sleeping
+    if (mode != WaitMode::SLEEP) {
+        const auto spinDeadline = (mode == WaitMode::BUSY)
+            ? deadline
+            : std::min(deadline, start + std::chrono::microseconds(spinUs));
+        while (clock::now() < spinDeadline) {
+            if (ready())
+                return true;
+            cpuRelax();
+        }
+        if (mode == WaitMode::BUSY)
+            return ready();
+    }
+
+    // sleep until the driver signals progress, which may not be enough (e.g.
+    // when the driver considers fewer buffers as processed than we do)
+    for (;;) {
+        const auto left = deadline - clock::now();
+        if (left <= clock::duration::zero())
+            return ready();
+
+        const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left).count();
+        struct timespec ts;
+        ts.tv_sec = ns / 1000000000;
+        ts.tv_nsec = ns % 1000000000;
+        int ret = ppoll(&fds, 1, &ts, NULL);
+        if (ret < 0 && errno != EINTR)
+            throw std::runtime_error("waitFor(): ppoll failed, " +
+                                     std::string(strerror(errno)));
+
+        if (ready())
+            return true;
+    }
+}
@@ -0,0 +1,122 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Persistent pool of threads splitting a job with the calling thread, used to
+// spread sample conversion over several cores.
+//
+// Starting a job bumps a generation counter and finishing it decrements a
+// counter of busy workers, so that back-to-back jobs only cost a few atomic
+// operations. Workers spin on the generation for a while before sleeping on a
+// condition variable, so that an idle stream doesn't keep cores busy.
+
+#pragma once
+
+#include "WaitStrategy.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+  public:
+    // Job run by every worker: `worker` is in [0, workers), 0 being the caller.
+    typedef void (*job_t)(void *ctx, size_t worker, size_t workers);
+
+    explicit WorkerPool(const size_t workers, const long spinUs = 100)
+        : _workers(workers < 1 ? 1 : workers), _spinUs(spinUs), _generation(0),
+          _busy(0), _stop(false), _job(nullptr), _ctx(nullptr) {
+        for (size_t i = 1; i < _workers; i++)
+            _threads.emplace_back(&WorkerPool::work, this, i);
+    }
+
+    ~WorkerPool() {
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stop = true;
+            _generation.fetch_add(1, std::memory_order_release);
+        }
+        _cv.notify_all();
+        for (auto &thread : _threads)
+            thread.join();
+    }
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    size_t size(void) const { return _workers; }
+
+    // Run `job` on all workers, returning once they are all done.
+    void run(job_t job, void *ctx) {
+        if (_workers == 1) {
+            job(ctx, 0, 1);
+            return;
+        }
+
+        _job = job;
+        _ctx = ctx;
+        _busy.store(_workers - 1, std::memory_order_relaxed);
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _generation.fetch_add(1, std::memory_order_release);
+        }
+        _cv.notify_all();
+
+        // wait for the workers, yielding in case they're waiting for a core
+        job(ctx, 0, _workers);
+        for (unsigned spins = 0; _busy.load(std::memory_order_acquire) != 0; spins++) {
+            if (spins < 1000)
+                cpuRelax();
+            else
+                std::this_thread::yield();
+        }
+    }
+
+  private:
+    void work(const size_t worker) {
+        uint64_t seen = 0;
+        for (;;) {
+            // wait for the next job
+            const auto spinDeadline = std::chrono::steady_clock::now() +
+                                      std::chrono::microseconds(_spinUs);
+            for (unsigned spins = 0; _generation.load(std::memory_order_acquire) == seen; spins++) {
+                if (spins < 1000) {
+                    cpuRelax();
+                } else if (std::chrono::steady_clock::now() < spinDeadline) {
+                    std::this_thread::yield();
+                } else {
+                    std::unique_lock<std::mutex> lock(_mutex);
+                    _cv.wait(lock, [&] {
+                        return _generation.load(std::memory_order_acquire) != seen;
+                    });
+                }
+            }
+            seen = _generation.load(std::memory_order_acquire);
+            if (_stop)
+                return;
+
+            _job(_ctx, worker, _workers);
+            _busy.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+    const size_t _workers;
+    const long _spinUs;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    alignas(64) std::atomic<uint64_t> _generation;
+    alignas(64) std::atomic<size_t> _busy;
+    bool _stop;
+    job_t _job;
+    void *_ctx;
+};
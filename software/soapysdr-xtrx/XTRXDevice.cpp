@@ -20,10 +20,12 @@
 //   what are we not properly initializing?
 
 #include "XTRXDevice.hpp"
-#include "litepcie_interface.h"
 #include <SoapySDR/Registry.hpp>
 #include <SoapySDR/Logger.hpp>
 #include <LMS7002M/LMS7002M_logger.h>
+#include <algorithm>
+#include <cctype>
+#include <cmath>
 #include <fstream>
 #include <sys/mman.h>
 
@@ -61,7 +63,8 @@ void dma_set_loopback(int fd, bool loopback_enable) {
 }
 
 SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
-    : _fd(-1), _lms(NULL), _masterClockRate(1.0e6), _refClockRate(26e6) {
+    : _fd(-1), _lms(NULL), _masterClockRate(1.0e6), _refClockRate(26e6),
+      _hop_running(false) {
     LMS7_set_log_handler(&customLogHandler);
     LMS7_set_log_level(LMS7_TRACE);
     SoapySDR::logf(SOAPY_SDR_INFO, "SoapyLiteXXTRX initializing...");
@@ -77,7 +80,18 @@ SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
     if (_fd < 0)
         throw std::runtime_error("SoapyLiteXXTRX(): failed to open " + path);
 
-    SoapySDR::logf(SOAPY_SDR_INFO, "Opened devnode %s, serial %s", path.c_str(), getXTRXSerial(_fd).c_str());
+    const std::string serial = getXTRXSerial(_fd);
+    SoapySDR::logf(SOAPY_SDR_INFO, "Opened devnode %s, serial %s", path.c_str(), serial.c_str());
+
+    // LO tunes from earlier runs, unless disabled (tune_cache=false) or kept
+    // in another file (tune_cache=/path/to/file)
+    const std::string tune_cache = args.count("tune_cache") ? args.at("tune_cache") : "true";
+    if (tune_cache != "false") {
+        _tune_cache.reset(new TuneCache(
+            tune_cache == "true" ? TuneCache::defaultPath(serial) : tune_cache));
+        _tune_cache->load();
+    }
+
     // reset the LMS7002M
     litepcie_writel(_fd, CSR_LMS7002M_CONTROL_ADDR,
         1 * (1 << CSR_LMS7002M_CONTROL_RESET_OFFSET)
@@ -108,11 +122,14 @@ SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
     writeSetting("FPGA_RX_DELAY", "16");
     writeSetting("FPGA_TX_DELAY", "16");
 
-    // setup LMS7002M
-    _lms = LMS7002M_create(litepcie_interface_transact, &_fd);
+    // setup LMS7002M, coalescing the register writes of its configuration
+    litepcie_interface_init(&_lms_spi, _fd);
+    _lms_spi.shadowed = !(args.count("lms_shadow") && args.at("lms_shadow") == "false");
+    _lms = LMS7002M_create(litepcie_interface_transact, &_lms_spi);
     if (_lms == NULL)
         throw std::runtime_error(
             "SoapyLiteXXTRX(): failed to LMS7002M_create()");
+    litepcie_interface_begin(&_lms_spi);
     LMS7002M_reset(_lms);
     LMS7002M_set_spi_mode(_lms, 4);
 
@@ -159,6 +176,12 @@ SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
     // some defaults to avoid throwing
     _cachedSampleRates[SOAPY_SDR_RX] = 1e6;
     _cachedSampleRates[SOAPY_SDR_TX] = 1e6;
+    _timeSource = "internal";
+    _timeNs = 0;
+    _timeHost = std::chrono::steady_clock::now();
+    _ppsTimeNs = 0;
+    _syncMode = 0;
+    _syncTimeNs = 0;
     for (size_t i = 0; i < 2; i++) {
         _cachedFreqValues[SOAPY_SDR_RX][i]["RF"] = 1e9;
         _cachedFreqValues[SOAPY_SDR_TX][i]["RF"] = 1e9;
@@ -187,12 +210,25 @@ SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
         this->setIQBalance(SOAPY_SDR_RX, i, std::polar(1.0, 0.0));
         this->setIQBalance(SOAPY_SDR_TX, i, std::polar(1.0, 0.0));
     }
+    litepcie_interface_end(&_lms_spi);
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "LMS7002M configured with %llu SPI words in %llu syscalls "
+                   "(%llu reads and %llu writes avoided)",
+                   (unsigned long long)_lms_spi.transferred,
+                   (unsigned long long)_lms_spi.syscalls,
+                   (unsigned long long)_lms_spi.reads_avoided,
+                   (unsigned long long)_lms_spi.writes_avoided);
 
     // set-up the DMA
     checked_ioctl(_fd, LITEPCIE_IOCTL_MMAP_DMA_INFO, &_dma_mmap_info);
     dma_init_cpu(_fd);
     _dma_buf = NULL;
 
+    // map the DMA status page, so that streaming can follow the DMA counters
+    // without syscalls (NULL with older drivers, falling back to ioctls)
+    _dma_status = litepcie_dma_status_mmap(_fd);
+    if (_dma_status == NULL)
+        SoapySDR::log(SOAPY_SDR_DEBUG, "DMA status page not available");
+
     // NOTE: if initialization misses a setting/register, try experimenting in
     //       LimeGUI and loading that register dump here
     if (args.count("ini") != 0) {
@@ -210,7 +246,14 @@ SoapyLiteXXTRX::SoapyLiteXXTRX(const SoapySDR::Kwargs &args)
 
 SoapyLiteXXTRX::~SoapyLiteXXTRX(void) {
     SoapySDR::log(SOAPY_SDR_INFO, "Power down and cleanup");
+    stopHopping();
     if (_rx_stream.opened) {
+        stopPrefetch();
+        if (_rx_stream.prefetch_buffers > 0)
+            close(_rx_stream.prefetch_fds.fd);
+        stopRecording();
+        if (_rx_stream.recording)
+            litepcie_recorder_close(&_rx_stream.recorder);
         litepcie_release_dma(_fd, 0, 1);
 
             munmap(_rx_stream.buf, _dma_mmap_info.dma_rx_buf_size *
@@ -218,6 +261,15 @@ SoapyLiteXXTRX::~SoapyLiteXXTRX(void) {
         _rx_stream.opened = false;
     }
     if (_tx_stream.opened) {
+        stopPipeline();
+        if (_tx_stream.pipeline_buffers > 0) {
+            close(_tx_stream.pipeline_fds.fd);
+            close(_tx_stream.space_fds.fd);
+        }
+        stopPlayback();
+        if (_tx_stream.playing)
+            litepcie_player_close(&_tx_stream.player);
+
         // release the DMA engine
         litepcie_release_dma(_fd, 1, 0);
 
@@ -225,6 +277,13 @@ SoapyLiteXXTRX::~SoapyLiteXXTRX(void) {
                                    _dma_mmap_info.dma_tx_buf_count);
         _tx_stream.opened = false;
     }
+    litepcie_dma_status_munmap(_dma_status);
+    // send the writes of an uncommitted transaction
+    if (_lms_spi.transactions > 0) {
+        _lms_spi.transactions = 1;
+        _lms_spi.depth = 1;
+        litepcie_interface_commit(&_lms_spi);
+    }
     // power down and clean up
     // NOTE: disable if you want to inspect the configuration (e.g. in LimeGUI)
     //       or to validate the settings (e.g. using xtrx_litepcie_test)
@@ -245,6 +304,9 @@ SoapyLiteXXTRX::~SoapyLiteXXTRX(void) {
     LMS7002M_power_down(_lms);
     LMS7002M_destroy(_lms);
     close(_fd);
+
+    if (_tune_cache)
+        _tune_cache->save();
 }
 
 
@@ -313,6 +375,7 @@ void SoapyLiteXXTRX::setAntenna(const int direction, const size_t channel,
             throw std::runtime_error("SoapyLiteXXTRX::setAntenna(RX, " + name +
                                      ") - unknown antenna name");
         LMS7002M_rfe_set_path(_lms, ch2LMS(channel), path);
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_RF_SWITCHES_RX_ADDR, rx_rf_switch);
     }
     if (direction == SOAPY_SDR_TX) {
@@ -330,6 +393,7 @@ void SoapyLiteXXTRX::setAntenna(const int direction, const size_t channel,
             throw std::runtime_error("SoapyLiteXXTRX::setAntenna(TX, " + name +
                                      ") - unknown antenna name");
         LMS7002M_trf_select_band(_lms, ch2LMS(channel), band);
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_RF_SWITCHES_TX_ADDR, tx_rf_switch);
     }
     _cachedAntValues[direction][channel] = name;
@@ -510,23 +574,89 @@ SoapySDR::Range SoapyLiteXXTRX::getGainRange(const int direction,
  * Frequency API
  ******************************************************************/
 
+// Time the comparators of a VCO take to settle after its CSW changed.
+#define TUNE_SETTLE_US 50
+
+// VCO comparators of the SX synthesizers: the VCO is locked when its tuning
+// voltage is between both thresholds, with only the high comparator set.
+#define LMS7002M_REG_SX_VCO_CMP 0x0123
+#define LMS7002M_SX_VCO_CMPHO   (1 << 13)
+#define LMS7002M_SX_VCO_CMPLO   (1 << 12)
+
+// Tune the LO of a direction, writing back the registers of an earlier tune
+// to the same frequency if cached, and running the full tune and VCO
+// calibration otherwise (or if these didn't lock). Returns the actual
+// frequency, and sets `replayed` (if given) to whether the registers were
+// written back.
+double SoapyLiteXXTRX::tuneLO(const int direction, const double frequency,
+                              bool *replayed) {
+    const auto start = std::chrono::steady_clock::now();
+    const auto elapsed_us = [&start]() {
+        return std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+    };
+
+    const TuneCache::Entry *cached = _tune_cache ?
+        _tune_cache->find(direction, _refClockRate, frequency) : NULL;
+    if (cached != NULL) {
+        // through the driver's copy of the registers, which it later
+        // read-modify-writes from (the shadow drops the unchanged ones)
+        LMS7002M_set_mac_dir(_lms, dir2LMS(direction));
+        LMS7002M_regs_t *regs = LMS7002M_regs(_lms);
+        for (size_t i = 0; i < TuneCache::REGISTERS; i++) {
+            const int addr = TuneCache::FIRST_REGISTER + i;
+            LMS7002M_regs_set(regs, addr, cached->regs[i]);
+            LMS7002M_regs_spi_write(_lms, addr);
+        }
+        litepcie_interface_flush(&_lms_spi);
+        std::this_thread::sleep_for(std::chrono::microseconds(TUNE_SETTLE_US));
+
+        const int cmp = LMS7002M_spi_read(_lms, LMS7002M_REG_SX_VCO_CMP);
+        if ((cmp & (LMS7002M_SX_VCO_CMPHO | LMS7002M_SX_VCO_CMPLO)) == LMS7002M_SX_VCO_CMPHO) {
+            _tune_cache->recordTune(true, elapsed_us());
+            if (replayed)
+                *replayed = true;
+            return cached->actual;
+        }
+        SoapySDR::logf(SOAPY_SDR_DEBUG, "Cached %s LO tune to %f MHz didn't lock, recalibrating",
+                       dir2Str(direction), frequency / 1e6);
+        _tune_cache->recordFallback();
+        _tune_cache->erase(direction, _refClockRate, frequency);
+    }
+
+    TuneCache::Entry entry;
+    int ret = LMS7002M_set_lo_freq(_lms, dir2LMS(direction), _refClockRate,
+                                   frequency, &entry.actual);
+    if (ret != 0)
+        throw std::runtime_error("SoapyLiteXXTRX::setFrequency(" +
+                                 std::to_string(frequency / 1e6) +
+                                 " MHz) failed - " + std::to_string(ret));
+
+    if (_tune_cache) {
+        // the tune left the synthesizer's channel selected
+        LMS7002M_regs_t *regs = LMS7002M_regs(_lms);
+        for (size_t i = 0; i < TuneCache::REGISTERS; i++)
+            entry.regs[i] = LMS7002M_regs_get(regs, TuneCache::FIRST_REGISTER + i);
+        _tune_cache->store(direction, _refClockRate, frequency, entry);
+        _tune_cache->recordTune(false, elapsed_us());
+    }
+    if (replayed)
+        *replayed = false;
+    return entry.actual;
+}
+
 void SoapyLiteXXTRX::setFrequency(const int direction, const size_t channel,
                              const std::string &name, const double frequency,
                              const SoapySDR::Kwargs &/*args*/) {
     std::unique_lock<std::mutex> lock(_mutex);
+    LMS7002MBatch batch(&_lms_spi);
 
     SoapySDR::logf(SOAPY_SDR_DEBUG,
                    "SoapyLiteXXTRX::setFrequency(%s, ch%d, %s, %f MHz)",
                    dir2Str(direction), channel, name.c_str(), frequency / 1e6);
 
     if (name == "RF") {
-        double actualFreq = 0.0;
-        int ret = LMS7002M_set_lo_freq(_lms, dir2LMS(direction), _refClockRate,
-                                       frequency, &actualFreq);
-        if (ret != 0)
-            throw std::runtime_error("SoapyLiteXXTRX::setFrequency(" +
-                                     std::to_string(frequency / 1e6) +
-                                     " MHz) failed - " + std::to_string(ret));
+        const double actualFreq = tuneLO(direction, frequency);
         _cachedFreqValues[direction][0][name] = actualFreq;
         _cachedFreqValues[direction][1][name] = actualFreq;
     }
@@ -571,6 +701,236 @@ SoapyLiteXXTRX::getFrequencyRange(const int direction, const size_t /*channel*/,
 }
 
 
+/*******************************************************************
+ * Frequency hopping
+ ******************************************************************/
+
+// How long the hop thread sleeps at most before checking whether it should
+// stop, and how long before a hop it stops sleeping and spins on the clock.
+#define HOP_TIMEOUT_US 100000
+#define HOP_SPIN_US    200
+
+// Parse a hop of the HOP_SCHEDULE setting: `time_ns,rx|tx,channel,frequency[,gain]`.
+static bool parseHop(const std::string &text, long long &time_ns, int &direction,
+                     size_t &channel, double &frequency, double &gain) {
+    std::vector<std::string> fields;
+    size_t pos = 0;
+    while (true) {
+        const size_t end = text.find(',', pos);
+        fields.push_back(text.substr(pos, end - pos));
+        if (end == std::string::npos)
+            break;
+        pos = end + 1;
+    }
+    if (fields.size() != 4 && fields.size() != 5)
+        return false;
+    if (fields[1] != "rx" && fields[1] != "tx")
+        return false;
+    try {
+        time_ns = std::stoll(fields[0]);
+        direction = (fields[1] == "rx") ? SOAPY_SDR_RX : SOAPY_SDR_TX;
+        channel = std::stoul(fields[2]);
+        frequency = std::stod(fields[3]);
+        gain = (fields.size() == 5) ? std::stod(fields[4]) : NAN;
+    } catch (const std::exception &) {
+        return false;
+    }
+    return channel < 2;
+}
+
+// Replace the hop schedule by the one in `table` (see HOP_SCHEDULE), and start
+// executing it. The LOs it tunes to are calibrated now if not in the tune
+// cache, so that the hops themselves only replay registers.
+void SoapyLiteXXTRX::loadHops(const std::string &table) {
+    std::vector<Hop> hops;
+    size_t pos = 0;
+    while (pos <= table.size()) {
+        size_t end = table.find_first_of(";\n", pos);
+        if (end == std::string::npos)
+            end = table.size();
+        std::string text = table.substr(pos, end - pos);
+        text.erase(std::remove_if(text.begin(), text.end(), ::isspace), text.end());
+        pos = end + 1;
+        if (text.empty())
+            continue;
+
+        Hop hop = Hop();
+        if (!parseHop(text, hop.time_ns, hop.direction, hop.channel, hop.frequency, hop.gain))
+            throw std::runtime_error("SoapyLiteXXTRX::writeSetting(HOP_SCHEDULE) invalid hop \"" +
+                                     text + "\", expected time_ns,rx|tx,channel,frequency[,gain]");
+        hops.push_back(hop);
+    }
+    std::stable_sort(hops.begin(), hops.end(),
+                     [](const Hop &a, const Hop &b) { return a.time_ns < b.time_ns; });
+
+    stopHopping();
+
+    if (_tune_cache) {
+        std::lock_guard<std::mutex> lock(_mutex);
+        LMS7002MBatch batch(&_lms_spi);
+        bool retuned[2] = {false, false};
+        for (const Hop &hop : hops) {
+            if (_tune_cache->find(hop.direction, _refClockRate, hop.frequency))
+                continue;
+            tuneLO(hop.direction, hop.frequency);
+            retuned[hop.direction == SOAPY_SDR_RX] = true;
+        }
+        // back to the LOs the schedule starts from
+        for (const int direction : {SOAPY_SDR_TX, SOAPY_SDR_RX})
+            if (retuned[direction == SOAPY_SDR_RX])
+                tuneLO(direction, _cachedFreqValues[direction][0]["RF"]);
+    } else
+        SoapySDR::log(SOAPY_SDR_WARNING, "Hopping without tune cache: every hop "
+                      "will calibrate its VCO");
+
+    {
+        std::lock_guard<std::mutex> lock(_hop_mutex);
+        _hops = std::move(hops);
+    }
+    if (_hops.empty())
+        return;
+    _hop_running = true;
+    _hop_thread = std::thread(&SoapyLiteXXTRX::hopLoop, this);
+}
+
+void SoapyLiteXXTRX::stopHopping(void) {
+    if (!_hop_thread.joinable())
+        return;
+    _hop_running = false;
+    _hop_thread.join();
+}
+
+void SoapyLiteXXTRX::hopLoop(void) {
+    // Device time, following the RX sample clock while the RX stream is
+    // active: the time of the last sample written by the DMA engine, taken
+    // when its count was seen advancing, and extrapolated with the host clock
+    // from there. Otherwise (or without the DMA status page, which would take
+    // a syscall per look), the host-based time of getHardwareTime.
+    int64_t rx_count = -1;
+    long long anchor_ns = 0;
+    std::chrono::steady_clock::time_point anchor_host;
+    bool rx_clock = false;
+    const auto now_ns = [&]() -> long long {
+        const auto host = std::chrono::steady_clock::now();
+        rx_clock = _dma_status != NULL && _rx_stream.active.load(std::memory_order_acquire);
+        if (!rx_clock) {
+            rx_count = -1;
+            return getHardwareTime();
+        }
+        const int64_t count = litepcie_dma_status_load(&_dma_status->writer_hw_count);
+        if (count != rx_count) {
+            rx_count = count;
+            anchor_ns = sampleTime(RX_STREAM, count * getStreamMTU(RX_STREAM));
+            anchor_host = host;
+        }
+        return anchor_ns + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                               host - anchor_host).count();
+    };
+
+    for (size_t i = 0; i < _hops.size(); i++) {
+        Hop &hop = _hops[i];
+
+        // sleep until shortly before the hop, then spin
+        long long start_ns;
+        while (true) {
+            if (!_hop_running.load(std::memory_order_relaxed))
+                return;
+            start_ns = now_ns();
+            const long long wait_us = (hop.time_ns - start_ns) / 1000;
+            if (wait_us <= 0)
+                break;
+            if (wait_us > HOP_SPIN_US)
+                std::this_thread::sleep_for(std::chrono::microseconds(
+                    std::min<long long>(wait_us - HOP_SPIN_US, HOP_TIMEOUT_US)));
+        }
+
+        const auto start = std::chrono::steady_clock::now();
+        double tune_us = 0;
+        bool replayed = false;
+        uint64_t words = 0;
+        std::string error;
+        try {
+            {
+                std::lock_guard<std::mutex> lock(_mutex);
+                const uint64_t transferred = _lms_spi.transferred;
+                {
+                    LMS7002MBatch batch(&_lms_spi);
+                    const double actual = tuneLO(hop.direction, hop.frequency, &replayed);
+                    _cachedFreqValues[hop.direction][0]["RF"] = actual;
+                    _cachedFreqValues[hop.direction][1]["RF"] = actual;
+                }
+                words = _lms_spi.transferred - transferred;
+            }
+            tune_us = std::chrono::duration<double, std::micro>(
+                std::chrono::steady_clock::now() - start).count();
+            if (!std::isnan(hop.gain))
+                SoapySDR::Device::setGain(hop.direction, hop.channel, hop.gain);
+        } catch (const std::exception &e) {
+            error = e.what();
+            SoapySDR::logf(SOAPY_SDR_ERROR, "Hop %zu failed: %s", i, e.what());
+        }
+        const double total_us = std::chrono::duration<double, std::micro>(
+            std::chrono::steady_clock::now() - start).count();
+
+        std::lock_guard<std::mutex> lock(_hop_mutex);
+        hop.done = true;
+        hop.start_ns = start_ns;
+        hop.rx_clock = rx_clock;
+        hop.tune_us = tune_us;
+        hop.total_us = total_us;
+        hop.replayed = replayed;
+        hop.words = words;
+        hop.error = error;
+    }
+    _hop_running = false;
+}
+
+// Report of the HOP_REPORT setting: statistics of the start latency of the
+// hops executed so far (the jitter being its standard deviation), then a line
+// per hop.
+std::string SoapyLiteXXTRX::hopReport(void) const {
+    std::lock_guard<std::mutex> lock(_hop_mutex);
+    size_t done = 0;
+    double sum = 0, sum_sq = 0;
+    long long min = 0, max = 0;
+    std::string lines;
+    for (size_t i = 0; i < _hops.size(); i++) {
+        const Hop &hop = _hops[i];
+        if (!hop.done)
+            continue;
+        const long long latency = hop.start_ns - hop.time_ns;
+        min = (done == 0) ? latency : std::min(min, latency);
+        max = (done == 0) ? latency : std::max(max, latency);
+        sum += latency;
+        sum_sq += (double)latency * latency;
+        done++;
+
+        char line[256];
+        snprintf(line, sizeof(line), "hop %zu: %lld ns %s ch%zu %f MHz latency: %lld ns "
+                 "(%s clock) tune: %.1f us (%s, %llu SPI words) total: %.1f us",
+                 i, hop.time_ns, dir2Str(hop.direction), hop.channel, hop.frequency / 1e6,
+                 latency, hop.rx_clock ? "RX" : "host", hop.tune_us,
+                 hop.replayed ? "replayed" : "calibrated", (unsigned long long)hop.words,
+                 hop.total_us);
+        lines += line;
+        if (!hop.error.empty())
+            lines += " error: " + hop.error;
+        lines += "\n";
+    }
+
+    std::string s = "hops: " + std::to_string(done) + "/" + std::to_string(_hops.size());
+    if (done > 0) {
+        const double mean = sum / done;
+        const double jitter = std::sqrt(std::max(sum_sq / done - mean * mean, 0.0));
+        s += " latency: mean " + std::to_string((long long)mean) + " ns, jitter " +
+             std::to_string((long long)jitter) + " ns, min " + std::to_string(min) +
+             " ns, max " + std::to_string(max) + " ns";
+    }
+    s += " running: " + std::string(_hop_running.load() ? "yes" : "no");
+    return s + "\n" + lines;
+}
+
+
 /*******************************************************************
  * Sample Rate API
  ******************************************************************/
@@ -578,6 +938,7 @@ SoapyLiteXXTRX::getFrequencyRange(const int direction, const size_t /*channel*/,
 void SoapyLiteXXTRX::setSampleRate(const int direction, const size_t,
                               const double rate) {
     std::lock_guard<std::mutex> lock(_mutex);
+    LMS7002MBatch batch(&_lms_spi);
 
     const double baseRate = this->getTSPRate(direction);
     const double factor = baseRate / rate;
@@ -610,6 +971,11 @@ void SoapyLiteXXTRX::setSampleRate(const int direction, const size_t,
     }
 
     _cachedSampleRates[direction] = baseRate / intFactor;
+
+    // keep the software NCOs at the same frequency
+    Stream &stream = (direction == SOAPY_SDR_RX) ? (Stream &)_rx_stream : (Stream &)_tx_stream;
+    if (stream.opened && stream.dsp)
+        stream.dsp->setSampleRate(_cachedSampleRates[direction]);
 }
 
 double SoapyLiteXXTRX::getSampleRate(const int direction, const size_t) const {
@@ -635,7 +1001,10 @@ std::vector<std::string> SoapyLiteXXTRX::getStreamFormats(const int /*direction*
                                                      const size_t /*channel*/) const
 {
     std::vector<std::string> formats;
+    formats.push_back(SOAPY_SDR_CS8);
     formats.push_back(SOAPY_SDR_CS16);
+    formats.push_back(SOAPY_SDR_CF32);
+    formats.push_back(SOAPY_SDR_CF64);
     return formats;
 }
 
@@ -646,6 +1015,7 @@ std::vector<std::string> SoapyLiteXXTRX::getStreamFormats(const int /*direction*
 void SoapyLiteXXTRX::setBandwidth(const int direction, const size_t channel,
                              const double bw) {
     std::lock_guard<std::mutex> lock(_mutex);
+    LMS7002MBatch batch(&_lms_spi);
 
     SoapySDR::logf(SOAPY_SDR_DEBUG, "SoapyLiteXXTRX::setBandwidth(%s, ch%d, %f MHz)",
                    dir2Str(direction), channel, bw / 1e6);
@@ -717,6 +1087,7 @@ double SoapyLiteXXTRX::getTSPRate(const int direction) const {
 
 void SoapyLiteXXTRX::setMasterClockRate(const double rate) {
     std::lock_guard<std::mutex> lock(_mutex);
+    LMS7002MBatch batch(&_lms_spi);
 
     int ret =
         LMS7002M_set_data_clock(_lms, _refClockRate, rate, &_masterClockRate);
@@ -774,6 +1145,7 @@ std::vector<std::string> SoapyLiteXXTRX::listClockSources(void) const {
  * \param source the name of a clock source
  */
 void SoapyLiteXXTRX::setClockSource(const std::string &source) {
+    std::lock_guard<std::mutex> lock(_mutex);
     int control = litepcie_readl(_fd, CSR_VCTCXO_CONTROL_ADDR);
     control &= ~(1 << CSR_VCTCXO_CONTROL_SEL_OFFSET);
 
@@ -782,6 +1154,7 @@ void SoapyLiteXXTRX::setClockSource(const std::string &source) {
     } else if (source != "internal") {
         throw std::runtime_error("setClockSource(" + source + ") invalid");
     }
+    litepcie_interface_flush(&_lms_spi);
     litepcie_writel(_fd, CSR_VCTCXO_CONTROL_ADDR, control);
 }
 
@@ -795,7 +1168,61 @@ std::string SoapyLiteXXTRX::getClockSource(void) const {
 }
 
 /*******************************************************************
- * Clocking API
+ * Time API
+ ******************************************************************/
+
+// There is no hardware clock: the device time is kept by the host, while RX
+// samples are timestamped by counting them from the start of the stream. That
+// start is either the time of activation ("internal" time source), or the PPS
+// edge the DMA synchronizer waits for before letting samples through ("pps").
+
+std::vector<std::string> SoapyLiteXXTRX::listTimeSources(void) const {
+    std::vector<std::string> sources;
+    sources.push_back("internal");
+#ifdef CSR_PCIE_DMA0_SYNCHRONIZER_ENABLE_ADDR
+    sources.push_back("pps");
+#endif
+    return sources;
+}
+
+void SoapyLiteXXTRX::setTimeSource(const std::string &source) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    const auto sources = this->listTimeSources();
+    if (std::find(sources.begin(), sources.end(), source) == sources.end())
+        throw std::runtime_error("setTimeSource(" + source + ") invalid");
+    _timeSource = source;
+}
+
+std::string SoapyLiteXXTRX::getTimeSource(void) const {
+    return _timeSource;
+}
+
+bool SoapyLiteXXTRX::hasHardwareTime(const std::string &what) const {
+    return what.empty() || what == "PPS";
+}
+
+long long SoapyLiteXXTRX::getHardwareTime(const std::string &what) const {
+    if (what == "PPS")
+        return _ppsTimeNs;
+    else if (!what.empty())
+        throw std::runtime_error("getHardwareTime(" + what + ") invalid");
+    return _timeNs + std::chrono::duration_cast<std::chrono::nanoseconds>(
+                         std::chrono::steady_clock::now() - _timeHost).count();
+}
+
+void SoapyLiteXXTRX::setHardwareTime(const long long timeNs, const std::string &what) {
+    if (what == "PPS") {
+        // the time of the PPS edge starting the next stream
+        _ppsTimeNs = timeNs;
+    } else if (what.empty()) {
+        _timeNs = timeNs;
+        _timeHost = std::chrono::steady_clock::now();
+    } else
+        throw std::runtime_error("setHardwareTime(" + what + ") invalid");
+}
+
+/*******************************************************************
+ * Sensor API
  ******************************************************************/
 
 std::vector<std::string> SoapyLiteXXTRX::listSensors(void) const {
@@ -806,6 +1233,7 @@ std::vector<std::string> SoapyLiteXXTRX::listSensors(void) const {
     sensors.push_back("xadc_vccaux");
     sensors.push_back("xadc_vccbram");
 #endif
+    sensors.push_back("rx_psd");
     return sensors;
 }
 
@@ -850,6 +1278,16 @@ SoapySDR::ArgInfo SoapyLiteXXTRX::getSensorInfo(const std::string &key) const {
             return info;
         }
 #endif
+        if (deviceStr == "rx" && sensorStr == "psd") {
+            info.key = "psd";
+            info.value = "";
+            info.units = "dBFS";
+            info.description = "Power spectrum of the first channel of the RX stream, "
+                               "from -rate/2 to +rate/2, as comma-separated values; "
+                               "needs a stream set up with psd=true";
+            info.type = SoapySDR::ArgInfo::STRING;
+            return info;
+        }
         throw std::runtime_error("SoapyLiteXXTRX::getSensorInfo(" + key +
                                  ") unknown device");
     }
@@ -891,6 +1329,12 @@ std::string SoapyLiteXXTRX::readSensor(const std::string &key) const {
             return sensorValue;
         }
 #endif
+        if (deviceStr == "rx" && sensorStr == "psd") {
+            if (!_rx_stream.psd)
+                throw std::runtime_error("SoapyLiteXXTRX::readSensor(" + key +
+                                         ") needs a stream set up with psd=true");
+            return formatPSD(_rx_stream.psd->read(0));
+        }
         throw std::runtime_error("SoapyLiteXXTRX::getSensorInfo(" + key +
                                  ") unknown device");
     }
@@ -912,28 +1356,34 @@ std::vector<std::string> SoapyLiteXXTRX::listRegisterInterfaces(void) const {
 
 
 void SoapyLiteXXTRX::writeRegister(const unsigned addr, const unsigned value) {
+    std::lock_guard<std::mutex> lock(_mutex);
     LMS7002M_spi_write(_lms, addr, value);
 }
 
 unsigned SoapyLiteXXTRX::readRegister(const unsigned addr) const {
+    std::lock_guard<std::mutex> lock(_mutex);
     return LMS7002M_spi_read(_lms, addr);
 }
 
 
 
 void SoapyLiteXXTRX::writeRegister(const std::string &name, const unsigned addr, const unsigned value) {
+    std::lock_guard<std::mutex> lock(_mutex);
     if (name == "LMS7002M") {
         LMS7002M_spi_write(_lms, addr, value);
     } else if (name == "LitePCI") {
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, addr, value);
     } else
         throw std::runtime_error("SoapyLiteXXTRX::writeRegister(" + name + ") unknown register");
 }
 
 unsigned SoapyLiteXXTRX::readRegister(const std::string &name, const unsigned addr) const {
+    std::lock_guard<std::mutex> lock(_mutex);
     if (name == "LMS7002M") {
         return LMS7002M_spi_read(_lms, addr);
     } else if (name == "LitePCI") {
+        litepcie_interface_flush(&_lms_spi);
         return litepcie_readl(_fd, addr);
     } else
         throw std::runtime_error("SoapyLiteXXTRX::readRegister(" + name + ") unknown register");
@@ -981,6 +1431,81 @@ std::string SoapyLiteXXTRX::readSetting(const std::string &key) const
                 + " TX hw count: " + std::to_string(_tx_stream.hw_count)
                 + " TX sw count: " + std::to_string(_tx_stream.sw_count)
                 + " TX user count: " + std::to_string(_tx_stream.user_count);
+    } else if (key == "TX_PIPELINE") {
+        return "ring fill: " + std::to_string(_tx_stream.pipeline_ring.fill())
+                + "/" + std::to_string(_tx_stream.pipeline_ring.count())
+                + " DMA fill: " + std::to_string(_tx_stream.dma_fill.load())
+                + "/" + std::to_string(_tx_stream.fill_target)
+                + " underflows: " + std::to_string(_tx_stream.underflow_count.load())
+                + " lost buffers: " + std::to_string(_tx_stream.lost_count.load());
+    } else if (key == "LMS7002M_SPI") {
+        return "words: " + std::to_string(_lms_spi.transferred)
+                + " syscalls: " + std::to_string(_lms_spi.syscalls)
+                + " batched: " + (_lms_spi.batched ? "yes" : "no")
+                + " reads avoided: " + std::to_string(_lms_spi.reads_avoided)
+                + " writes avoided: " + std::to_string(_lms_spi.writes_avoided)
+                + " writes merged: " + std::to_string(_lms_spi.writes_merged)
+                + " in transaction: " + (_lms_spi.transactions > 0 ? "yes" : "no");
+    } else if (key == "TUNE_CACHE") {
+        if (!_tune_cache)
+            throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key +
+                                     ") needs the tune_cache device argument enabled");
+        return _tune_cache->stats();
+    } else if (key == "HOP_REPORT") {
+        return hopReport();
+    } else if (key == "STREAM_STATUS") {
+        // totals behind the events reported by readStreamStatus
+        return "RX lost buffers: " + std::to_string(_rx_stream.lost_count.load())
+                + " RX dropped events: " + std::to_string(_rx_stream.events.dropped())
+                + " TX lost buffers: " + std::to_string(_tx_stream.lost_count.load())
+                + " TX dropped events: " + std::to_string(_tx_stream.events.dropped());
+    } else if (key == "RX_PSD") {
+        // a header line, then the spectrum of every channel of the stream
+        if (!_rx_stream.psd)
+            throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key +
+                                     ") needs a stream set up with psd=true");
+        const Spectrum &psd = *_rx_stream.psd;
+        const auto rate = _cachedSampleRates.find(SOAPY_SDR_RX);
+        const double bin_width = (rate == _cachedSampleRates.end()) ? 0 :
+            rate->second / psd.config().fft_size;
+        std::string blob = "updates: " + std::to_string(psd.updates())
+                + " fft size: " + std::to_string(psd.config().fft_size)
+                + " bin width: " + std::to_string(bin_width) + " Hz"
+                + " window: " + psd.config().window
+                + " averaging: " + (psd.config().max_hold ? "max" : "mean")
+                + " of " + std::to_string(psd.config().averages) + "\n";
+        for (size_t i = 0; i < _rx_stream.channels.size(); i++)
+            blob += "ch" + std::to_string(_rx_stream.channels[i]) + ": " +
+                    formatPSD(psd.read(i)) + "\n";
+        return blob;
+    } else if (key == "SNAPSHOT") {
+        if (!_rx_stream.snapshot)
+            throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key +
+                                     ") needs a stream set up with snapshot=true");
+        return std::string(_rx_stream.snapshot->ready() ? "ready" : "armed")
+                + " snapshots: " + std::to_string(_rx_stream.snapshot->count())
+                + " threshold triggers: " + std::to_string(_rx_stream.snapshot->thresholdTriggers());
+    } else if (key == "PLAYER") {
+        if (!_tx_stream.opened || !_tx_stream.playing)
+            throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key +
+                                     ") needs a stream set up with play_path");
+        const struct litepcie_player &player = _tx_stream.player;
+        return "loops: " + std::to_string(player.loops)
+                + " bytes: " + std::to_string(player.bytes)
+                + " underflows: " + std::to_string(_tx_stream.underflow_count.load())
+                + " lost buffers: " + std::to_string(_tx_stream.lost_count.load());
+    } else if (key == "RECORDER") {
+        if (!_rx_stream.opened || !_rx_stream.recording)
+            throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key +
+                                     ") needs a stream set up with record_path");
+        const struct litepcie_recorder &rec = _rx_stream.recorder;
+        return "files: " + std::to_string(rec.files)
+                + " bytes: " + std::to_string(rec.bytes)
+                + " buffers: " + std::to_string(rec.buffers)
+                + " gaps: " + std::to_string(rec.gap_count)
+                + " lost samples: " + std::to_string(rec.lost_samples)
+                + " O_DIRECT: " + (rec.direct ? "yes" : "no")
+                + " io_uring: " + (rec.ring_fd >= 0 ? "yes" : "no");
     } else
         throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key + ") unknown key");
 }
@@ -989,8 +1514,32 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
     SoapySDR::logf(SOAPY_SDR_DEBUG, "SoapyLiteXXTRX::writeSetting(%s, %s)",
                    key.c_str(), value.c_str());
 
+    // (before locking, as the hop thread needs the lock to stop)
+    if (key == "HOP_SCHEDULE") {
+        loadHops(value);
+        return;
+    } else if (key == "HOP_CANCEL") {
+        stopHopping();
+        return;
+    }
+
     std::lock_guard<std::mutex> lock(_mutex);
 
+    // hold back the LMS7002M writes of the following calls until COMMIT, and
+    // send them in as few batches as possible (reads, and the accesses to the
+    // FPGA's CSRs that must come after them, flush these early), merging
+    // consecutive writes of a register
+    if (key == "BEGIN_TRANSACTION") {
+        litepcie_interface_begin_transaction(&_lms_spi);
+        return;
+    } else if (key == "COMMIT") {
+        if (_lms_spi.transactions == 0)
+            throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key +
+                                     ") without BEGIN_TRANSACTION");
+        litepcie_interface_commit(&_lms_spi);
+        return;
+    }
+
     // undo any changes caused by one of the other keys with these enable calls
     if (key == "RXTSP_ENABLE")
         LMS7002M_rxtsp_enable(_lms, LMS_CHAB, value == "TRUE");
@@ -1081,6 +1630,11 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
                                      value + ") unknown value");
     } else if (key == "TRF_ENABLE_LOOPBACK") {
         LMS7002M_trf_enable_loopback(_lms, LMS_CHAB, value == "TRUE");
+    } else if (key == "SNAPSHOT_TRIGGER") {
+        if (!_rx_stream.snapshot)
+            throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key +
+                                     ") needs a stream set up with snapshot=true");
+        _rx_stream.snapshot->trigger();
     } else if (key == "RESET_RX_FIFO") {
         LMS7002M_reset_lml_fifo(_lms, LMS_RX);
     } else if (key == "FPGA_TX_RX_LOOPBACK_ENABLE") {
@@ -1092,9 +1646,11 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
         } else if (value != "FALSE")
             throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key + ", " +
                                      value + ") unknown value");
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_LMS7002M_CONTROL_ADDR, control);
     } else if (key == "FPGA_DMA_LOOPBACK_ENABLE") {
         SoapySDR::log(SOAPY_SDR_DEBUG, "Setting FPGA DMA Loopback");
+        litepcie_interface_flush(&_lms_spi);
         if (value == "TRUE")
              dma_set_loopback(_fd, true);
         else if (value == "FALSE")
@@ -1112,6 +1668,7 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
         } else if (value != "0")
             throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key + ", " +
                                      value + ") unknown value");
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_LMS7002M_TX_PATTERN_CONTROL_ADDR, control);
     } else if (key == "FPGA_RX_PATTERN") {
         SoapySDR::log(SOAPY_SDR_DEBUG, "Setting FPGA RX pattern");
@@ -1122,6 +1679,7 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
         } else if (value != "0")
             throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key + ", " +
                                      value + ") unknown value");
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_LMS7002M_RX_PATTERN_CONTROL_ADDR, control);
     } else if (key == "FPGA_TX_DELAY") {
         int delay = std::stoi(value);
@@ -1130,6 +1688,7 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
                                      value + ") invalid value");
         uint32_t reg = litepcie_readl(_fd, CSR_LMS7002M_DELAY_ADDR);
         uint32_t mask = ((uint32_t)(1 << CSR_LMS7002M_DELAY_TX_DELAY_SIZE)-1) << CSR_LMS7002M_DELAY_TX_DELAY_OFFSET;
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_LMS7002M_DELAY_ADDR,
                         (reg & ~mask) | (delay << CSR_LMS7002M_DELAY_TX_DELAY_OFFSET));
     } else if (key == "FPGA_RX_DELAY") {
@@ -1139,6 +1698,7 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
                                      value + ") invalid value");
         uint32_t reg = litepcie_readl(_fd, CSR_LMS7002M_DELAY_ADDR);
         uint32_t mask = ((uint32_t)(1 << CSR_LMS7002M_DELAY_RX_DELAY_SIZE)-1) << CSR_LMS7002M_DELAY_RX_DELAY_OFFSET;
+        litepcie_interface_flush(&_lms_spi);
         litepcie_writel(_fd, CSR_LMS7002M_DELAY_ADDR,
                         (reg & ~mask) | (delay << CSR_LMS7002M_DELAY_RX_DELAY_OFFSET));
     } else if (key == "DUMP_INI") {
@@ -1156,6 +1716,73 @@ void SoapyLiteXXTRX::writeSetting(const std::string &key, const std::string &val
                                  value + ") unknown key");
 }
 
+// The software corrections of a channel, and its position in the stream.
+StreamDSP &SoapyLiteXXTRX::streamDSP(const int direction, const size_t channel,
+                                     size_t &index) const {
+    const Stream &stream = (direction == SOAPY_SDR_RX) ? (const Stream &)_rx_stream
+                                                        : (const Stream &)_tx_stream;
+    if (!stream.opened || !stream.dsp)
+        throw std::runtime_error("Software processing needs a stream set up with dsp=true");
+    const auto it = std::find(stream.channels.begin(), stream.channels.end(), channel);
+    if (it == stream.channels.end())
+        throw std::runtime_error("Channel " + std::to_string(channel) + " is not streaming");
+    index = it - stream.channels.begin();
+    return *stream.dsp;
+}
+
+std::string SoapyLiteXXTRX::readSetting(const int direction, const size_t channel,
+                                        const std::string &key) const {
+    size_t index;
+    const StreamDSP &dsp = streamDSP(direction, channel, index);
+    const ChannelCorrection correction = dsp.getCorrection(index);
+
+    if (key == "IQ_CORRECTION") {
+        return formatFloatList(correction.iq_matrix, 4);
+    } else if (key == "DC_TRACKING" && direction == SOAPY_SDR_RX) {
+        return correction.dc_tracking ? "TRUE" : "FALSE";
+    } else if (key == "DC_TAU" && direction == SOAPY_SDR_RX) {
+        return std::to_string(correction.dc_tau);
+    } else if (key == "DC_ESTIMATE" && direction == SOAPY_SDR_RX) {
+        const std::complex<float> dc = dsp.getDCEstimate(index);
+        const float values[2] = {dc.real(), dc.imag()};
+        return formatFloatList(values, 2);
+    } else if (key == "DC_OFFSET" && direction == SOAPY_SDR_TX) {
+        const float values[2] = {correction.dc_offset.real(), correction.dc_offset.imag()};
+        return formatFloatList(values, 2);
+    } else if (key == "NCO_FREQ") {
+        return std::to_string(correction.nco_freq);
+    } else
+        throw std::runtime_error("SoapyLiteXXTRX::readSetting(" + key + ") unknown channel key");
+}
+
+void SoapyLiteXXTRX::writeSetting(const int direction, const size_t channel,
+                                  const std::string &key, const std::string &value) {
+    SoapySDR::logf(SOAPY_SDR_DEBUG, "SoapyLiteXXTRX::writeSetting(%s, %zu, %s, %s)",
+                   dir2Str(direction), channel, key.c_str(), value.c_str());
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    size_t index;
+    StreamDSP &dsp = streamDSP(direction, channel, index);
+    ChannelCorrection correction = dsp.getCorrection(index);
+
+    if (key == "IQ_CORRECTION") {
+        parseFloatList(value, correction.iq_matrix, 4);
+    } else if (key == "DC_TRACKING" && direction == SOAPY_SDR_RX) {
+        correction.dc_tracking = value == "TRUE";
+    } else if (key == "DC_TAU" && direction == SOAPY_SDR_RX) {
+        correction.dc_tau = std::stod(value);
+    } else if (key == "DC_OFFSET" && direction == SOAPY_SDR_TX) {
+        float dc[2];
+        parseFloatList(value, dc, 2);
+        correction.dc_offset = std::complex<float>(dc[0], dc[1]);
+    } else if (key == "NCO_FREQ") {
+        correction.nco_freq = std::stod(value);
+    } else
+        throw std::runtime_error("SoapyLiteXXTRX::writeSetting(" + key + ", " +
+                                 value + ") unknown channel key");
+    dsp.setCorrection(index, correction);
+}
+
 
 /***********************************************************************
  * Find available devices
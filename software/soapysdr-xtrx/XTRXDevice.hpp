@@ -12,7 +12,11 @@
 #include <SoapySDR/Logger.hpp>
 #include <SoapySDR/Time.hpp>
 #include <SoapySDR/Formats.hpp>
+#include <atomic>
+#include <chrono>
+#include <memory>
 #include <mutex>
+#include <thread>
 #include <cstring>
 #include <cstdlib>
 #include <stdexcept>
@@ -20,12 +24,32 @@
 
 #include <LMS7002M/LMS7002M.h>
 #include "liblitepcie.h"
+#include "litepcie_interface.h"
+#include "BufferRing.hpp"
+#include "Conversion.hpp"
+#include "EventQueue.hpp"
+#include "Snapshot.hpp"
+#include "Spectrum.hpp"
+#include "StreamDSP.hpp"
+#include "TuneCache.hpp"
+#include "WaitStrategy.hpp"
+#include "WorkerPool.hpp"
 
 #define DLL_EXPORT __attribute__ ((visibility ("default")))
-#define BYTES_PER_SAMPLE 2 // TODO validate this
 
 enum class TargetDevice { CPU, GPU };
 
+// Coalesce the LMS7002M register writes made during the lifetime of this
+// object (see litepcie_interface.h).
+class LMS7002MBatch {
+  public:
+    LMS7002MBatch(struct litepcie_interface *spi) : _spi(spi) { litepcie_interface_begin(_spi); }
+    ~LMS7002MBatch() { litepcie_interface_end(_spi); }
+
+  private:
+    struct litepcie_interface *_spi;
+};
+
 class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
   public:
     SoapyLiteXXTRX(const SoapySDR::Kwargs &args);
@@ -44,11 +68,13 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
     std::string getNativeStreamFormat(const int /*direction*/,
                                       const size_t /*channel*/,
                                       double &fullScale) const {
-        fullScale = 4096;
+        fullScale = NATIVE_FULL_SCALE;
         return SOAPY_SDR_CS16;
     }
 
     // Stream API
+    SoapySDR::ArgInfoList getStreamArgsInfo(const int direction,
+                                            const size_t channel) const override;
     SoapySDR::Stream *setupStream(const int direction,
                                   const std::string &format,
                                   const std::vector<size_t> &channels,
@@ -168,6 +194,15 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
     void setClockSource(const std::string &source) override;
     std::string getClockSource(void) const override;
 
+    // Time API
+    std::vector<std::string> listTimeSources(void) const override;
+    void setTimeSource(const std::string &source) override;
+    std::string getTimeSource(void) const override;
+    bool hasHardwareTime(const std::string &what = "") const override;
+    long long getHardwareTime(const std::string &what = "") const override;
+    void setHardwareTime(const long long timeNs,
+                         const std::string &what = "") override;
+
     // Sensor API
     std::vector<std::string> listSensors(void) const override;
     SoapySDR::ArgInfo getSensorInfo(const std::string &key) const override;
@@ -259,10 +294,38 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
     //  - RXTSP_ENABLE(TRUE/FALSE) - initialize the RX TSP chain
     //
     //  - TXTSP_ENABLE(TRUE/FALSE) - initialize the TX TSP chain
+    //
+    //  - HOP_SCHEDULE(hops) - retune at given times from a control thread,
+    //    replacing the schedule in progress. Hops are separated by newlines or
+    //    semicolons, each as `time_ns,rx|tx,channel,frequency[,gain]`, with the
+    //    device time (following the RX sample clock while the RX stream is
+    //    active) and the LO frequency in Hz. LOs missing from the tune cache
+    //    are calibrated when the schedule is loaded. HOP_REPORT returns the
+    //    latency of every hop executed, HOP_CANCEL stops the schedule.
     std::string readSetting(const std::string &key) const;
     void writeSetting(const std::string &key,
                       const std::string &value) override;
 
+    // Channel settings, adjusting the software processing of a stream set up
+    // with it (see the `dsp` stream arg) while it is running:
+    //
+    //  - IQ_CORRECTION(m00,m01,m10,m11) - get or set the IQ correction matrix.
+    //
+    //  - DC_TRACKING(TRUE/FALSE) - RX: get or set the DC offset tracking.
+    //
+    //  - DC_TAU(samples) - RX: get or set the time constant of the DC tracking.
+    //
+    //  - DC_ESTIMATE(i,q) - RX: get the DC offset currently removed.
+    //
+    //  - DC_OFFSET(i,q) - TX: get or set the DC offset added to the samples.
+    //
+    //  - NCO_FREQ(Hz) - get or set the frequency shift, without a phase jump.
+    std::string readSetting(const int direction, const size_t channel,
+                            const std::string &key) const override;
+    void writeSetting(const int direction, const size_t channel,
+                      const std::string &key,
+                      const std::string &value) override;
+
     int readStream(
         SoapySDR::Stream *stream,
         void * const *buffs,
@@ -280,16 +343,25 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
             const long long timeNs = 0,
             const long timeoutUs = 100000);
 
+    int readStreamStatus(
+        SoapySDR::Stream *stream,
+        size_t &chanMask,
+        int &flags,
+        long long &timeNs,
+        const long timeoutUs = 100000) override;
+
   private:
     SoapySDR::Stream *const TX_STREAM = (SoapySDR::Stream *)0x1;
     SoapySDR::Stream *const RX_STREAM = (SoapySDR::Stream *)0x2;
 
     struct litepcie_ioctl_mmap_dma_info _dma_mmap_info;
+    struct litepcie_dma_status *_dma_status;
     void *_dma_buf;
 
     struct Stream {
         Stream() : opened(false), remainderHandle(-1), remainderSamps(0),
-                   remainderOffset(0), remainderBuff(nullptr) {}
+                   remainderOffset(0), remainderBuff(nullptr),
+                   active(false), lost_count(0) {}
 
         bool opened;
         void *buf;
@@ -302,6 +374,36 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
         int8_t* remainderBuff;
         std::string format;
         std::vector<size_t> channels;
+
+        // retire buffers to the DMA engine every `retire_every` buffers or
+        // `retire_us` microseconds, whichever comes first
+        size_t retire_every;
+        long retire_us;
+        int64_t retired_count, release_count;
+        std::chrono::steady_clock::time_point retire_time;
+
+        // check for overflows/underflows every `detect_every` buffers
+        size_t detect_every;
+        size_t detect_countdown;
+
+        // how to wait for the DMA engine
+        WaitMode wait_mode;
+        long spin_us;
+
+        // threads sharing the sample conversion with the caller
+        std::unique_ptr<WorkerPool> workers;
+
+        // software processing replacing the converter, if requested
+        std::unique_ptr<StreamDSP> dsp;
+
+        // time of the first sample of the stream, and the rate it advances at
+        long long time0_ns;
+        double time_rate;
+        std::atomic<bool> active;
+
+        // events for readStreamStatus, and the DMA buffers lost to them
+        EventQueue events;
+        std::atomic<uint64_t> lost_count;
     };
 
     struct RXStream: Stream {
@@ -312,7 +414,37 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
         uint32_t bandwidth;
         uint64_t frequency;
 
+        rx_converter_t convert;
+
+        // optional thread draining the DMA ring into a larger software ring,
+        // signaling new buffers through an eventfd
+        size_t prefetch_buffers;
+        int prefetch_cpu;
+        BufferRing prefetch_ring;
+        std::thread prefetch_thread;
+        std::atomic<bool> prefetch_running;
+        struct pollfd prefetch_fds;
+
+        // power spectrum computed in the background, if requested
+        std::unique_ptr<Spectrum> psd;
+
+        // history handing out snapshots around triggers instead of the
+        // stream, if requested
+        std::unique_ptr<Snapshot> snapshot;
+
+        // thread recording the stream to disk instead of handing it out, if
+        // requested (pinned with the prefetch_cpu)
+        bool recording;
+        struct litepcie_recorder recorder;
+        std::thread record_thread;
+        std::atomic<bool> record_running;
+
         bool overflow;
+
+        // when decimating: the input sample the output is timed from, and the
+        // one expected next (anything else is a discontinuity)
+        int64_t resample_anchor;
+        int64_t resample_next;
     };
 
     struct TXStream: Stream {
@@ -323,15 +455,89 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
         uint64_t frequency;
         bool bias;
 
+        tx_converter_t convert;
+
         bool underflow;
 
         bool burst_end;
         int32_t burst_samps;
+
+        // first buffer that may hold samples since the ring was last zeroed
+        int64_t dirty_count;
+
+        // optional thread refilling the DMA ring from a software ring, keeping
+        // `fill_target` buffers queued; eventfds signal buffers and free space
+        size_t pipeline_buffers;
+        int pipeline_cpu;
+        int64_t fill_target;
+        BufferRing pipeline_ring;
+        std::thread pipeline_thread;
+        std::atomic<bool> pipeline_running;
+        struct pollfd pipeline_fds, space_fds;
+        std::atomic<int64_t> dma_fill;
+        std::atomic<uint64_t> underflow_count;
+
+        // thread playing a file instead of the samples written, if requested
+        // (pinned with the pipeline_cpu)
+        bool playing;
+        bool play_loop;
+        struct litepcie_player player;
+        std::thread play_thread;
+        std::atomic<bool> play_running;
     } ;
 
     RXStream _rx_stream;
     TXStream _tx_stream;
 
+    void refreshCounters(SoapySDR::Stream *stream);
+    long long sampleTime(SoapySDR::Stream *stream, const int64_t sample) const;
+    int acquireDMAReadBuffer(size_t &handle, const void **buffs, int &flags,
+                             long long &timeNs, const long timeoutUs);
+    int acquirePrefetchedBuffer(size_t &handle, const void **buffs, int &flags,
+                                long long &timeNs, const long timeoutUs);
+    void startPrefetch(void);
+    void stopPrefetch(void);
+    void prefetchLoop(void);
+    void startRecording(void);
+    void stopRecording(void);
+    void recordLoop(void);
+    int acquireDMAWriteBuffer(size_t &handle, void **buffs, const long timeoutUs);
+    void releaseDMAWriteBuffer(const size_t handle, const size_t numElems,
+                               const bool end_burst);
+    int acquirePipelineBuffer(size_t &handle, void **buffs, const long timeoutUs);
+    void releasePipelineBuffer(const size_t numElems, const bool end_burst);
+    void startPipeline(void);
+    void stopPipeline(void);
+    void pipelineLoop(void);
+    void startPlayback(void);
+    void stopPlayback(void);
+    void playLoop(void);
+    void resumeBurst(void);
+    void pushEvent(SoapySDR::Stream *stream, const int code, const int flags,
+                   const long long timeNs, const size_t lost);
+    void endBurst(const int64_t position);
+    long long syncStreamStart(const unsigned mode);
+    void syncStreamStop(void);
+    int64_t txPosition(void) const;
+    void cleanTxBuffers(void);
+    StreamDSP &streamDSP(const int direction, const size_t channel,
+                         size_t &index) const;
+    int readSnapshot(void *const *buffs, const size_t numElems, int &flags,
+                     long long &timeNs,
+                     const std::chrono::steady_clock::time_point &deadline);
+    int fillTxBuffers(const void *const *buffs, const size_t offset,
+                      const size_t numElems,
+                      const std::chrono::steady_clock::time_point &deadline,
+                      const bool flush = false);
+    void retireBuffers(SoapySDR::Stream *stream, const int64_t sw_count,
+                       const bool flush);
+    double tuneLO(const int direction, const double frequency,
+                  bool *replayed = NULL);
+    void loadHops(const std::string &table);
+    void stopHopping(void);
+    void hopLoop(void);
+    std::string hopReport(void) const;
+
     LMS7002M_dir_t dir2LMS(const int direction) const {
         return (direction == SOAPY_SDR_RX) ? LMS_RX : LMS_TX;
     }
@@ -345,13 +551,46 @@ class DLL_EXPORT SoapyLiteXXTRX : public SoapySDR::Device {
     }
 
     int _fd;
+    mutable struct litepcie_interface _lms_spi; // flushed by const CSR reads too
     LMS7002M_t *_lms;
     double _masterClockRate;
     double _refClockRate;
 
+    // device time, kept by the host
+    std::string _timeSource;
+    long long _timeNs;                               // device time at _timeHost
+    std::chrono::steady_clock::time_point _timeHost;
+    long long _ppsTimeNs;                            // time of the next PPS
+    unsigned _syncMode;                              // synchronizer armed, or 0
+    long long _syncTimeNs;                           // PPS edge it was armed for
+
+    // results of earlier LO tunes, or NULL if disabled
+    std::unique_ptr<TuneCache> _tune_cache;
+
+    // schedule of the hop thread, and what became of each hop
+    struct Hop {
+        long long time_ns;
+        int direction;
+        size_t channel;
+        double frequency;
+        double gain; // NaN to leave it as is
+
+        bool done;
+        long long start_ns; // device time the hop started at
+        bool rx_clock;      // whether that followed the RX sample clock
+        double tune_us, total_us;
+        bool replayed;
+        uint64_t words; // SPI words of the tune
+        std::string error;
+    };
+    std::vector<Hop> _hops;
+    mutable std::mutex _hop_mutex;
+    std::thread _hop_thread;
+    std::atomic<bool> _hop_running;
+
     // calibration data
     std::vector<std::map<std::string, std::string>> _calData;
 
-    // register protection
-    std::mutex _mutex;
+    // register protection (also taken by the const register reads)
+    mutable std::mutex _mutex;
 };
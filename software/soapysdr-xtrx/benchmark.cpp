@@ -0,0 +1,629 @@
+//
+// SoapySDR driver for the LMS7002M-based Fairwaves XTRX.
+//
+// Copyright (c) 2021 Julia Computing.
+// SPDX-License-Identifier: Apache-2.0
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+
+// Hardware-less benchmarks of the streaming code paths, operating on
+// synthetic DMA buffers.
+
+#include "Conversion.hpp"
+#include "Snapshot.hpp"
+#include "Spectrum.hpp"
+#include "StreamDSP.hpp"
+#include "WaitStrategy.hpp"
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+/* Helpers */
+/*---------*/
+
+static double now_s(void)
+{
+    using namespace std::chrono;
+    return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename T>
+static std::vector<T> random_buffer(size_t len)
+{
+    std::mt19937 rng(42);
+    std::vector<T> buf(len);
+    if (std::is_floating_point<T>::value) {
+        /* Slightly over full scale, to exercise saturation. */
+        std::uniform_real_distribution<double> dist(-1.1, 1.1);
+        for (auto &x : buf)
+            x = (T)dist(rng);
+    } else {
+        std::uniform_int_distribution<int> dist(-32768, 32767);
+        for (auto &x : buf)
+            x = (T)dist(rng);
+    }
+    return buf;
+}
+
+
+/* Conversion kernels */
+/*--------------------*/
+
+template <typename T>
+static void bench_format(const char *format, size_t frames, size_t iterations,
+                         deinterleave_t<T> ConversionKernels::*deinterleave,
+                         interleave_t<T> ConversionKernels::*interleave)
+{
+    const auto wire = random_buffer<int8_t>(frames * BYTES_PER_FRAME);
+    const auto user = random_buffer<T>(frames * 2);
+    const ConversionKernels *ref = listConversionKernels().front();
+
+    for (const ConversionKernels *k : listConversionKernels()) {
+        std::vector<T> rx(frames * 2), rx_ref(frames * 2);
+        std::vector<int8_t> tx(wire), tx_ref(wire);
+
+        /* Check against the scalar kernels. */
+        for (size_t channel = 0; channel < WIRE_CHANNELS; channel++) {
+            (ref->*deinterleave)(wire.data(), rx_ref.data(), frames, channel);
+            (k->*deinterleave)(wire.data(), rx.data(), frames, channel);
+            (ref->*interleave)(user.data(), tx_ref.data(), frames, channel);
+            (k->*interleave)(user.data(), tx.data(), frames, channel);
+            if (memcmp(rx.data(), rx_ref.data(), rx.size() * sizeof(T)) ||
+                tx != tx_ref) {
+                printf("%-6s %-8s MISMATCH on channel %zu\n", format, k->name, channel);
+                exit(1);
+            }
+        }
+
+        /* Measure throughput, converting both channels like a MIMO stream would. */
+        double start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            for (size_t channel = 0; channel < WIRE_CHANNELS; channel++)
+                (k->*deinterleave)(wire.data(), rx.data(), frames, channel);
+        double rx_time = now_s() - start;
+
+        start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            for (size_t channel = 0; channel < WIRE_CHANNELS; channel++)
+                (k->*interleave)(user.data(), tx.data(), frames, channel);
+        double tx_time = now_s() - start;
+
+        printf("%-6s %-8s %16.1f %16.1f\n", format, k->name,
+               frames * iterations / rx_time / 1e6,
+               frames * iterations / tx_time / 1e6);
+    }
+}
+
+static void bench_conversion(size_t frames, size_t iterations)
+{
+    printf("Conversion kernels, %zu frames per buffer (selected: %s)\n",
+           frames, getConversionKernels().name);
+    printf("%-6s %-8s %16s %16s\n", "format", "kernels", "RX (MS/s/ch)", "TX (MS/s/ch)");
+
+    bench_format<int8_t>("CS8", frames, iterations,
+                         &ConversionKernels::deinterleave_cs8,
+                         &ConversionKernels::interleave_cs8);
+    bench_format<int16_t>("CS16", frames, iterations,
+                          &ConversionKernels::deinterleave_cs16,
+                          &ConversionKernels::interleave_cs16);
+    bench_format<float>("CF32", frames, iterations,
+                        &ConversionKernels::deinterleave_cf32,
+                        &ConversionKernels::interleave_cf32);
+    bench_format<double>("CF64", frames, iterations,
+                         &ConversionKernels::deinterleave_cf64,
+                         &ConversionKernels::interleave_cf64);
+}
+
+
+/* Per-call overhead */
+/*------------------*/
+
+/* What readStream used to do for every call: compare the format string, once
+   per channel. */
+static void string_dispatch(const int8_t *src, void *const *buffs, size_t offset,
+                            size_t frames, std::string format,
+                            const std::vector<size_t> &channels)
+{
+    const ConversionKernels &kernels = getConversionKernels();
+    for (size_t i = 0; i < channels.size(); i++) {
+        if (format == "CS8")
+            kernels.deinterleave_cs8(src, (int8_t *)buffs[i] + offset * 2, frames, channels[i]);
+        else if (format == "CS16")
+            kernels.deinterleave_cs16(src, (int16_t *)buffs[i] + offset * 2, frames, channels[i]);
+        else if (format == "CF32")
+            kernels.deinterleave_cf32(src, (float *)buffs[i] + offset * 2, frames, channels[i]);
+        else if (format == "CF64")
+            kernels.deinterleave_cf64(src, (double *)buffs[i] + offset * 2, frames, channels[i]);
+    }
+}
+
+static void bench_converter(size_t iterations)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const rx_converter_t convert = getRXConverter(StreamFormat::CF32, channels);
+    const size_t max_frames = 1024;
+    const auto wire = random_buffer<int8_t>(max_frames * BYTES_PER_FRAME);
+    std::vector<float> ch0(max_frames * 2), ch1(max_frames * 2);
+    void *buffs[] = {ch0.data(), ch1.data()};
+
+    /* Make sure both paths agree before timing them. */
+    std::vector<float> ref0(ch0.size()), ref1(ch1.size());
+    void *ref_buffs[] = {ref0.data(), ref1.data()};
+    convert(wire.data(), buffs, 0, max_frames);
+    string_dispatch(wire.data(), ref_buffs, 0, max_frames, "CF32", channels);
+    if (ch0 != ref0 || ch1 != ref1) {
+        printf("converter MISMATCH\n");
+        exit(1);
+    }
+
+    printf("Per-call conversion cost, CF32 on 2 channels\n");
+    printf("%-8s %16s %16s\n", "frames", "string (ns)", "converter (ns)");
+    for (size_t frames = 1; frames <= max_frames; frames *= 4) {
+        double start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            string_dispatch(wire.data(), buffs, 0, frames, "CF32", channels);
+        double string_time = now_s() - start;
+
+        start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            convert(wire.data(), buffs, 0, frames);
+        double converter_time = now_s() - start;
+
+        printf("%-8zu %16.1f %16.1f\n", frames,
+               string_time / iterations * 1e9,
+               converter_time / iterations * 1e9);
+    }
+}
+
+
+/* Parallel conversion */
+/*---------------------*/
+
+/* Converts a ring of synthetic DMA buffers (larger than the caches, like a
+   real stream) for both channels, with an increasing number of workers. */
+template <typename T>
+static void bench_workers_format(const char *format, StreamFormat stream_format,
+                                 size_t frames, size_t iterations, size_t max_workers)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const rx_converter_t rx = getRXConverter(stream_format, channels);
+    const tx_converter_t tx = getTXConverter(stream_format, channels);
+    const size_t ring = 64;
+    auto wire = random_buffer<int8_t>(ring * frames * BYTES_PER_FRAME);
+    auto ch0 = random_buffer<T>(frames * 2), ch1 = random_buffer<T>(frames * 2);
+    void *buffs[] = {ch0.data(), ch1.data()};
+
+    double rx_base = 0, tx_base = 0;
+    for (size_t workers = 1; workers <= max_workers; workers++) {
+        WorkerPool pool(workers);
+
+        /* Check against a single-threaded conversion. */
+        std::vector<T> ref0(ch0.size()), ref1(ch1.size());
+        void *ref_buffs[] = {ref0.data(), ref1.data()};
+        std::vector<int8_t> tx_wire(frames * BYTES_PER_FRAME), tx_ref(frames * BYTES_PER_FRAME);
+        rx(wire.data(), ref_buffs, 0, frames);
+        convertParallel(pool, rx, wire.data(), buffs, 0, frames);
+        tx(buffs, tx_ref.data(), 0, frames);
+        convertParallel(pool, tx, buffs, tx_wire.data(), 0, frames);
+        if (ch0 != ref0 || ch1 != ref1 || tx_wire != tx_ref) {
+            printf("%-6s %-8zu MISMATCH\n", format, workers);
+            continue;
+        }
+
+        double start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            convertParallel(pool, rx, wire.data() + (i % ring) * frames * BYTES_PER_FRAME,
+                            buffs, 0, frames);
+        double rx_rate = frames * iterations / (now_s() - start) / 1e6;
+
+        start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            convertParallel(pool, tx, buffs, wire.data() + (i % ring) * frames * BYTES_PER_FRAME,
+                            0, frames);
+        double tx_rate = frames * iterations / (now_s() - start) / 1e6;
+
+        if (workers == 1) {
+            rx_base = rx_rate;
+            tx_base = tx_rate;
+        }
+        printf("%-6s %-8zu %12.1f %8.2fx %12.1f %8.2fx\n", format, workers,
+               rx_rate, rx_rate / rx_base, tx_rate, tx_rate / tx_base);
+    }
+}
+
+static void bench_workers(size_t frames, size_t iterations, size_t max_workers)
+{
+    printf("Parallel conversion on 2 channels, %zu frames per buffer (%s kernels)\n",
+           frames, getConversionKernels().name);
+    printf("%-6s %-8s %12s %9s %12s %9s\n", "format", "workers",
+           "RX (MS/s)", "speedup", "TX (MS/s)", "speedup");
+    bench_workers_format<int16_t>("CS16", StreamFormat::CS16, frames, iterations, max_workers);
+    bench_workers_format<float>("CF32", StreamFormat::CF32, frames, iterations, max_workers);
+}
+
+
+/* Software corrections */
+/*----------------------*/
+
+/* Compares plain conversion with the fused corrections, and with the same
+   corrections applied in a second pass over the converted samples, then adds
+   the NCO. */
+static void bench_dsp(size_t frames, size_t iterations)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const rx_converter_t convert = getRXConverter(StreamFormat::CF32, channels);
+    const size_t ring = 64;
+    const auto wire = random_buffer<int8_t>(ring * frames * BYTES_PER_FRAME);
+    std::vector<float> ch0(frames * 2), ch1(frames * 2);
+    void *buffs[] = {ch0.data(), ch1.data()};
+
+    ChannelCorrection correction;
+    const float m[4] = {1.02f, -0.03f, 0.01f, 0.98f};
+    std::copy(m, m + 4, correction.iq_matrix);
+    StreamDSP dsp(true, StreamFormat::CF32, channels);
+    for (size_t i = 0; i < channels.size(); i++)
+        dsp.setCorrection(i, correction);
+
+    /* Check the fused pass against a scalar second pass. */
+    std::vector<float> ref0(ch0.size()), ref1(ch1.size());
+    void *ref_buffs[] = {ref0.data(), ref1.data()};
+    convert(wire.data(), ref_buffs, 0, frames);
+    dsp.rx(wire.data(), buffs, 0, frames);
+    for (auto *ref : {&ref0, &ref1})
+        for (size_t k = 0; k < frames; k++) {
+            const float i = (*ref)[2 * k], q = (*ref)[2 * k + 1];
+            (*ref)[2 * k] = m[0] * i + m[1] * q;
+            (*ref)[2 * k + 1] = m[2] * i + m[3] * q;
+        }
+    for (size_t k = 0; k < ch0.size(); k++)
+        if (std::abs(ch0[k] - ref0[k]) > 1e-5f || std::abs(ch1[k] - ref1[k]) > 1e-5f) {
+            printf("dsp MISMATCH\n");
+            exit(1);
+        }
+
+    printf("Software corrections, CF32 on 2 channels, %zu frames per buffer\n", frames);
+    printf("%-24s %12s\n", "pass", "RX (MS/s)");
+
+    double start = now_s();
+    for (size_t i = 0; i < iterations; i++)
+        convert(wire.data() + (i % ring) * frames * BYTES_PER_FRAME, buffs, 0, frames);
+    printf("%-24s %12.1f\n", "conversion", frames * iterations / (now_s() - start) / 1e6);
+
+    start = now_s();
+    for (size_t i = 0; i < iterations; i++) {
+        convert(wire.data() + (i % ring) * frames * BYTES_PER_FRAME, buffs, 0, frames);
+        for (auto *ch : {&ch0, &ch1})
+            for (size_t k = 0; k < frames; k++) {
+                const float i = (*ch)[2 * k], q = (*ch)[2 * k + 1];
+                (*ch)[2 * k] = m[0] * i + m[1] * q;
+                (*ch)[2 * k + 1] = m[2] * i + m[3] * q;
+            }
+    }
+    printf("%-24s %12.1f\n", "conversion + 2nd pass", frames * iterations / (now_s() - start) / 1e6);
+
+    start = now_s();
+    for (size_t i = 0; i < iterations; i++)
+        dsp.rx(wire.data() + (i % ring) * frames * BYTES_PER_FRAME, buffs, 0, frames);
+    printf("%-24s %12.1f\n", "fused IQ", frames * iterations / (now_s() - start) / 1e6);
+
+    correction.dc_tracking = true;
+    for (size_t i = 0; i < channels.size(); i++)
+        dsp.setCorrection(i, correction);
+    start = now_s();
+    for (size_t i = 0; i < iterations; i++)
+        dsp.rx(wire.data() + (i % ring) * frames * BYTES_PER_FRAME, buffs, 0, frames);
+    printf("%-24s %12.1f\n", "fused IQ + DC tracking", frames * iterations / (now_s() - start) / 1e6);
+
+    correction.nco_freq = 123456.7;
+    dsp.setSampleRate(1e6);
+    for (size_t i = 0; i < channels.size(); i++)
+        dsp.setCorrection(i, correction);
+    start = now_s();
+    for (size_t i = 0; i < iterations; i++)
+        dsp.rx(wire.data() + (i % ring) * frames * BYTES_PER_FRAME, buffs, 0, frames);
+    printf("%-24s %12.1f\n", "fused IQ + DC + NCO", frames * iterations / (now_s() - start) / 1e6);
+}
+
+
+/* Resampling */
+/*------------*/
+
+/* Times the RX path with decimation, feeding wire samples the way readStream
+   does and draining the output, for a few factors. */
+static void bench_resample(size_t frames, size_t iterations)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const size_t ring = 64;
+    const auto wire = random_buffer<int8_t>(ring * frames * BYTES_PER_FRAME);
+    std::vector<float> ch0(frames * 2), ch1(frames * 2);
+    void *buffs[] = {ch0.data(), ch1.data()};
+
+    printf("Decimation, CF32 on 2 channels, %zu frames per buffer\n", frames);
+    printf("%-12s %12s %12s\n", "factor", "in (MS/s)", "out (MS/s)");
+
+    const char *factors[] = {"2", "4", "8", "16", "3", "10", "5/2"};
+    for (const char *factor : factors) {
+        unsigned num, den;
+        parseResamplingFactor(factor, num, den);
+        StreamDSP dsp(true, StreamFormat::CF32, channels);
+        dsp.setResampling(num, den);
+
+        size_t out = 0;
+        const double start = now_s();
+        for (size_t i = 0; i < iterations; i++) {
+            const int8_t *src = wire.data() + (i % ring) * frames * BYTES_PER_FRAME;
+            for (size_t k = 0; k < frames;) {
+                const size_t n = std::min(frames - k, dsp.maxInput());
+                dsp.rxInput(src + k * BYTES_PER_FRAME, n);
+                while (dsp.pending() > 0)
+                    out += dsp.rxOutput(buffs, 0, frames);
+                k += n;
+            }
+        }
+        const double elapsed = now_s() - start;
+        printf("%-12s %12.1f %12.1f\n", factor, frames * iterations / elapsed / 1e6, out / elapsed / 1e6);
+    }
+}
+
+
+/* Spectrum */
+/*----------*/
+
+/* Times the work of the PSD worker per FFT frame, which bounds the update rate
+   and averaging it can sustain, and the cost of the tap on the stream while the
+   worker isn't waiting for a frame. */
+static void bench_psd(size_t frames, size_t iterations)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const auto wire = random_buffer<int8_t>(65536 * BYTES_PER_FRAME);
+
+    printf("PSD on 2 channels\n");
+    printf("%-12s %16s\n", "FFT size", "us per frame");
+    for (size_t fft_size = 256; fft_size <= 65536; fft_size *= 4) {
+        SpectrumConfig config;
+        config.fft_size = fft_size;
+        config.rate = 1e-3;
+        Spectrum psd(config, channels);
+        const size_t n = std::max<size_t>(1, iterations * 1024 / fft_size / 10);
+        const double start = now_s();
+        for (size_t i = 0; i < n; i++)
+            psd.accumulate(wire.data(), i == 0);
+        printf("%-12zu %16.1f\n", fft_size, (now_s() - start) / n * 1e6);
+    }
+
+    /* the worker of a fresh spectrum only waits for its first update */
+    SpectrumConfig config;
+    config.rate = 1e-3;
+    Spectrum psd(config, channels);
+    while (psd.updates() == 0)
+        psd.tap(wire.data(), std::min<size_t>(frames, 65536));
+    const double start = now_s();
+    for (size_t i = 0; i < iterations * 100; i++)
+        psd.tap(wire.data(), std::min<size_t>(frames, 65536));
+    printf("idle tap: %.1f ns per buffer\n", (now_s() - start) / (iterations * 100) * 1e9);
+}
+
+
+/* Snapshots */
+/*-----------*/
+
+/* Times the history kept for snapshots, which the stream pays for every
+   sample, with and without the power threshold. */
+static void bench_snapshot(size_t frames, size_t iterations)
+{
+    const std::vector<size_t> channels = {0, 1};
+    const size_t ring = 64;
+    const auto wire = random_buffer<int8_t>(ring * frames * BYTES_PER_FRAME);
+
+    printf("Snapshot history of 1M samples on 2 channels, %zu frames per buffer\n", frames);
+    printf("%-24s %12s\n", "trigger", "RX (MS/s)");
+    for (const double threshold : {0.0, 10.0}) {
+        Snapshot snapshot(1 << 19, 1 << 19, threshold, channels);
+        const double start = now_s();
+        for (size_t i = 0; i < iterations; i++)
+            snapshot.push(wire.data() + (i % ring) * frames * BYTES_PER_FRAME,
+                          i * frames, frames);
+        printf("%-24s %12.1f\n", threshold > 0 ? "software + threshold" : "software",
+               frames * iterations / (now_s() - start) / 1e6);
+    }
+}
+
+
+/* Wakeup latency */
+/*----------------*/
+
+/* Emulates the DMA engine with a thread that publishes a buffer counter and
+   signals an eventfd (like the interrupt handler publishes hw_count and wakes up
+   poll), and measures how long the wait strategies take to notice. */
+static void bench_wakeup_mode(WaitMode mode, long spin_us, size_t events, long period_us)
+{
+    std::atomic<int64_t> hw_count(0);
+    std::vector<std::atomic<double>> stamps(events);
+    std::vector<double> latencies;
+    latencies.reserve(events);
+
+    struct pollfd fds;
+    fds.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    fds.events = POLLIN;
+    if (fds.fd < 0) {
+        perror("eventfd");
+        exit(1);
+    }
+
+    std::thread producer([&] {
+        for (size_t i = 0; i < events; i++) {
+            std::this_thread::sleep_for(std::chrono::microseconds(period_us));
+            stamps[i].store(now_s(), std::memory_order_relaxed);
+            hw_count.store(i + 1, std::memory_order_release);
+            uint64_t one = 1;
+            if (write(fds.fd, &one, sizeof(one)) < 0)
+                perror("write");
+        }
+    });
+
+    int64_t user_count = 0;
+    while (user_count < (int64_t)events) {
+        bool ready = waitFor(fds, mode, spin_us, 1000000, [&] {
+            return hw_count.load(std::memory_order_acquire) > user_count;
+        });
+        double now = now_s();
+        if (!ready) {
+            printf("%-6s timeout\n", waitModeName(mode));
+            exit(1);
+        }
+
+        uint64_t value;
+        if (read(fds.fd, &value, sizeof(value)) < 0 && errno != EAGAIN)
+            perror("read");
+
+        /* Only the oldest new buffer was waited for. */
+        latencies.push_back(now - stamps[user_count].load(std::memory_order_relaxed));
+        user_count = hw_count.load(std::memory_order_acquire);
+    }
+    producer.join();
+    close(fds.fd);
+
+    /* Histogram */
+    static const double bins_us[] = {1, 2, 5, 10, 20, 50, 100, 1000};
+    size_t counts[sizeof(bins_us) / sizeof(bins_us[0]) + 1] = {0};
+    for (double l : latencies) {
+        size_t b = 0;
+        while (b < sizeof(bins_us) / sizeof(bins_us[0]) && l * 1e6 >= bins_us[b])
+            b++;
+        counts[b]++;
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("%-6s %8.1f %8.1f %8.1f  ", waitModeName(mode),
+           latencies[latencies.size() / 2] * 1e6,
+           latencies[latencies.size() * 99 / 100] * 1e6,
+           latencies.back() * 1e6);
+    for (size_t c : counts)
+        printf(" %6zu", c);
+    printf("\n");
+}
+
+static void bench_wakeup(size_t events, long period_us, long spin_us)
+{
+    printf("Wakeup latency, %zu buffers every %ld us (spin: %ld us)\n",
+           events, period_us, spin_us);
+    printf("%-6s %8s %8s %8s   %6s %6s %6s %6s %6s %6s %6s %6s %6s\n",
+           "mode", "p50 (us)", "p99 (us)", "max (us)",
+           "<1", "<2", "<5", "<10", "<20", "<50", "<100", "<1000", ">=1000");
+    bench_wakeup_mode(WaitMode::SLEEP, spin_us, events, period_us);
+    bench_wakeup_mode(WaitMode::SPIN, spin_us, events, period_us);
+    bench_wakeup_mode(WaitMode::BUSY, spin_us, events, period_us);
+}
+
+
+/* Help */
+/*------*/
+
+static void help(void)
+{
+    printf("SoapyLiteXXTRX streaming benchmarks\n"
+           "usage: benchmark [options] cmd [args...]\n"
+           "\n"
+           "options:\n"
+           "-h                               Help.\n"
+           "-f frames                        Frames per DMA buffer (default = 8192).\n"
+           "-n iterations                    Buffers to process (default = 10000).\n"
+           "\n"
+           "conversion                       Check and time the conversion kernels.\n"
+           "converter                        Time the per-call cost of stream conversion.\n"
+           "wakeup [period_us] [spin_us]     Measure the wakeup latency of the wait strategies.\n"
+           "workers [max_workers]            Time parallel conversion with 1 to max_workers (default = 8) workers.\n"
+           "dsp                              Time the software corrections and NCO.\n"
+           "resample                         Time decimation by a few factors.\n"
+           "psd                              Time the background power spectrum.\n"
+           "snapshot                         Time the history kept for snapshots.\n"
+           );
+    exit(1);
+}
+
+/* Main */
+/*------*/
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    int c;
+    size_t frames = 8192;
+    size_t iterations = 10000;
+
+    /* Parameters. */
+    for (;;) {
+        c = getopt(argc, argv, "hf:n:");
+        if (c == -1)
+            break;
+        switch(c) {
+        case 'h':
+            help();
+            break;
+        case 'f':
+            frames = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            iterations = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            exit(1);
+        }
+    }
+
+    /* Show help when too much args. */
+    if (optind >= argc)
+        help();
+
+    cmd = argv[optind++];
+
+    /* Conversion cmd. */
+    if (!strcmp(cmd, "conversion")) {
+        bench_conversion(frames, iterations);
+    /* Converter cmd. */
+    } else if (!strcmp(cmd, "converter")) {
+        bench_converter(iterations * 100);
+    /* Wakeup cmd. */
+    } else if (!strcmp(cmd, "wakeup")) {
+        long period_us = 200;
+        long spin_us = 50;
+        if (optind < argc)
+            period_us = strtol(argv[optind++], NULL, 0);
+        if (optind < argc)
+            spin_us = strtol(argv[optind++], NULL, 0);
+        bench_wakeup(iterations, period_us, spin_us);
+    /* Workers cmd. */
+    } else if (!strcmp(cmd, "workers")) {
+        size_t max_workers = 8;
+        if (optind < argc)
+            max_workers = strtoul(argv[optind++], NULL, 0);
+        bench_workers(frames, iterations, max_workers);
+    /* DSP cmd. */
+    } else if (!strcmp(cmd, "dsp")) {
+        bench_dsp(frames, iterations);
+    /* Resample cmd. */
+    } else if (!strcmp(cmd, "resample")) {
+        bench_resample(frames, iterations);
+    /* PSD cmd. */
+    } else if (!strcmp(cmd, "psd")) {
+        bench_psd(frames, iterations);
+    /* Snapshot cmd. */
+    } else if (!strcmp(cmd, "snapshot")) {
+        bench_snapshot(frames, iterations);
+    /* Show help otherwise. */
+    } else
+        help();
+
+    return 0;
+}
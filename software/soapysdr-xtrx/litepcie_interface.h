@@ -1,6 +1,13 @@
+#pragma once
+
 #include "liblitepcie.h"
 
+#include <LMS7002M/LMS7002M_logger.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
 #include <unistd.h>
 
 #define LITEPCIE_SPI_CS_HIGH (0 << 0)
@@ -9,22 +16,253 @@
 #define LITEPCIE_SPI_DONE    (1 << 0)
 #define LITEPCIE_SPI_LENGTH  (1 << 8)
 
-static inline uint32_t litepcie_interface_transact(void *handle, const uint32_t data_in, const bool readback)
+// SPI access to the LMS7002M, handed to LMS7002M_create as the transact
+// callback's handle.
+//
+// Words are sent to the driver in batches (LITEPCIE_IOCTL_LMS7002M_SPI), which
+// runs them back-to-back and polls for their completion in the kernel, instead
+// of taking several register ioctls per word. Between litepcie_interface_begin
+// and litepcie_interface_end, writes are also held back and coalesced with the
+// next ones, until a read needs the SPI bus (or the batch is full); outside of
+// these, every word is sent right away. Drivers without the batched ioctl fall
+// back to register accesses.
+//
+// Explicit transactions (litepcie_interface_begin_transaction and
+// litepcie_interface_commit) also merge consecutive writes of a register: a
+// write of the register queued last replaces its value, unless the register is
+// volatile or holds the resets. Only the last word is replaced, so that the
+// order of the writes to different registers is kept; writes that only matter
+// through their intermediate value (e.g. a reset pulse) shouldn't be made in
+// an explicit transaction.
+//
+// The registers are also shadowed: reads of registers whose value is known are
+// served from the shadow, and writes of the value a register already holds are
+// dropped. The registers that change by themselves (status, readback and
+// self-clearing bits) are listed in litepcie_interface_volatile and always go
+// to the chip. Registers 0x0100 to 0x05ff exist once per channel, selected by
+// the MAC field of 0x0020, and are shadowed per channel. A write asserting any
+// of the resets of 0x0020 forgets the whole shadow.
+
+// Registers shadowed, and the channel-specific ones.
+#define LMS7002M_SHADOW_SIZE   0x0800
+#define LMS7002M_CHANNEL_START 0x0100
+#define LMS7002M_CHANNEL_END   0x0600
+
+// Register holding the resets (active low, bits 15:8) and the MAC field.
+#define LMS7002M_REG_RESETS 0x0020
+#define LMS7002M_RESETS     0xff00
+#define LMS7002M_MAC        0x0003
+
+struct litepcie_interface {
+    int fd;
+    bool batched;
+    int depth, transactions;
+    uint32_t count;
+    uint32_t words[LITEPCIE_LMS7002M_SPI_MAX];
+
+    // register shadow, per channel (the first one for global registers)
+    bool shadowed;
+    uint16_t mac;
+    uint16_t shadow[2][LMS7002M_SHADOW_SIZE];
+    bool known[2][LMS7002M_SHADOW_SIZE];
+
+    // statistics: words transferred and syscalls it took, and transactions
+    // served from the shadow
+    uint64_t transferred, syscalls;
+    uint64_t reads_avoided, writes_avoided, writes_merged;
+};
+
+static inline void litepcie_interface_init(struct litepcie_interface *spi, const int fd)
+{
+    memset(spi, 0, sizeof(*spi));
+    spi->fd = fd;
+    spi->batched = true;
+    spi->shadowed = true;
+}
+
+// Registers whose value can't be shadowed.
+static inline bool litepcie_interface_volatile(const uint16_t addr)
+{
+    return addr <= 0x0006 ||                    // MCU control, status and data
+           addr == 0x008c ||                    // CGEN VCO comparators
+           addr == 0x0123 ||                    // SXR/SXT VCO comparators
+           addr == 0x0400 ||                    // RxTSP capture trigger
+           addr == 0x040e || addr == 0x040f ||  // RxTSP readback (RSSI, DC)
+           (addr >= 0x05c0 && addr <= 0x05cc) || // DC calibration start and status
+           (addr >= 0x0600 && addr <= 0x0641) || // detectors and calibration comparators
+           addr >= LMS7002M_SHADOW_SIZE;
+}
+
+// Channels of the shadow a register maps to, as a mask (0 if not shadowed).
+static inline unsigned litepcie_interface_banks(const struct litepcie_interface *spi, const uint16_t addr)
 {
-    int *fd = (int *)handle;
+    if (!spi->shadowed || litepcie_interface_volatile(addr))
+        return 0;
+    if (addr < LMS7002M_CHANNEL_START || addr >= LMS7002M_CHANNEL_END)
+        return 1;
+    return spi->mac & LMS7002M_MAC;
+}
 
+// Forget the shadow, e.g. when the chip was reset behind our back.
+static inline void litepcie_interface_invalidate(struct litepcie_interface *spi)
+{
+    memset(spi->known, 0, sizeof(spi->known));
+    spi->mac = 0;
+}
+
+// Run a word through the register interface, replacing a read by its readback.
+static inline void litepcie_interface_transfer(struct litepcie_interface *spi, uint32_t *word)
+{
     //load tx data
-    litepcie_writel(*fd, CSR_LMS7002M_SPI_MOSI_ADDR, data_in);
+    litepcie_writel(spi->fd, CSR_LMS7002M_SPI_MOSI_ADDR, *word);
 
     //start transaction
-    litepcie_writel(*fd, CSR_LMS7002M_SPI_CONTROL_ADDR, 32*LITEPCIE_SPI_LENGTH | LITEPCIE_SPI_START);
+    litepcie_writel(spi->fd, CSR_LMS7002M_SPI_CONTROL_ADDR, 32*LITEPCIE_SPI_LENGTH | LITEPCIE_SPI_START);
+    spi->syscalls += 2;
 
     //wait for completion
-    while ((litepcie_readl(*fd, CSR_LMS7002M_SPI_STATUS_ADDR) & LITEPCIE_SPI_DONE) == 0);
+    do
+        spi->syscalls++;
+    while ((litepcie_readl(spi->fd, CSR_LMS7002M_SPI_STATUS_ADDR) & LITEPCIE_SPI_DONE) == 0);
+
+    //load rx data
+    if (!(*word & (1u << 31))) {
+        spi->syscalls++;
+        *word = litepcie_readl(spi->fd, CSR_LMS7002M_SPI_MISO_ADDR) & 0xffff;
+    }
+}
+
+// Send the queued words, replacing the reads by their readback. Return false
+// if they were dropped instead (having logged why).
+static inline bool litepcie_interface_flush(struct litepcie_interface *spi)
+{
+    if (spi->count == 0)
+        return true;
+
+    if (spi->batched) {
+        struct litepcie_ioctl_lms7002m_spi m;
+        m.count = spi->count;
+        m.words = (uintptr_t)spi->words;
+        spi->syscalls++;
+        if (ioctl(spi->fd, LITEPCIE_IOCTL_LMS7002M_SPI, &m) == 0) {
+            spi->transferred += spi->count;
+            spi->count = 0;
+            return true;
+        }
+        // this is called from the LMS7002M driver, which can't be unwound
+        // through, so rather than throwing: without the batched ioctl, which
+        // then didn't run any of the words, fall back to register accesses;
+        // otherwise, log the failure and drop the batch rather than sending it
+        // again, as part of it may have run already (and repeating a
+        // self-clearing or triggering write isn't harmless), and forget the
+        // shadow, which holds writes that may not have been made
+        if (errno != ENOTTY) {
+            LMS7_logf(LMS7_ERROR, "LMS7002M SPI batch of %u words failed: %s",
+                      spi->count, strerror(errno));
+            litepcie_interface_invalidate(spi);
+            spi->count = 0;
+            return false;
+        }
+        spi->batched = false;
+    }
+
+    for (uint32_t i = 0; i < spi->count; i++)
+        litepcie_interface_transfer(spi, &spi->words[i]);
+    spi->transferred += spi->count;
+    spi->count = 0;
+    return true;
+}
+
+static inline void litepcie_interface_begin(struct litepcie_interface *spi)
+{
+    spi->depth++;
+}
+
+static inline void litepcie_interface_end(struct litepcie_interface *spi)
+{
+    if (--spi->depth == 0)
+        litepcie_interface_flush(spi);
+}
+
+static inline void litepcie_interface_begin_transaction(struct litepcie_interface *spi)
+{
+    spi->transactions++;
+    litepcie_interface_begin(spi);
+}
+
+static inline void litepcie_interface_commit(struct litepcie_interface *spi)
+{
+    spi->transactions--;
+    litepcie_interface_end(spi);
+}
+
+static inline uint32_t litepcie_interface_transact(void *handle, const uint32_t data_in, const bool readback)
+{
+    struct litepcie_interface *spi = (struct litepcie_interface *)handle;
+    const bool write = (data_in >> 31) & 1;
+    const uint16_t addr = (data_in >> 16) & 0x7fff;
+    const uint16_t value = data_in & 0xffff;
+    unsigned banks = litepcie_interface_banks(spi, addr);
+
+    if (write) {
+        // drop writes that wouldn't change anything
+        bool unchanged = banks != 0;
+        for (unsigned b = 0; b < 2; b++)
+            if (banks & (1 << b))
+                unchanged &= spi->known[b][addr] && spi->shadow[b][addr] == value;
+        if (unchanged) {
+            spi->writes_avoided++;
+            return 0;
+        }
+
+        if (addr == LMS7002M_REG_RESETS) {
+            if ((value & LMS7002M_RESETS) != LMS7002M_RESETS)
+                litepcie_interface_invalidate(spi);
+            spi->mac = value & LMS7002M_MAC;
+        }
+        for (unsigned b = 0; b < 2; b++) {
+            if (banks & (1 << b)) {
+                spi->shadow[b][addr] = value;
+                spi->known[b][addr] = true;
+            }
+        }
+    } else if (banks == 1 || banks == 2) {
+        // serve reads of a single channel from the shadow
+        if (spi->known[banks - 1][addr]) {
+            spi->reads_avoided++;
+            return spi->shadow[banks - 1][addr];
+        }
+    } else {
+        // reads of both channels at once return the first one's
+        banks = 0;
+    }
+
+    // in explicit transactions, merge with the write queued last if it is of
+    // the same register (replacing an older word would reorder the writes)
+    if (write && spi->transactions > 0 && spi->count > 0 &&
+        addr != LMS7002M_REG_RESETS && !litepcie_interface_volatile(addr)) {
+        const uint32_t last = spi->words[spi->count - 1];
+        if (((last >> 31) & 1) && ((last >> 16) & 0x7fff) == addr) {
+            spi->words[spi->count - 1] = data_in;
+            spi->writes_merged++;
+            return 0;
+        }
+    }
+
+    const uint32_t index = spi->count;
+    bool sent = true;
+    spi->words[spi->count++] = data_in;
+    if (readback || spi->depth == 0 || spi->count == LITEPCIE_LMS7002M_SPI_MAX)
+        sent = litepcie_interface_flush(spi);
 
     //load rx data
     if (readback) {
-        return litepcie_readl(*fd, CSR_LMS7002M_SPI_MISO_ADDR) & 0xffff;
+        const uint16_t readback_value = spi->words[index] & 0xffff;
+        if (!write && banks && sent) {
+            spi->shadow[banks - 1][addr] = readback_value;
+            spi->known[banks - 1][addr] = true;
+        }
+        return readback_value;
     } else {
         return 0;
     }
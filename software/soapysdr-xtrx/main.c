@@ -43,7 +43,9 @@ int main(int argc, char **argv)
 
     //create and test lms....
     printf("Create LMS7002M instance\n");
-    LMS7002M_t *lms = LMS7002M_create(litepcie_interface_transact, &fd);
+    struct litepcie_interface spi;
+    litepcie_interface_init(&spi, fd);
+    LMS7002M_t *lms = LMS7002M_create(litepcie_interface_transact, &spi);
     if (lms == NULL) return EXIT_FAILURE;
     LMS7002M_reset(lms);
     LMS7002M_set_spi_mode(lms, 4); //set 4-wire spi before reading back